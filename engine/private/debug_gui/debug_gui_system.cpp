@@ -67,6 +67,11 @@ namespace DebugGui
 		return ImGui::DragFloat(label, &f, step, min, max);
 	}
 
+	bool DebugGuiSystem::DragInt(const char* label, int& i, float step, int min, int max)
+	{
+		return ImGui::DragInt(label, &i, step, min, max);
+	}
+
 	bool DebugGuiSystem::DragVector(const char* label, glm::vec3& v, float step, float min, float max)
 	{
 		return ImGui::DragFloat3(label, glm::value_ptr(v), step, min, max);
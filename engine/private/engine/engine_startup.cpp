@@ -11,11 +11,10 @@ SDLEngine
 namespace Engine
 {
 	// Application entry point
-	int Run(IAppSystemRegistrar& sysRegistrar, int argc, char* args[])
+	int Run(IAppSystemRegistrar& sysRegistrar, int argc, char* args[], Kernel::Platform::Features platformFeatures)
 	{
-		// Initialise platform stuff
-		Kernel::Platform::InitResult result = Kernel::Platform::Initialise(argc, args);
-		SDE_ASSERT(result == Kernel::Platform::InitResult::InitOK);
+		// Initialise platform stuff, failures are logged by the platform
+		Kernel::Platform::InitResult result = Kernel::Platform::Initialise(argc, args, platformFeatures);
 		if (result == Kernel::Platform::InitResult::InitFailed)
 		{
 			return 1;
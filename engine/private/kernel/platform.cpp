@@ -5,20 +5,18 @@ SDLEngine
 
 #include "platform.h"
 #include "log.h"
-#include "assert.h"
 #include <SDL.h>
 
 namespace Kernel
 {
 	namespace Platform
 	{
-		InitResult Platform::Initialise(int argc, char* argv[])
+		InitResult Platform::Initialise(int argc, char* argv[], Features features)
 		{
 			SDE_LOGC(Engine, "Initialising Platform");
 
-			int sdlResult = SDL_Init(SDL_INIT_EVERYTHING);
-			SDE_ASSERT(sdlResult == 0);
-
+			// Headless tools may run where there is no display or input device, so failing here is reported rather than asserted
+			int sdlResult = SDL_Init(features == Features::Headless ? SDL_INIT_TIMER : SDL_INIT_EVERYTHING);
 			if (sdlResult != 0)
 			{
 				SDE_LOGC(Engine, "Failed to initialise SDL:\r\n\t%s", SDL_GetError());
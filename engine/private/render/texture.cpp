@@ -293,6 +293,30 @@ namespace Render
 		return true;
 	}
 
+	bool Texture::Update(uint32_t x, uint32_t y, uint32_t width, uint32_t height, const uint32_t* data, uint32_t rowLength)
+	{
+		SDE_RENDER_ASSERT(m_handle != 0);
+		SDE_ASSERT(data != nullptr && rowLength >= width);
+		if (m_isArray)
+		{
+			return false;
+		}
+
+		glBindTexture(GL_TEXTURE_2D, m_handle);
+		SDE_RENDER_PROCESS_GL_ERRORS_RET("glBindTexture");
+
+		// Row length is global unpack state, so always put it back even if the upload fails
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, rowLength);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, data);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		SDE_RENDER_PROCESS_GL_ERRORS_RET("glTexSubImage2D");
+
+		glBindTexture(GL_TEXTURE_2D, 0);
+		SDE_RENDER_PROCESS_GL_ERRORS_RET("glBindTexture");
+
+		return true;
+	}
+
 	bool Texture::Create(const std::vector<TextureSource>& src)
 	{
 		SDE_RENDER_ASSERT(m_handle == 0);
@@ -6,8 +6,8 @@ Matt Hoyle
 
 namespace SDE
 {
-	JobSystem::JobSystem()
-		: m_threadCount(4)
+	JobSystem::JobSystem(int32_t threadCount)
+		: m_threadCount(threadCount)
 		, m_jobThreadTrigger(0)
 		, m_jobThreadStopRequested(0)
 	{
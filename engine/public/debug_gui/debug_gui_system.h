@@ -45,6 +45,7 @@ namespace DebugGui
 		void GraphHistogram(const char* label, glm::vec2 size, GraphDataBuffer& buffer);
 		bool Checkbox(const char* text, bool* val);
 		bool DragFloat(const char* label, float& f, float step = 1.0f, float min = 0.0f, float max = 0.0f);
+		bool DragInt(const char* label, int& i, float step = 1.0f, int min = 0, int max = 0);
 		bool DragVector(const char* label, glm::vec4& v, float step = 1.0f, float min = 0.0f, float max = 0.0f);
 		bool DragVector(const char* label, glm::vec3& v, float step = 1.0f, float min = 0.0f, float max = 0.0f);
 		bool ColourEdit(const char* label, glm::vec4& c, bool showAlpha = true);
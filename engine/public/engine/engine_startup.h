@@ -5,6 +5,8 @@ SDLEngine
 
 #pragma once
 
+#include "kernel/platform.h"
+
 namespace Core
 {
 	class ISystemRegistrar;
@@ -20,5 +22,5 @@ namespace Engine
 	};
 
 	// This runs everything. Call it from main()!
-	int Run(IAppSystemRegistrar& sysRegistrar, int argc, char* args[]);
+	int Run(IAppSystemRegistrar& sysRegistrar, int argc, char* args[], Kernel::Platform::Features platformFeatures = Kernel::Platform::Features::All);
 }
\ No newline at end of file
@@ -19,7 +19,13 @@ namespace Kernel
 			ShutdownOK
 		};
 
-		InitResult Initialise(int argc, char* argv[]);
+		enum class Features
+		{
+			All,			// Video, audio, input devices etc.
+			Headless,		// Only what threads + timers need, for command line tools
+		};
+
+		InitResult Initialise(int argc, char* argv[], Features features = Features::All);
 		ShutdownResult Shutdown();
 	}
 }
@@ -16,6 +16,9 @@ namespace Render
 		~Texture();
 
 		bool Update(const std::vector<TextureSource>& src);
+		// Uploads a width x height rectangle of RGBA8 pixels into mip 0 at x,y straight from data, nothing is copied
+		// rowLength = pixels from the start of one row to the next, so the rectangle can be part of a larger image
+		bool Update(uint32_t x, uint32_t y, uint32_t width, uint32_t height, const uint32_t* data, uint32_t rowLength);
 		bool Create(const std::vector<TextureSource>& src);
 		void Destroy();
 
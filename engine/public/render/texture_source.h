@@ -30,7 +30,7 @@ namespace Render
 
 		TextureSource();
 		TextureSource(uint32_t w, uint32_t h, Format f, std::vector<MipDesc>& mips, std::vector<uint8_t>& data);
-		TextureSource(uint32_t w, uint32_t h, Format f, std::vector<MipDesc>& mips, std::vector<uint32_t>& data);
+		TextureSource(uint32_t w, uint32_t h, Format f, std::vector<MipDesc>& mips, const std::vector<uint32_t>& data);
 		~TextureSource();
 
 		inline uint32_t Width() const { return m_width; }
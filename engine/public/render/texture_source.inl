@@ -16,13 +16,13 @@ namespace Render
 	{
 	}
 
-	inline TextureSource::TextureSource(uint32_t w, uint32_t h, Format f, std::vector<MipDesc>& mips, std::vector<uint32_t>& data)
+	inline TextureSource::TextureSource(uint32_t w, uint32_t h, Format f, std::vector<MipDesc>& mips, const std::vector<uint32_t>& data)
 		: m_width(w)
 		, m_height(h)
 		, m_format(f)
 		, m_mipDescriptors(mips)
 	{
-		m_rawBuffer.insert(m_rawBuffer.begin(), (uint8_t*)data.data(), (uint8_t*)data.data() + (data.size() * 4));
+		m_rawBuffer.insert(m_rawBuffer.begin(), (const uint8_t*)data.data(), (const uint8_t*)data.data() + (data.size() * 4));
 	}
 
 	inline TextureSource::~TextureSource()
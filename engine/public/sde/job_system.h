@@ -15,13 +15,14 @@ namespace SDE
 	class JobSystem : public Core::ISystem
 	{
 	public:
-		JobSystem();
+		JobSystem(int32_t threadCount = 4);
 		virtual ~JobSystem();
 
 		virtual bool Initialise() override;
 		virtual void Shutdown() override;
 
 		void PushJob(Job::JobThreadFunction threadFn, const char* dbgName="");
+		inline int32_t GetThreadCount() const { return m_threadCount; }
 
 	private:
 		Core::ThreadPool m_threadPool;
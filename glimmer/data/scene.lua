@@ -4,18 +4,26 @@ local function randFloat(min,max)
 	return math.min(min,max) + math.random() * math.abs(max-min)
 end
 
+-- Generated primitives are added in one call each, as flat arrays of their values
+local spheres = {}
 for i = 0, 20 do
-	glimmer.scene.addSphere(math.random(-100,100), math.random(-32,64), math.random(0,50), math.random(4,12), false)
+	local n = #spheres
+	spheres[n+1], spheres[n+2], spheres[n+3], spheres[n+4] = math.random(-100,100), math.random(-32,64), math.random(0,50), math.random(4,12)
 end
+glimmer.scene.addSpheres(spheres, false)
 glimmer.scene.addSphere(-35, 82, 130, 64, false)
 
 glimmer.scene.addPlane(0,1,0,0,-100,0,false)
 
 -- Lights
+local lights = {}
 for i = 0, 6 do
-	glimmer.scene.addLight(math.random(-250,250),math.random(200,500),math.random(-250,250),
-	randFloat(0.0,0.25),randFloat(0.0,0.25),randFloat(0.0,0.25))
+	local n = #lights
+	lights[n+1], lights[n+2], lights[n+3] = math.random(-250,250),math.random(200,500),math.random(-250,250)
+	lights[n+4], lights[n+5], lights[n+6] = randFloat(0.0,0.25),randFloat(0.0,0.25),randFloat(0.0,0.25)
+	lights[n+7] = 0		-- range
 end
+glimmer.scene.addLights(lights)
 
 -- Sky
 glimmer.scene.setSkyColour(0.8, 0.8, 0.8)
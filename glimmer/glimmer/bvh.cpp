@@ -0,0 +1,1162 @@
+#include "bvh.h"
+#include "ray_packet.h"
+#include "simd.h"
+#include "kernel/assert.h"
+#include <algorithm>
+#include <float.h>
+
+namespace
+{
+	const uint32_t c_sahBinCount = 16;
+	const uint32_t c_maxLeafPrimitives = 8;
+	const uint32_t c_maxBuildDepth = 48;		// Stops degenerate inputs blowing the traversal stack
+	const uint32_t c_maxTraversalStack = c_maxBuildDepth * 2;
+	const float c_traversalCost = 1.0f;			// Relative to the cost of one primitive test
+	const float c_blockTestCost = 2.0f;			// One ray against a whole sphere / triangle block
+
+	inline Math::Box3 EmptyBounds()
+	{
+		return Math::Box3(glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX));
+	}
+
+	inline void GrowBounds(Math::Box3& b, const glm::vec3& p)
+	{
+		b.Min() = glm::min(b.Min(), p);
+		b.Max() = glm::max(b.Max(), p);
+	}
+
+	inline void GrowBounds(Math::Box3& b, const Math::Box3& other)
+	{
+		b.Min() = glm::min(b.Min(), other.Min());
+		b.Max() = glm::max(b.Max(), other.Max());
+	}
+
+	inline Math::Box3 SphereBounds(const Sphere& s)
+	{
+		const glm::vec3 centre(s.m_sphere.m_posAndRadius);
+		const glm::vec3 radius(fabs(s.m_sphere.m_posAndRadius.w));
+		return Math::Box3(centre - radius, centre + radius);
+	}
+
+	inline bool IsEmpty(const Math::Box3& b)
+	{
+		return glm::any(glm::greaterThan(b.Min(), b.Max()));
+	}
+
+	inline float SurfaceArea(const Math::Box3& b)
+	{
+		glm::vec3 size = glm::max(b.Size(), glm::vec3(0.0f));
+		return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+	}
+
+	// Slab test using a precomputed inverse direction. tNear = distance along ray where it enters the box
+	inline bool RayIntersectsBounds(const glm::vec3& origin, const glm::vec3& invDirection, const Math::Box3& b, float maxT, float& tNear)
+	{
+		glm::vec3 t0 = (b.Min() - origin) * invDirection;
+		glm::vec3 t1 = (b.Max() - origin) * invDirection;
+		glm::vec3 tMin = glm::min(t0, t1);
+		glm::vec3 tMax = glm::max(t0, t1);
+		float enter = glm::max(glm::max(tMin.x, tMin.y), glm::max(tMin.z, 0.0f));
+		float exit = glm::min(glm::min(tMax.x, tMax.y), glm::min(tMax.z, maxT));
+		tNear = enter;
+		return enter <= exit;
+	}
+
+	inline Geometry::Ray ToObjectSpace(const Geometry::Ray& ray, const glm::mat4& worldToObject)
+	{
+		return { glm::vec3(worldToObject * glm::vec4(ray.m_origin, 1.0f)), glm::mat3(worldToObject) * ray.m_direction };
+	}
+
+	template<class FloatType>
+	inline Geometry::RayPacket<FloatType> ToObjectSpace(const Geometry::RayPacket<FloatType>& rays, const glm::mat4& m)
+	{
+		auto transform = [&m](int row, const FloatType& x, const FloatType& y, const FloatType& z, float w)
+		{
+			return FloatType(m[0][row]) * x + FloatType(m[1][row]) * y + FloatType(m[2][row]) * z + FloatType(m[3][row] * w);
+		};
+		return Geometry::RayPacket<FloatType>(
+			transform(0, rays.m_originX, rays.m_originY, rays.m_originZ, 1.0f),
+			transform(1, rays.m_originX, rays.m_originY, rays.m_originZ, 1.0f),
+			transform(2, rays.m_originX, rays.m_originY, rays.m_originZ, 1.0f),
+			transform(0, rays.m_dirX, rays.m_dirY, rays.m_dirZ, 0.0f),
+			transform(1, rays.m_dirX, rays.m_dirY, rays.m_dirZ, 0.0f),
+			transform(2, rays.m_dirX, rays.m_dirY, rays.m_dirZ, 0.0f));
+	}
+
+	// Scalar copy of each lane, for primitives that have no packet kernel
+	template<class FloatType>
+	inline void GetLaneRays(const Geometry::RayPacket<FloatType>& rays, Geometry::Ray* laneRays)
+	{
+		alignas(32) float lanes[6][FloatType::Width];
+		rays.m_originX.Store(lanes[0]);
+		rays.m_originY.Store(lanes[1]);
+		rays.m_originZ.Store(lanes[2]);
+		rays.m_dirX.Store(lanes[3]);
+		rays.m_dirY.Store(lanes[4]);
+		rays.m_dirZ.Store(lanes[5]);
+		for (int lane = 0; lane < FloatType::Width; ++lane)
+		{
+			laneRays[lane] = { { lanes[0][lane], lanes[1][lane], lanes[2][lane] }, { lanes[3][lane], lanes[4][lane], lanes[5][lane] } };
+		}
+	}
+}
+
+void SceneBvh::Build(const Mesh& mesh)
+{
+	Scene meshScene;
+	meshScene.meshes.push_back(mesh);
+	Build(meshScene);
+}
+
+void SceneBvh::GetMesh(Mesh& mesh) const
+{
+	SDE_ASSERT(m_meshMaterials.size() == 1, "Only bottom level bvhs are built from one mesh");
+	mesh.m_material = m_meshMaterials[0];
+	mesh.m_triangles.clear();
+	mesh.m_triangles.reserve(m_triangleCount);
+	for (const auto& block : m_triangleBlocks)
+	{
+		for (int lane = 0; lane < block.m_count; ++lane)
+		{
+			mesh.m_triangles.push_back(block.Get(lane));
+		}
+	}
+}
+
+void SceneBvh::Build(const Scene& scene)
+{
+	m_nodes.clear();
+	m_primitives.clear();
+	m_sphereBlocks.clear();
+	m_triangleBlocks.clear();
+	m_triangleMeshes.clear();
+	m_meshMaterials.clear();
+	m_volumes.clear();
+	m_instances.clear();
+	m_instanceSources.clear();
+	m_firstVolumeId = m_firstInstanceId = 0;
+	m_spheres = scene.spheres;
+	m_sceneInstanceCount = scene.meshInstances.size();
+	m_builtCost = m_cost = 0.0f;
+
+	size_t triangleCount = 0;
+	for (const auto& mesh : scene.meshes)
+	{
+		triangleCount += mesh.m_triangles.size();
+	}
+	m_triangleCount = triangleCount;
+	std::vector<const Geometry::PrecomputedTriangle*> triangles;
+	std::vector<uint32_t> triangleMeshes;
+	triangles.reserve(triangleCount);
+	triangleMeshes.reserve(triangleCount);
+	m_meshMaterials.reserve(scene.meshes.size());
+	for (const auto& mesh : scene.meshes)
+	{
+		const uint32_t meshIndex = static_cast<uint32_t>(m_meshMaterials.size());
+		m_meshMaterials.push_back(mesh.m_material);
+		for (const auto& tri : mesh.m_triangles)
+		{
+			triangles.push_back(&tri);
+			triangleMeshes.push_back(meshIndex);
+		}
+	}
+
+	std::vector<BuildPrimitive> buildPrims;
+	buildPrims.reserve(m_spheres.size() + triangles.size() + scene.voxelVolumes.size() + scene.meshInstances.size());
+	for (uint32_t s = 0; s < m_spheres.size(); ++s)
+	{
+		buildPrims.push_back({ SphereBounds(m_spheres[s]), glm::vec3(m_spheres[s].m_sphere.m_posAndRadius), { SpherePrimitive, s } });
+	}
+	for (uint32_t t = 0; t < triangles.size(); ++t)
+	{
+		const auto& tri = *triangles[t];
+		Math::Box3 bounds(glm::min(tri.m_v0, glm::min(tri.m_v1, tri.m_v2)), glm::max(tri.m_v0, glm::max(tri.m_v1, tri.m_v2)));
+		buildPrims.push_back({ bounds, (tri.m_v0 + tri.m_v1 + tri.m_v2) / 3.0f, { TrianglePrimitive, t } });
+	}
+	m_volumes.resize(scene.voxelVolumes.size());
+	for (uint32_t v = 0; v < scene.voxelVolumes.size(); ++v)
+	{
+		if (MakeVolume(scene, v, m_volumes[v]))
+		{
+			buildPrims.push_back({ m_volumes[v].m_bounds, (m_volumes[v].m_bounds.Min() + m_volumes[v].m_bounds.Max()) * 0.5f, { VolumePrimitive, v } });
+		}
+	}
+	m_instances.reserve(scene.meshInstances.size());
+	for (uint32_t i = 0; i < scene.meshInstances.size(); ++i)
+	{
+		Instance instance;
+		if (MakeInstance(scene, i, instance))
+		{
+			const uint32_t instanceIndex = static_cast<uint32_t>(m_instances.size());
+			m_instances.push_back(instance);
+			m_instanceSources.push_back(i);
+			buildPrims.push_back({ instance.m_bounds, (instance.m_bounds.Min() + instance.m_bounds.Max()) * 0.5f, { InstancePrimitive, instanceIndex } });
+		}
+	}
+	if (buildPrims.size() == 0)
+	{
+		return;
+	}
+
+	m_nodes.reserve(buildPrims.size() * 2);
+	m_nodes.push_back(Node());
+	BuildRecursive(0, buildPrims, 0, static_cast<uint32_t>(buildPrims.size()), 0);
+	PackLeaves(buildPrims, triangles, triangleMeshes);
+	AssignInstanceIds();
+	m_builtCost = m_cost = ComputeCost();
+}
+
+bool SceneBvh::MakeInstance(const Scene& scene, uint32_t sceneInstance, Instance& instance) const
+{
+	const MeshInstance& source = scene.meshInstances[sceneInstance];
+	if (source.m_mesh >= scene.instancedMeshes.size() || scene.instancedMeshes[source.m_mesh]->NodeCount() == 0)
+	{
+		return false;	// nothing to hit
+	}
+	const auto& meshBvh = scene.instancedMeshes[source.m_mesh];
+	SDE_ASSERT(meshBvh->InstanceCount() == 0, "Instanced meshes cannot contain more instances");
+
+	// World space bounds of the transformed object space root box
+	const Math::Box3& localBounds = meshBvh->m_nodes[0].m_bounds;
+	Math::Box3 bounds = EmptyBounds();
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		const glm::vec3 p((corner & 1) ? localBounds.Max().x : localBounds.Min().x,
+			(corner & 2) ? localBounds.Max().y : localBounds.Min().y,
+			(corner & 4) ? localBounds.Max().z : localBounds.Min().z);
+		GrowBounds(bounds, glm::vec3(source.m_transform * glm::vec4(p, 1.0f)));
+	}
+	instance = { meshBvh, glm::inverse(source.m_transform), glm::transpose(glm::inverse(glm::mat3(source.m_transform))), 0, bounds };
+	return true;
+}
+
+// Volumes with an empty model are kept so they line up with Scene::voxelVolumes, but stay out of the tree
+bool SceneBvh::MakeVolume(const Scene& scene, uint32_t sceneVolume, Volume& volume) const
+{
+	const VoxelVolume& source = scene.voxelVolumes[sceneVolume];
+	volume = { nullptr, source.m_position, source.m_material, EmptyBounds() };
+	if (source.m_model >= scene.voxelModels.size())
+	{
+		return false;
+	}
+	volume.m_model = scene.voxelModels[source.m_model];
+	const Math::Box3& modelBounds = volume.m_model->GetTotalBounds();
+	if (IsEmpty(modelBounds))
+	{
+		return false;	// nothing to hit
+	}
+	volume.m_bounds = Math::Box3(modelBounds.Min() + source.m_position, modelBounds.Max() + source.m_position);
+	return true;
+}
+
+// Hits inside instances are numbered after everything in this bvh
+void SceneBvh::AssignInstanceIds()
+{
+	m_firstVolumeId = static_cast<uint32_t>(m_spheres.size() + m_triangleBlocks.size() * Geometry::TriangleBlock::Width);
+	m_firstInstanceId = m_firstVolumeId + static_cast<uint32_t>(m_volumes.size() * 6);
+	uint64_t nextPrimitiveId = m_firstInstanceId;
+	for (auto& instance : m_instances)
+	{
+		instance.m_firstPrimitiveId = static_cast<uint32_t>(nextPrimitiveId);
+		nextPrimitiveId += instance.m_bvh->m_firstInstanceId;
+	}
+	SDE_ASSERT(nextPrimitiveId < c_noHit, "Too many instanced primitives");
+}
+
+bool SceneBvh::Update(const Scene& scene)
+{
+	// Removing things would leave holes in the tree + shift primitive ids, cheaper to start again
+	if (m_nodes.empty() || scene.spheres.size() < m_spheres.size() || scene.meshInstances.size() < m_sceneInstanceCount || scene.meshes.size() != m_meshMaterials.size() ||
+		scene.voxelVolumes.size() != m_volumes.size())
+	{
+		return false;
+	}
+	size_t triangleCount = 0;
+	for (uint32_t m = 0; m < scene.meshes.size(); ++m)
+	{
+		triangleCount += scene.meshes[m].m_triangles.size();
+		m_meshMaterials[m] = scene.meshes[m].m_material;
+	}
+	if (triangleCount != m_triangleCount)
+	{
+		return false;
+	}
+
+	// Existing spheres + instances may have moved, their new bounds are picked up by the refit
+	std::copy(scene.spheres.begin(), scene.spheres.begin() + m_spheres.size(), m_spheres.begin());
+	for (auto& block : m_sphereBlocks)
+	{
+		for (int lane = 0; lane < block.m_count; ++lane)
+		{
+			block.Set(lane, m_spheres[block.m_sphereIndex[lane]].m_sphere);
+		}
+	}
+	for (uint32_t i = 0; i < m_instances.size(); ++i)
+	{
+		Instance moved;
+		if (!MakeInstance(scene, m_instanceSources[i], moved) || moved.m_bvh != m_instances[i].m_bvh)
+		{
+			return false;	// now references a different mesh
+		}
+		moved.m_firstPrimitiveId = m_instances[i].m_firstPrimitiveId;
+		m_instances[i] = moved;
+	}
+	for (uint32_t v = 0; v < m_volumes.size(); ++v)
+	{
+		Volume moved;
+		const bool inTree = !IsEmpty(m_volumes[v].m_bounds);
+		if (MakeVolume(scene, v, moved) != inTree || moved.m_model != m_volumes[v].m_model)
+		{
+			return false;	// now references a different model
+		}
+		m_volumes[v] = moved;
+	}
+
+	for (uint32_t s = static_cast<uint32_t>(m_spheres.size()); s < scene.spheres.size(); ++s)
+	{
+		m_spheres.push_back(scene.spheres[s]);
+		const uint32_t blockIndex = static_cast<uint32_t>(m_sphereBlocks.size());
+		m_sphereBlocks.emplace_back();
+		m_sphereBlocks[blockIndex].Add(m_spheres[s].m_sphere, s);
+		if (!InsertLeaf({ SphereBlockPrimitive, blockIndex }, SphereBounds(m_spheres[s])))
+		{
+			return false;
+		}
+	}
+	for (uint32_t i = static_cast<uint32_t>(m_sceneInstanceCount); i < scene.meshInstances.size(); ++i)
+	{
+		Instance instance;
+		if (MakeInstance(scene, i, instance))
+		{
+			const uint32_t instanceIndex = static_cast<uint32_t>(m_instances.size());
+			m_instances.push_back(instance);
+			m_instanceSources.push_back(i);
+			if (!InsertLeaf({ InstancePrimitive, instanceIndex }, instance.m_bounds))
+			{
+				return false;
+			}
+		}
+	}
+	m_sceneInstanceCount = scene.meshInstances.size();
+
+	Refit();
+	AssignInstanceIds();
+	m_cost = ComputeCost();
+	return true;
+}
+
+// Walks down to the leaf whose sibling would grow least by adding the new bounds, then splits it into
+// the old leaf + a new one. New nodes go on the end so children still come after their parents
+bool SceneBvh::InsertLeaf(const PrimitiveRef& ref, const Math::Box3& bounds)
+{
+	uint32_t nodeIndex = 0;
+	uint32_t depth = 0;
+	while (m_nodes[nodeIndex].m_primitiveCount == 0)
+	{
+		GrowBounds(m_nodes[nodeIndex].m_bounds, bounds);
+		const uint32_t leftChild = m_nodes[nodeIndex].m_firstChildOrPrimitive;
+		float growth[2];
+		for (uint32_t c = 0; c < 2; ++c)
+		{
+			Math::Box3 grown = m_nodes[leftChild + c].m_bounds;
+			GrowBounds(grown, bounds);
+			growth[c] = SurfaceArea(grown) - SurfaceArea(m_nodes[leftChild + c].m_bounds);
+		}
+		nodeIndex = growth[0] <= growth[1] ? leftChild : leftChild + 1;
+		++depth;
+	}
+	if (depth >= c_maxBuildDepth)
+	{
+		return false;	// traversal stacks are sized for built trees
+	}
+
+	const uint32_t leftChild = static_cast<uint32_t>(m_nodes.size());
+	Node newLeaf;
+	newLeaf.m_bounds = bounds;
+	newLeaf.m_firstChildOrPrimitive = static_cast<uint32_t>(m_primitives.size());
+	newLeaf.m_primitiveCount = 1;
+	m_primitives.push_back(ref);
+	m_nodes.push_back(m_nodes[nodeIndex]);
+	m_nodes.push_back(newLeaf);
+	m_nodes[nodeIndex].m_firstChildOrPrimitive = leftChild;
+	m_nodes[nodeIndex].m_primitiveCount = 0;
+	return true;
+}
+
+Math::Box3 SceneBvh::PrimitiveBounds(const PrimitiveRef& ref) const
+{
+	switch (ref.m_type)
+	{
+	case SphereBlockPrimitive:
+	{
+		const Geometry::SphereBlock& block = m_sphereBlocks[ref.m_index];
+		Math::Box3 bounds = EmptyBounds();
+		for (int lane = 0; lane < block.m_count; ++lane)
+		{
+			GrowBounds(bounds, SphereBounds(m_spheres[block.m_sphereIndex[lane]]));
+		}
+		return bounds;
+	}
+	case VolumePrimitive:
+		return m_volumes[ref.m_index].m_bounds;
+	case InstancePrimitive:
+		return m_instances[ref.m_index].m_bounds;
+	default:
+	{
+		const Geometry::TriangleBlock& block = m_triangleBlocks[ref.m_index];
+		Math::Box3 bounds = EmptyBounds();
+		for (int lane = 0; lane < block.m_count; ++lane)
+		{
+			const Geometry::PrecomputedTriangle tri = block.Get(lane);
+			GrowBounds(bounds, tri.m_v0);
+			GrowBounds(bounds, tri.m_v1);
+			GrowBounds(bounds, tri.m_v2);
+		}
+		return bounds;
+	}
+	}
+}
+
+// Children always come after their parents, so walking backwards visits both children before the parent
+void SceneBvh::Refit()
+{
+	for (size_t n = m_nodes.size(); n-- > 0;)
+	{
+		Node& node = m_nodes[n];
+		Math::Box3 bounds = EmptyBounds();
+		if (node.m_primitiveCount == 0)
+		{
+			GrowBounds(bounds, m_nodes[node.m_firstChildOrPrimitive].m_bounds);
+			GrowBounds(bounds, m_nodes[node.m_firstChildOrPrimitive + 1].m_bounds);
+		}
+		else
+		{
+			for (uint32_t p = node.m_firstChildOrPrimitive; p < node.m_firstChildOrPrimitive + node.m_primitiveCount; ++p)
+			{
+				GrowBounds(bounds, PrimitiveBounds(m_primitives[p]));
+			}
+		}
+		node.m_bounds = bounds;
+	}
+}
+
+// Expected cost of tracing a random ray that hits the root, using the same costs as the build
+float SceneBvh::ComputeCost() const
+{
+	if (m_nodes.empty())
+	{
+		return 0.0f;
+	}
+	float cost = 0.0f;
+	for (const auto& node : m_nodes)
+	{
+		cost += SurfaceArea(node.m_bounds) * (node.m_primitiveCount == 0 ? c_traversalCost : (float)node.m_primitiveCount);
+	}
+	return cost / glm::max(SurfaceArea(m_nodes[0].m_bounds), FLT_MIN);
+}
+
+// Leaves are built with one primitive per triangle + sphere, this packs the triangles and spheres in each leaf
+// into blocks so a ray can test all of them at once. Instances are kept as they are
+void SceneBvh::PackLeaves(const std::vector<BuildPrimitive>& prims, const std::vector<const Geometry::PrecomputedTriangle*>& triangles, const std::vector<uint32_t>& triangleMeshes)
+{
+	const int c_blockWidth = Geometry::TriangleBlock::Width;
+	m_primitives.reserve(prims.size());
+	m_triangleBlocks.reserve((triangles.size() + c_blockWidth - 1) / c_blockWidth);
+	m_sphereBlocks.reserve((m_spheres.size() + Geometry::SphereBlock::Width - 1) / Geometry::SphereBlock::Width);
+	for (auto& node : m_nodes)
+	{
+		if (node.m_primitiveCount == 0)
+		{
+			continue;
+		}
+		const uint32_t firstPrimitive = static_cast<uint32_t>(m_primitives.size());
+		uint32_t blockIndex = c_noHit;
+		uint32_t sphereBlockIndex = c_noHit;
+		for (uint32_t p = node.m_firstChildOrPrimitive; p < node.m_firstChildOrPrimitive + node.m_primitiveCount; ++p)
+		{
+			const PrimitiveRef& ref = prims[p].m_ref;
+			if (ref.m_type == SpherePrimitive)
+			{
+				if (sphereBlockIndex == c_noHit || m_sphereBlocks[sphereBlockIndex].m_count == Geometry::SphereBlock::Width)
+				{
+					sphereBlockIndex = static_cast<uint32_t>(m_sphereBlocks.size());
+					m_sphereBlocks.emplace_back();
+					m_primitives.push_back({ SphereBlockPrimitive, sphereBlockIndex });
+				}
+				m_sphereBlocks[sphereBlockIndex].Add(m_spheres[ref.m_index].m_sphere, ref.m_index);
+				continue;
+			}
+			if (ref.m_type != TrianglePrimitive)
+			{
+				m_primitives.push_back(ref);
+				continue;
+			}
+			if (blockIndex == c_noHit || m_triangleBlocks[blockIndex].m_count == c_blockWidth)
+			{
+				blockIndex = static_cast<uint32_t>(m_triangleBlocks.size());
+				m_triangleBlocks.emplace_back();
+				m_triangleMeshes.resize(m_triangleBlocks.size() * c_blockWidth, 0);
+				m_primitives.push_back({ TriangleBlockPrimitive, blockIndex });
+			}
+			auto& block = m_triangleBlocks[blockIndex];
+			m_triangleMeshes[blockIndex * c_blockWidth + block.m_count] = triangleMeshes[ref.m_index];
+			block.Add(*triangles[ref.m_index]);
+		}
+		node.m_firstChildOrPrimitive = firstPrimitive;
+		node.m_primitiveCount = static_cast<uint32_t>(m_primitives.size()) - firstPrimitive;
+	}
+}
+
+void SceneBvh::BuildRecursive(uint32_t nodeIndex, std::vector<BuildPrimitive>& prims, uint32_t first, uint32_t count, uint32_t depth)
+{
+	Math::Box3 bounds = EmptyBounds();
+	Math::Box3 centroidBounds = EmptyBounds();
+	for (uint32_t p = first; p < first + count; ++p)
+	{
+		GrowBounds(bounds, prims[p].m_bounds);
+		GrowBounds(centroidBounds, prims[p].m_centroid);
+	}
+	m_nodes[nodeIndex].m_bounds = bounds;
+	m_nodes[nodeIndex].m_firstChildOrPrimitive = first;
+	m_nodes[nodeIndex].m_primitiveCount = count;
+	if (count <= 2 || depth >= c_maxBuildDepth)
+	{
+		return;
+	}
+
+	// Find the cheapest split plane on any axis by binning centroids
+	struct Bin
+	{
+		Math::Box3 m_bounds;
+		uint32_t m_count;
+	};
+	const glm::vec3 centroidExtents = centroidBounds.Size();
+	const float parentArea = glm::max(SurfaceArea(bounds), FLT_MIN);
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	uint32_t bestSplit = 0;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (centroidExtents[axis] <= 0.0f)
+		{
+			continue;
+		}
+		Bin bins[c_sahBinCount];
+		for (auto& bin : bins)
+		{
+			bin.m_bounds = EmptyBounds();
+			bin.m_count = 0;
+		}
+		const float binScale = c_sahBinCount / centroidExtents[axis];
+		for (uint32_t p = first; p < first + count; ++p)
+		{
+			uint32_t b = glm::min(c_sahBinCount - 1, (uint32_t)((prims[p].m_centroid[axis] - centroidBounds.Min()[axis]) * binScale));
+			bins[b].m_count++;
+			GrowBounds(bins[b].m_bounds, prims[p].m_bounds);
+		}
+
+		// Sweep from the right to get the cost of everything after each split
+		float rightCost[c_sahBinCount] = { 0.0f };
+		Math::Box3 rightBounds = EmptyBounds();
+		uint32_t rightCount = 0;
+		for (uint32_t b = c_sahBinCount - 1; b > 0; --b)
+		{
+			GrowBounds(rightBounds, bins[b].m_bounds);
+			rightCount += bins[b].m_count;
+			rightCost[b - 1] = rightCount > 0 ? SurfaceArea(rightBounds) * rightCount : 0.0f;
+		}
+
+		// Then sweep from the left, combining costs
+		Math::Box3 leftBounds = EmptyBounds();
+		uint32_t leftCount = 0;
+		for (uint32_t b = 0; b < c_sahBinCount - 1; ++b)
+		{
+			GrowBounds(leftBounds, bins[b].m_bounds);
+			leftCount += bins[b].m_count;
+			if (leftCount == 0 || leftCount == count)
+			{
+				continue;
+			}
+			float cost = c_traversalCost + (SurfaceArea(leftBounds) * leftCount + rightCost[b]) / parentArea;
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = b;
+			}
+		}
+	}
+
+	// Stop if splitting would not be cheaper than testing everything here
+	// Leaf spheres + triangles are packed into blocks that are tested all at once, so filling a block is nearly free
+	uint32_t blockedCount[2] = { 0, 0 };
+	for (uint32_t p = first; p < first + count; ++p)
+	{
+		const PrimitiveType type = prims[p].m_ref.m_type;
+		if (type == SpherePrimitive || type == TrianglePrimitive)
+		{
+			blockedCount[type == TrianglePrimitive]++;
+		}
+	}
+	const uint32_t blockCount = ((blockedCount[0] + Geometry::SphereBlock::Width - 1) / Geometry::SphereBlock::Width) +
+		((blockedCount[1] + Geometry::TriangleBlock::Width - 1) / Geometry::TriangleBlock::Width);
+	const float leafCost = c_blockTestCost * blockCount + (float)(count - blockedCount[0] - blockedCount[1]);
+	if (count <= c_maxLeafPrimitives && (bestAxis == -1 || bestCost >= leafCost))
+	{
+		return;
+	}
+
+	uint32_t mid = first + count / 2;
+	if (bestAxis != -1)
+	{
+		const float binScale = c_sahBinCount / centroidExtents[bestAxis];
+		const float axisMin = centroidBounds.Min()[bestAxis];
+		auto splitIt = std::partition(prims.begin() + first, prims.begin() + first + count, [&](const BuildPrimitive& p)
+		{
+			uint32_t b = glm::min(c_sahBinCount - 1, (uint32_t)((p.m_centroid[bestAxis] - axisMin) * binScale));
+			return b <= bestSplit;
+		});
+		mid = static_cast<uint32_t>(splitIt - prims.begin());
+	}
+	if (mid == first || mid == first + count)
+	{
+		mid = first + count / 2;	// All centroids in one place, just split down the middle
+	}
+
+	const uint32_t leftChild = static_cast<uint32_t>(m_nodes.size());
+	m_nodes.push_back(Node());
+	m_nodes.push_back(Node());
+	m_nodes[nodeIndex].m_firstChildOrPrimitive = leftChild;
+	m_nodes[nodeIndex].m_primitiveCount = 0;
+	BuildRecursive(leftChild, prims, first, mid - first, depth + 1);
+	BuildRecursive(leftChild + 1, prims, mid, first + count - mid, depth + 1);
+}
+
+const SceneBvh::Instance& SceneBvh::FindInstance(uint32_t primitiveId) const
+{
+	auto it = std::upper_bound(m_instances.begin(), m_instances.end(), primitiveId, [](uint32_t id, const Instance& instance)
+	{
+		return id < instance.m_firstPrimitiveId;
+	});
+	SDE_ASSERT(it != m_instances.begin());
+	return *(it - 1);
+}
+
+template<class FloatType>
+bool SceneBvh::LeafRayHit(const Node& leaf, const Geometry::Ray& ray, float& closestT, uint32_t& hitPrimitive, uint32_t primitiveIdBase, RayStats& stats) const
+{
+	bool hit = false;
+	const uint32_t lastPrimitive = leaf.m_firstChildOrPrimitive + leaf.m_primitiveCount;
+	for (uint32_t p = leaf.m_firstChildOrPrimitive; p < lastPrimitive; ++p)
+	{
+		const PrimitiveRef& ref = m_primitives[p];
+		if (ref.m_type == TriangleBlockPrimitive)
+		{
+			const Geometry::TriangleBlock& block = m_triangleBlocks[ref.m_index];
+			int hitLane = 0;
+			stats.m_triangleTests += block.m_count;
+			if (Geometry::RayTriangleBlockHit<FloatType>(ray, block, closestT, hitLane))
+			{
+				hitPrimitive = primitiveIdBase + TriangleId(ref.m_index, hitLane);
+				hit = true;
+			}
+		}
+		else if (ref.m_type == SphereBlockPrimitive)
+		{
+			const Geometry::SphereBlock& block = m_sphereBlocks[ref.m_index];
+			int hitLane = 0;
+			stats.m_sphereTests += block.m_count;
+			if (Geometry::RaySphereBlockHit<FloatType>(ray, block, closestT, hitLane))
+			{
+				hitPrimitive = primitiveIdBase + block.m_sphereIndex[hitLane];
+				hit = true;
+			}
+		}
+		else if (ref.m_type == VolumePrimitive)
+		{
+			const Volume& volume = m_volumes[ref.m_index];
+			float t = closestT;
+			int face = 0;
+			if (Geometry::RayVoxelModelHit(ray, *volume.m_model, volume.m_position, closestT, t, face, stats.m_voxelTests))
+			{
+				closestT = t;
+				hitPrimitive = primitiveIdBase + m_firstVolumeId + ref.m_index * 6 + face;
+				hit = true;
+			}
+		}
+		else
+		{
+			const Instance& instance = m_instances[ref.m_index];
+			hit |= instance.m_bvh->ClosestHit<FloatType>(ToObjectSpace(ray, instance.m_worldToObject), closestT, hitPrimitive, instance.m_firstPrimitiveId, stats);
+		}
+	}
+	return hit;
+}
+
+template<class FloatType>
+bool SceneBvh::LeafRayOccluded(const Node& leaf, const Geometry::Ray& ray, float maxT, RayStats& stats) const
+{
+	const uint32_t lastPrimitive = leaf.m_firstChildOrPrimitive + leaf.m_primitiveCount;
+	for (uint32_t p = leaf.m_firstChildOrPrimitive; p < lastPrimitive; ++p)
+	{
+		const PrimitiveRef& ref = m_primitives[p];
+		bool occluded = false;
+		if (ref.m_type == TriangleBlockPrimitive)
+		{
+			stats.m_triangleTests += m_triangleBlocks[ref.m_index].m_count;
+			occluded = Geometry::RayTriangleBlockOccluded<FloatType>(ray, m_triangleBlocks[ref.m_index], maxT);
+		}
+		else if (ref.m_type == SphereBlockPrimitive)
+		{
+			stats.m_sphereTests += m_sphereBlocks[ref.m_index].m_count;
+			occluded = Geometry::RaySphereBlockOccluded<FloatType>(ray, m_sphereBlocks[ref.m_index], maxT);
+		}
+		else if (ref.m_type == VolumePrimitive)
+		{
+			const Volume& volume = m_volumes[ref.m_index];
+			float t = maxT;
+			int face = 0;
+			occluded = Geometry::RayVoxelModelHit(ray, *volume.m_model, volume.m_position, maxT, t, face, stats.m_voxelTests);
+		}
+		else
+		{
+			const Instance& instance = m_instances[ref.m_index];
+			occluded = instance.m_bvh->AnyHit<FloatType>(ToObjectSpace(ray, instance.m_worldToObject), maxT, stats);
+		}
+		if (occluded)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool SceneBvh::RayOccluded(const Geometry::Ray& ray, float maxT, RayStats& stats) const
+{
+	return Simd::HasAvx() ? AnyHit<Simd::Float8>(ray, maxT, stats) : AnyHit<Simd::Float4>(ray, maxT, stats);
+}
+
+template<class FloatType>
+bool SceneBvh::AnyHit(const Geometry::Ray& ray, float maxT, RayStats& stats) const
+{
+	if (m_nodes.size() == 0)
+	{
+		return false;
+	}
+
+	// Any hit will do, so there is no need to sort children or track the closest hit
+	const glm::vec3 invDirection = 1.0f / ray.m_direction;
+	uint32_t nodeStack[c_maxTraversalStack];
+	int stackSize = 0;
+	nodeStack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const Node& node = m_nodes[nodeStack[--stackSize]];
+		float tNear = 0.0f;
+		++stats.m_boxTests;
+		if (!RayIntersectsBounds(ray.m_origin, invDirection, node.m_bounds, maxT, tNear))
+		{
+			continue;
+		}
+		if (node.m_primitiveCount > 0)
+		{
+			if (LeafRayOccluded<FloatType>(node, ray, maxT, stats))
+			{
+				return true;
+			}
+		}
+		else
+		{
+			SDE_ASSERT(stackSize + 2 <= c_maxTraversalStack);
+			nodeStack[stackSize++] = node.m_firstChildOrPrimitive + 1;
+			nodeStack[stackSize++] = node.m_firstChildOrPrimitive;
+		}
+	}
+	return false;
+}
+
+bool SceneBvh::RayHit(const Geometry::Ray& ray, float& t, glm::vec3& normal, Material& material, RayStats& stats) const
+{
+	uint32_t hitPrimitive = c_noHit;
+	const bool hit = Simd::HasAvx() ? ClosestHit<Simd::Float8>(ray, t, hitPrimitive, 0, stats) : ClosestHit<Simd::Float4>(ray, t, hitPrimitive, 0, stats);
+	if (hit)
+	{
+		HitAttributes(hitPrimitive, ray, t, normal, material);	// only for the closest
+		return true;
+	}
+	return false;
+}
+
+// hitPrimitive is only written if something closer than t is hit
+template<class FloatType>
+bool SceneBvh::ClosestHit(const Geometry::Ray& ray, float& t, uint32_t& hitPrimitive, uint32_t primitiveIdBase, RayStats& stats) const
+{
+	if (m_nodes.size() == 0)
+	{
+		return false;
+	}
+
+	const glm::vec3 invDirection = 1.0f / ray.m_direction;
+	float tNear = 0.0f;
+	++stats.m_boxTests;
+	if (!RayIntersectsBounds(ray.m_origin, invDirection, m_nodes[0].m_bounds, t, tNear))
+	{
+		return false;
+	}
+
+	// Nodes are pushed along with their entry distance, so they can be skipped
+	// if something closer was found since they were pushed
+	uint32_t nodeStack[c_maxTraversalStack];
+	float nearStack[c_maxTraversalStack];
+	int stackSize = 0;
+	nodeStack[stackSize] = 0;
+	nearStack[stackSize++] = tNear;
+
+	bool hit = false;
+	while (stackSize > 0)
+	{
+		--stackSize;
+		if (nearStack[stackSize] > t)
+		{
+			continue;
+		}
+		const Node& node = m_nodes[nodeStack[stackSize]];
+		if (node.m_primitiveCount > 0)
+		{
+			hit |= LeafRayHit<FloatType>(node, ray, t, hitPrimitive, primitiveIdBase, stats);
+			continue;
+		}
+
+		const uint32_t left = node.m_firstChildOrPrimitive;
+		const uint32_t right = left + 1;
+		float leftNear = 0.0f, rightNear = 0.0f;
+		stats.m_boxTests += 2;
+		bool hitLeft = RayIntersectsBounds(ray.m_origin, invDirection, m_nodes[left].m_bounds, t, leftNear);
+		bool hitRight = RayIntersectsBounds(ray.m_origin, invDirection, m_nodes[right].m_bounds, t, rightNear);
+		SDE_ASSERT(stackSize + 2 <= c_maxTraversalStack);
+		if (hitLeft && hitRight)
+		{
+			// Push the far child first so the near one is visited next
+			bool leftFirst = leftNear <= rightNear;
+			nodeStack[stackSize] = leftFirst ? right : left;
+			nearStack[stackSize++] = leftFirst ? rightNear : leftNear;
+			nodeStack[stackSize] = leftFirst ? left : right;
+			nearStack[stackSize++] = leftFirst ? leftNear : rightNear;
+		}
+		else if (hitLeft)
+		{
+			nodeStack[stackSize] = left;
+			nearStack[stackSize++] = leftNear;
+		}
+		else if (hitRight)
+		{
+			nodeStack[stackSize] = right;
+			nearStack[stackSize++] = rightNear;
+		}
+	}
+	return hit;
+}
+
+void SceneBvh::HitAttributes(uint32_t primitive, const Geometry::Ray& ray, float t, glm::vec3& normal, Material& material) const
+{
+	if (primitive >= m_firstInstanceId)
+	{
+		const Instance& instance = FindInstance(primitive);
+		instance.m_bvh->HitAttributes(primitive - instance.m_firstPrimitiveId, ToObjectSpace(ray, instance.m_worldToObject), t, normal, material);
+		normal = glm::normalize(instance.m_normalToWorld * normal);
+	}
+	else if (primitive < m_spheres.size())
+	{
+		const Sphere& s = m_spheres[primitive];
+		auto hitPos = ray.m_origin + ray.m_direction * t;
+		normal = glm::normalize(hitPos - glm::vec3(s.m_sphere.m_posAndRadius));
+		material = s.m_material;
+	}
+	else if (primitive >= m_firstVolumeId)
+	{
+		const uint32_t volumeFace = primitive - m_firstVolumeId;
+		normal = Geometry::VoxelFaceNormal(volumeFace % 6);
+		material = m_volumes[volumeFace / 6].m_material;
+	}
+	else
+	{
+		const uint32_t triangle = primitive - static_cast<uint32_t>(m_spheres.size());
+		const int c_blockWidth = Geometry::TriangleBlock::Width;
+		const Geometry::TriangleBlock& block = m_triangleBlocks[triangle / c_blockWidth];
+		const int lane = triangle % c_blockWidth;
+		normal = glm::vec3(block.m_normal[0][lane], block.m_normal[1][lane], block.m_normal[2][lane]);
+		material = m_meshMaterials[m_triangleMeshes[triangle]];
+	}
+}
+
+template<class FloatType>
+bool SceneBvh::LeafRayPacketHit(const Node& leaf, const Geometry::RayPacket<FloatType>& rays, FloatType& closestT, uint32_t* hitPrimitives, uint32_t primitiveIdBase, RayStats& stats) const
+{
+	bool hit = false;
+	FloatType t = closestT;
+	const uint32_t lastPrimitive = leaf.m_firstChildOrPrimitive + leaf.m_primitiveCount;
+	auto keepCloserHits = [&](FloatType hitMask, uint32_t primitiveId)
+	{
+		hitMask = hitMask & (t < closestT);
+		int laneBits = hitMask.MoveMask();
+		if (laneBits != 0)
+		{
+			closestT = FloatType::Select(hitMask, t, closestT);
+			for (int lane = 0; lane < FloatType::Width; ++lane)
+			{
+				if (laneBits & (1 << lane))
+				{
+					hitPrimitives[lane] = primitiveId;
+				}
+			}
+			hit = true;
+		}
+	};
+	for (uint32_t p = leaf.m_firstChildOrPrimitive; p < lastPrimitive; ++p)
+	{
+		const PrimitiveRef& ref = m_primitives[p];
+		if (ref.m_type == TriangleBlockPrimitive)
+		{
+			// The rays are already SoA, so test them against one triangle at a time
+			const Geometry::TriangleBlock& block = m_triangleBlocks[ref.m_index];
+			stats.m_triangleTests += FloatType::Width * block.m_count;
+			for (int lane = 0; lane < block.m_count; ++lane)
+			{
+				keepCloserHits(Geometry::RayPacketTriangleIntersect(rays, block.Get(lane), t), primitiveIdBase + TriangleId(ref.m_index, lane));
+			}
+		}
+		else if (ref.m_type == SphereBlockPrimitive)
+		{
+			const Geometry::SphereBlock& block = m_sphereBlocks[ref.m_index];
+			stats.m_sphereTests += FloatType::Width * block.m_count;
+			for (int lane = 0; lane < block.m_count; ++lane)
+			{
+				const uint32_t sphere = block.m_sphereIndex[lane];
+				keepCloserHits(Geometry::RayPacketSphereIntersect(rays, m_spheres[sphere].m_sphere, t), primitiveIdBase + sphere);
+			}
+		}
+		else if (ref.m_type == VolumePrimitive)
+		{
+			// Each lane walks different voxels, so trace them one at a time
+			const Volume& volume = m_volumes[ref.m_index];
+			Geometry::Ray laneRays[FloatType::Width];
+			alignas(32) float laneT[FloatType::Width];
+			GetLaneRays(rays, laneRays);
+			closestT.Store(laneT);
+			for (int lane = 0; lane < FloatType::Width; ++lane)
+			{
+				float volumeT = laneT[lane];
+				int face = 0;
+				if (Geometry::RayVoxelModelHit(laneRays[lane], *volume.m_model, volume.m_position, laneT[lane], volumeT, face, stats.m_voxelTests))
+				{
+					laneT[lane] = volumeT;
+					hitPrimitives[lane] = primitiveIdBase + m_firstVolumeId + ref.m_index * 6 + face;
+					hit = true;
+				}
+			}
+			closestT = FloatType::Load(laneT);
+		}
+		else
+		{
+			const Instance& instance = m_instances[ref.m_index];
+			hit |= instance.m_bvh->PacketClosestHit(ToObjectSpace(rays, instance.m_worldToObject), closestT, hitPrimitives, instance.m_firstPrimitiveId, stats);
+		}
+	}
+	return hit;
+}
+
+template<class FloatType>
+bool SceneBvh::RayPacketHit(const Geometry::RayPacket<FloatType>& rays, FloatType& t, uint32_t* hitPrimitives, RayStats& stats) const
+{
+	for (int lane = 0; lane < FloatType::Width; ++lane)
+	{
+		hitPrimitives[lane] = c_noHit;
+	}
+	return PacketClosestHit(rays, t, hitPrimitives, 0, stats);
+}
+
+// As ClosestHit, hitPrimitives is only written for lanes that hit something closer than t
+template<class FloatType>
+bool SceneBvh::PacketClosestHit(const Geometry::RayPacket<FloatType>& rays, FloatType& t, uint32_t* hitPrimitives, uint32_t primitiveIdBase, RayStats& stats) const
+{
+	if (m_nodes.size() == 0)
+	{
+		return false;
+	}
+
+	// Same traversal as RayHit, but a node is visited if any lane hits it
+	// The stack holds the nearest entry distance of any lane
+	// Packet tests are counted per lane
+	FloatType tNear;
+	stats.m_boxTests += FloatType::Width;
+	FloatType rootMask = Geometry::RayPacketBoxIntersect(rays, m_nodes[0].m_bounds.Min(), m_nodes[0].m_bounds.Max(), t, tNear);
+	if (rootMask.MoveMask() == 0)
+	{
+		return false;
+	}
+	uint32_t nodeStack[c_maxTraversalStack];
+	float nearStack[c_maxTraversalStack];
+	int stackSize = 0;
+	nodeStack[stackSize] = 0;
+	nearStack[stackSize++] = Simd::MaskedMin(rootMask, tNear);
+
+	bool hit = false;
+	while (stackSize > 0)
+	{
+		--stackSize;
+		if ((FloatType(nearStack[stackSize]) <= t).MoveMask() == 0)
+		{
+			continue;	// every lane found something closer since this was pushed
+		}
+		const Node& node = m_nodes[nodeStack[stackSize]];
+		if (node.m_primitiveCount > 0)
+		{
+			hit |= LeafRayPacketHit(node, rays, t, hitPrimitives, primitiveIdBase, stats);
+			continue;
+		}
+
+		const uint32_t left = node.m_firstChildOrPrimitive;
+		const uint32_t right = left + 1;
+		FloatType leftNear, rightNear;
+		stats.m_boxTests += 2 * FloatType::Width;
+		FloatType leftMask = Geometry::RayPacketBoxIntersect(rays, m_nodes[left].m_bounds.Min(), m_nodes[left].m_bounds.Max(), t, leftNear);
+		FloatType rightMask = Geometry::RayPacketBoxIntersect(rays, m_nodes[right].m_bounds.Min(), m_nodes[right].m_bounds.Max(), t, rightNear);
+		bool hitLeft = leftMask.MoveMask() != 0;
+		bool hitRight = rightMask.MoveMask() != 0;
+		float leftMin = hitLeft ? Simd::MaskedMin(leftMask, leftNear) : 0.0f;
+		float rightMin = hitRight ? Simd::MaskedMin(rightMask, rightNear) : 0.0f;
+		SDE_ASSERT(stackSize + 2 <= c_maxTraversalStack);
+		if (hitLeft && hitRight)
+		{
+			bool leftFirst = leftMin <= rightMin;
+			nodeStack[stackSize] = leftFirst ? right : left;
+			nearStack[stackSize++] = leftFirst ? rightMin : leftMin;
+			nodeStack[stackSize] = leftFirst ? left : right;
+			nearStack[stackSize++] = leftFirst ? leftMin : rightMin;
+		}
+		else if (hitLeft)
+		{
+			nodeStack[stackSize] = left;
+			nearStack[stackSize++] = leftMin;
+		}
+		else if (hitRight)
+		{
+			nodeStack[stackSize] = right;
+			nearStack[stackSize++] = rightMin;
+		}
+	}
+	return hit;
+}
+
+template<class FloatType>
+int SceneBvh::LeafRayPacketOccluded(const Node& leaf, const Geometry::RayPacket<FloatType>& rays, FloatType& maxT, RayStats& stats) const
+{
+	// Occluded lanes have their maxT set negative so every later test misses them
+	int occludedLanes = 0;
+	const uint32_t lastPrimitive = leaf.m_firstChildOrPrimitive + leaf.m_primitiveCount;
+	auto occludeHits = [&](FloatType hitMask, const FloatType& t)
+	{
+		hitMask = hitMask & (t < maxT);
+		int laneBits = hitMask.MoveMask();
+		if (laneBits != 0)
+		{
+			maxT = FloatType::Select(hitMask, FloatType(-1.0f), maxT);
+			occludedLanes |= laneBits;
+		}
+	};
+	for (uint32_t p = leaf.m_firstChildOrPrimitive; p < lastPrimitive; ++p)
+	{
+		const PrimitiveRef& ref = m_primitives[p];
+		if (ref.m_type == TriangleBlockPrimitive)
+		{
+			const Geometry::TriangleBlock& block = m_triangleBlocks[ref.m_index];
+			stats.m_triangleTests += FloatType::Width * block.m_count;
+			for (int lane = 0; lane < block.m_count; ++lane)
+			{
+				FloatType t = maxT;
+				occludeHits(Geometry::RayPacketTriangleIntersect(rays, block.Get(lane), t), t);
+			}
+		}
+		else if (ref.m_type == SphereBlockPrimitive)
+		{
+			const Geometry::SphereBlock& block = m_sphereBlocks[ref.m_index];
+			stats.m_sphereTests += FloatType::Width * block.m_count;
+			for (int lane = 0; lane < block.m_count; ++lane)
+			{
+				FloatType t = maxT;
+				occludeHits(Geometry::RayPacketSphereIntersect(rays, m_spheres[block.m_sphereIndex[lane]].m_sphere, t), t);
+			}
+		}
+		else if (ref.m_type == VolumePrimitive)
+		{
+			const Volume& volume = m_volumes[ref.m_index];
+			Geometry::Ray laneRays[FloatType::Width];
+			alignas(32) float laneMaxT[FloatType::Width];
+			GetLaneRays(rays, laneRays);
+			maxT.Store(laneMaxT);
+			for (int lane = 0; lane < FloatType::Width; ++lane)
+			{
+				float t = 0.0f;
+				int face = 0;
+				if (laneMaxT[lane] >= 0.0f && Geometry::RayVoxelModelHit(laneRays[lane], *volume.m_model, volume.m_position, laneMaxT[lane], t, face, stats.m_voxelTests))
+				{
+					laneMaxT[lane] = -1.0f;
+					occludedLanes |= 1 << lane;
+				}
+			}
+			maxT = FloatType::Load(laneMaxT);
+		}
+		else
+		{
+			// Lanes that were already occluded come back set too, which does no harm
+			const Instance& instance = m_instances[ref.m_index];
+			FloatType hitMask = instance.m_bvh->RayPacketOccluded(ToObjectSpace(rays, instance.m_worldToObject), maxT, stats);
+			maxT = FloatType::Select(hitMask, FloatType(-1.0f), maxT);
+			occludedLanes |= hitMask.MoveMask();
+		}
+	}
+	return occludedLanes;
+}
+
+template<class FloatType>
+FloatType SceneBvh::RayPacketOccluded(const Geometry::RayPacket<FloatType>& rays, const FloatType& maxT, RayStats& stats) const
+{
+	FloatType laneMaxT = maxT;
+	if (m_nodes.size() == 0)
+	{
+		return laneMaxT < FloatType(0.0f);
+	}
+
+	// Same as RayOccluded, a node is visited if any lane that is not yet occluded enters it
+	const int c_allLanes = (1 << FloatType::Width) - 1;
+	int occludedLanes = 0;
+	uint32_t nodeStack[c_maxTraversalStack];
+	int stackSize = 0;
+	nodeStack[stackSize++] = 0;
+	while (stackSize > 0 && occludedLanes != c_allLanes)
+	{
+		const Node& node = m_nodes[nodeStack[--stackSize]];
+		FloatType tNear;
+		stats.m_boxTests += FloatType::Width;
+		if (Geometry::RayPacketBoxIntersect(rays, node.m_bounds.Min(), node.m_bounds.Max(), laneMaxT, tNear).MoveMask() == 0)
+		{
+			continue;
+		}
+		if (node.m_primitiveCount > 0)
+		{
+			occludedLanes |= LeafRayPacketOccluded(node, rays, laneMaxT, stats);
+		}
+		else
+		{
+			SDE_ASSERT(stackSize + 2 <= c_maxTraversalStack);
+			nodeStack[stackSize++] = node.m_firstChildOrPrimitive + 1;
+			nodeStack[stackSize++] = node.m_firstChildOrPrimitive;
+		}
+	}
+	return laneMaxT < FloatType(0.0f);
+}
+
+template bool SceneBvh::RayPacketHit<Simd::Float4>(const Geometry::RayPacket<Simd::Float4>&, Simd::Float4&, uint32_t*, RayStats&) const;
+template bool SceneBvh::RayPacketHit<Simd::Float8>(const Geometry::RayPacket<Simd::Float8>&, Simd::Float8&, uint32_t*, RayStats&) const;
+template Simd::Float4 SceneBvh::RayPacketOccluded<Simd::Float4>(const Geometry::RayPacket<Simd::Float4>&, const Simd::Float4&, RayStats&) const;
+template Simd::Float8 SceneBvh::RayPacketOccluded<Simd::Float8>(const Geometry::RayPacket<Simd::Float8>&, const Simd::Float8&, RayStats&) const;
@@ -0,0 +1,168 @@
+#pragma once
+#include "traceboi.h"
+#include "ray_stats.h"
+#include "triangle_block.h"
+#include "sphere_block.h"
+#include "math/box3.h"
+#include <vector>
+#include <memory>
+#include <stdint.h>
+
+namespace Geometry
+{
+	template<class FloatType> struct RayPacket;
+}
+
+// Bounding volume hierarchy over all finite primitives in a scene (spheres, mesh triangles, voxel volumes + mesh instances)
+// Built top-down using a binned surface area heuristic, then the triangles + spheres in each leaf are packed into SIMD blocks
+// Planes are infinite and cannot be bounded, so they are NOT included; test them seperately
+// Voxel volumes are one primitive each, bounded by their occupied blocks. Their voxels are walked with Geometry::RayVoxelModelHit
+// Once built it is read-only, and can be shared between any number of trace jobs
+// Instancing uses 2 levels: Build(const Mesh&) makes a bottom level bvh over one object space mesh,
+// and the scene bvh only stores the bounds + transform of each instance that references it.
+// Moving instances only needs the scene bvh rebuilding, the bottom levels are reused as-is
+// Live edits can use Update on a copy of the last bvh instead of a full Build, see Degradation for when to rebuild
+class SceneBvh
+{
+public:
+	SceneBvh() = default;
+	~SceneBvh() = default;
+
+	void Build(const Scene& scene);		// Rebuilds everything from scratch, apart from the bvhs in Scene::instancedMeshes
+	void Build(const Mesh& mesh);		// Bottom level bvh for Scene::instancedMeshes, the triangles stay in object space
+	void GetMesh(Mesh& mesh) const;		// The mesh a bottom level bvh was built from, with its triangles in leaf order
+
+	// Updates a copy of the bvh built for an earlier version of the scene. Existing spheres + instances keep their
+	// place in the tree and only have their bounds refit, new ones are inserted as leaves next to their nearest neighbours
+	// Returns false if the scene changed in a way that needs a full Build (anything removed, mesh triangles or voxel volumes added, too deep)
+	// Mesh triangles are assumed not to change in place, they are never re-read
+	bool Update(const Scene& scene);
+
+	// SAH cost of the tree relative to the last full Build, grows as updates move + insert things
+	inline float Degradation() const		{ return m_builtCost > 0.0f ? m_cost / m_builtCost : 1.0f; }
+
+	// Finds the closest hit. t must be initialised to the max distance to search (e.g. closest hit so far)
+	// All queries add the node + primitive tests they do to stats
+	bool RayHit(const Geometry::Ray& ray, float& t, glm::vec3& normal, Material& material, RayStats& stats) const;
+
+	// Returns true as soon as anything is hit closer than maxT, e.g. for shadow rays
+	bool RayOccluded(const Geometry::Ray& ray, float maxT, RayStats& stats) const;
+
+	// Packet version of RayHit for coherent rays, instantiated for Simd::Float4 + Simd::Float8
+	// t is per-lane, as above. hitPrimitives receives the primitive each lane hit (or c_noHit)
+	// Primitive ids are spheres, then triangle block lanes, then 6 per voxel volume (one per face direction), then the triangles in each instance
+	// Normals + materials are only fetched for the lanes that need them, via HitAttributes
+	static const uint32_t c_noHit = ~0u;
+	template<class FloatType>
+	bool RayPacketHit(const Geometry::RayPacket<FloatType>& rays, FloatType& t, uint32_t* hitPrimitives, RayStats& stats) const;
+	void HitAttributes(uint32_t primitive, const Geometry::Ray& ray, float t, glm::vec3& normal, Material& material) const;
+
+	// Packet version of RayOccluded, returns a mask of the lanes that hit something closer than their maxT
+	template<class FloatType>
+	FloatType RayPacketOccluded(const Geometry::RayPacket<FloatType>& rays, const FloatType& maxT, RayStats& stats) const;
+
+	inline size_t NodeCount() const			{ return m_nodes.size(); }
+	inline size_t PrimitiveCount() const	{ return m_primitives.size(); }
+	inline size_t InstanceCount() const		{ return m_instances.size(); }
+
+private:
+	enum PrimitiveType : uint32_t
+	{
+		SpherePrimitive,			// only during the build, leaves end up with SphereBlockPrimitives
+		TrianglePrimitive,			// only during the build, leaves end up with TriangleBlockPrimitives
+		SphereBlockPrimitive,
+		TriangleBlockPrimitive,
+		VolumePrimitive,
+		InstancePrimitive
+	};
+
+	// Points at a sphere block, triangle block, volume or instance owned by the bvh
+	struct PrimitiveRef
+	{
+		PrimitiveType m_type;
+		uint32_t m_index;
+	};
+
+	// Interior nodes store the index of the first of 2 adjacent children
+	// Leaves store the first primitive index + count (count == 0 means interior node)
+	struct Node
+	{
+		Math::Box3 m_bounds;
+		uint32_t m_firstChildOrPrimitive = 0;
+		uint32_t m_primitiveCount = 0;
+	};
+
+	// A placed copy of a bottom level bvh. Rays are moved into its object space instead of moving the triangles,
+	// the direction is not renormalised so hit distances are the same in both spaces
+	struct Instance
+	{
+		std::shared_ptr<const SceneBvh> m_bvh;
+		glm::mat4 m_worldToObject;
+		glm::mat3 m_normalToWorld;
+		uint32_t m_firstPrimitiveId;	// Hits on primitive p of m_bvh are reported as m_firstPrimitiveId + p
+		Math::Box3 m_bounds;			// World space, used to refit after updates
+	};
+
+	// A placed voxel model, hit faces are reported as m_firstVolumeId + volume * 6 + face
+	struct Volume
+	{
+		std::shared_ptr<const VoxelModel> m_model;
+		glm::vec3 m_position;
+		Material m_material;
+		Math::Box3 m_bounds;			// World space, empty if the model has no blocks
+	};
+
+	// Per-primitive data only needed during the build
+	struct BuildPrimitive
+	{
+		Math::Box3 m_bounds;
+		glm::vec3 m_centroid;
+		PrimitiveRef m_ref;
+	};
+
+	bool MakeInstance(const Scene& scene, uint32_t sceneInstance, Instance& instance) const;
+	bool MakeVolume(const Scene& scene, uint32_t sceneVolume, Volume& volume) const;
+	void AssignInstanceIds();
+	bool InsertLeaf(const PrimitiveRef& ref, const Math::Box3& bounds);
+	Math::Box3 PrimitiveBounds(const PrimitiveRef& ref) const;
+	void Refit();
+	float ComputeCost() const;
+	void BuildRecursive(uint32_t nodeIndex, std::vector<BuildPrimitive>& prims, uint32_t first, uint32_t count, uint32_t depth);
+	void PackLeaves(const std::vector<BuildPrimitive>& prims, const std::vector<const Geometry::PrecomputedTriangle*>& triangles, const std::vector<uint32_t>& triangleMeshes);
+	inline uint32_t TriangleId(uint32_t block, int lane) const	{ return static_cast<uint32_t>(m_spheres.size()) + block * Geometry::TriangleBlock::Width + lane; }
+	const Instance& FindInstance(uint32_t primitiveId) const;
+	// FloatType is the width the primitive blocks are tested at, RayHit + RayOccluded pick it once per ray
+	template<class FloatType>
+	bool ClosestHit(const Geometry::Ray& ray, float& t, uint32_t& hitPrimitive, uint32_t primitiveIdBase, RayStats& stats) const;
+	template<class FloatType>
+	bool AnyHit(const Geometry::Ray& ray, float maxT, RayStats& stats) const;
+	template<class FloatType>
+	bool LeafRayHit(const Node& leaf, const Geometry::Ray& ray, float& closestT, uint32_t& hitPrimitive, uint32_t primitiveIdBase, RayStats& stats) const;
+	template<class FloatType>
+	bool LeafRayOccluded(const Node& leaf, const Geometry::Ray& ray, float maxT, RayStats& stats) const;
+	template<class FloatType>
+	bool PacketClosestHit(const Geometry::RayPacket<FloatType>& rays, FloatType& t, uint32_t* hitPrimitives, uint32_t primitiveIdBase, RayStats& stats) const;
+	template<class FloatType>
+	bool LeafRayPacketHit(const Node& leaf, const Geometry::RayPacket<FloatType>& rays, FloatType& closestT, uint32_t* hitPrimitives, uint32_t primitiveIdBase, RayStats& stats) const;
+	template<class FloatType>
+	int LeafRayPacketOccluded(const Node& leaf, const Geometry::RayPacket<FloatType>& rays, FloatType& maxT, RayStats& stats) const;
+
+	std::vector<Node> m_nodes;
+	std::vector<PrimitiveRef> m_primitives;		// in leaf order
+	std::vector<Sphere> m_spheres;				// primitive ids + materials of spheres index this
+	std::vector<Geometry::SphereBlock> m_sphereBlocks;
+	std::vector<Geometry::TriangleBlock> m_triangleBlocks;
+	std::vector<uint32_t> m_triangleMeshes;		// mesh index per triangle block lane, used to find materials
+	std::vector<Material> m_meshMaterials;
+	std::vector<Volume> m_volumes;				// one per Scene::voxelVolumes entry
+	std::vector<Instance> m_instances;			// sorted by m_firstPrimitiveId
+	uint32_t m_firstVolumeId = 0;				// ids from here to m_firstInstanceId are voxel volume faces
+	uint32_t m_firstInstanceId = 0;				// ids below this are spheres, triangles + volumes in this bvh
+
+	// Used by Update to match the bvh against a newer version of the scene
+	std::vector<uint32_t> m_instanceSources;	// Scene::meshInstances index of each instance
+	size_t m_sceneInstanceCount = 0;			// Scene::meshInstances.size() when last built / updated
+	size_t m_triangleCount = 0;
+	float m_builtCost = 0.0f;					// SAH cost after the last full Build
+	float m_cost = 0.0f;						// SAH cost now
+};
@@ -1,259 +1,846 @@
 #include "cpu_raytracer.h"
 #include "kernel/assert.h"
-#include "kernel/thread.h"
 #include "core/timer.h"
-#include "render/texture.h"
-#include "render/texture_source.h"
 #include "render/camera.h"
+#include "kernel/log.h"
 #include "sde/job_system.h"
+#include "math/morton_encoding.h"
+#include <algorithm>
 
-#include "core/system_enumerator.h"
-#include "sde/script_system.h"
-#include "debug_gui/debug_gui_system.h"
-
-const glm::ivec2 c_outputSize = { 512, 512 };
+// Radical inverse of index in the given base, gives well spread sub-pixel sample positions
+float Halton(int index, int base)
+{
+	float result = 0.0f;
+	float fraction = 1.0f / base;
+	for (; index > 0; index /= base)
+	{
+		result += fraction * (index % base);
+		fraction /= base;
+	}
+	return result;
+}
 
-void CpuRaytracerSystem::CreateScene()
+CpuRaytracer::CpuRaytracer(const Parameters& params)
+	: m_parameters(params)
+	, m_budget(params.m_interactiveTraceTime, params.m_maxRecursion)
+	, m_rebuildInProgress(false)
+	, m_nextTile(0)
+	, m_nextDenoiseRow(0)
+	, m_jobsInProgress(0)
+	, m_traceStatus(Status::Ready)
+	, m_cancelRequested(false)
+	, m_traceStartTime(0)
+	, m_lastTraceTime(0)
 {
-	TraceBoi::RegisterScriptTypes(m_scriptSystem->Globals(), m_scene);
+	m_rawOutput.resize(params.m_image.m_dimensions.x * params.m_image.m_dimensions.y);
+	m_hdrOutput.resize(m_rawOutput.size());
+	m_workerStats.resize(params.m_jobCount);
+	m_adaptiveScratch.resize(params.m_jobCount);	// Adaptive sampling can be turned on at any time, unused ones stay empty
+	if (params.m_wavefront)
+	{
+		m_wavefrontQueues.resize(params.m_jobCount);
+	}
+	m_traceQuality = m_lastTraceQuality = m_budget.FullQuality();
+	BuildTileOrder(params.m_image.m_dimensions);
+	for (const auto& connection : params.m_tileWorkers)
+	{
+		auto remote = std::make_unique<RemoteWorker>();
+		remote->m_connection = connection;
+		RemoteWorker* remoteWorker = remote.get();
+		remote->m_thread = std::thread([this, remoteWorker]()
+		{
+			RemoteWorkerThread(*remoteWorker);
+		});
+		m_remoteWorkers.push_back(std::move(remote));
+	}
+}
 
-	// Load the scene
-	std::string errorText;
-	if (!m_scriptSystem->RunScriptFromFile("scene.lua", errorText))
+void CpuRaytracer::BuildTileOrder(glm::ivec2 imageDims)
+{
+	const int tileSize = m_parameters.m_tileSize;
+	const glm::ivec2 tileCount = (imageDims + glm::ivec2(tileSize - 1)) / tileSize;
+	std::vector<std::pair<uint64_t, glm::ivec2>> sortedTiles;
+	sortedTiles.reserve(tileCount.x * tileCount.y);
+	for (int y = 0; y < tileCount.y; ++y)
+	{
+		for (int x = 0; x < tileCount.x; ++x)
+		{
+			sortedTiles.push_back({ Math::MortonEncode(x, y, 0), glm::ivec2(x, y) * tileSize });
+		}
+	}
+	std::sort(sortedTiles.begin(), sortedTiles.end(), [](const std::pair<uint64_t, glm::ivec2>& a, const std::pair<uint64_t, glm::ivec2>& b)
+	{
+		return a.first < b.first;
+	});
+	m_tileOrigins.clear();
+	m_tileOrigins.reserve(sortedTiles.size());
+	for (const auto& it : sortedTiles)
 	{
-		SDE_LOG("Lua error in scene.lua - %s", errorText.data());
+		m_tileOrigins.push_back(it.second);
 	}
+	m_tileOrderDimensions = imageDims;
+}
 
-	// Setup the camera
-	m_camera.SetFOVAndAspectRatio(51.52f, (float)c_outputSize.x / (float)c_outputSize.y);
-	m_camera.LookAt({ 0.0f, 50.0f, -200.0f }, { 0.0f, 50.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+double CpuRaytracer::GetLoadBalance() const
+{
+	double totalTime = 0.0, maxTime = 0.0;
+	for (const auto& it : m_lastWorkerStats)
+	{
+		totalTime += it.m_busyTime;
+		maxTime = glm::max(maxTime, it.m_busyTime);
+	}
+	return maxTime > 0.0 ? (totalTime / m_lastWorkerStats.size()) / maxTime : 1.0;
 }
 
-bool CpuRaytracerSystem::PreInit(Core::ISystemEnumerator& systemEnumerator)
+CpuRaytracer::~CpuRaytracer()
 {
-	m_debugGui = (DebugGui::DebugGuiSystem*)systemEnumerator.GetSystem("DebugGui");
-	m_scriptSystem = (SDE::ScriptSystem*)systemEnumerator.GetSystem("Script");
+	// Jobs + remote worker threads reference this, so they must all be finished before anything is destroyed
+	// Connections are closed first, a worker that stopped answering would otherwise keep the trace going
+	Cancel();
+	for (auto& remote : m_remoteWorkers)
+	{
+		remote->m_connection->Close();
+	}
+	WaitForTrace();
+	WaitForRebuild();
+	for (auto& remote : m_remoteWorkers)
+	{
+		remote->m_thread.join();
+	}
+}
 
-	// Set up cpu ray tracer
-	CpuRaytracer::Parameters params;
-	params.m_jobSystem = (SDE::JobSystem*)systemEnumerator.GetSystem("Jobs");
-	params.m_maxRecursion = 6;
-	params.m_image.m_dimensions = c_outputSize;
-	m_cpuTracer = std::make_unique<CpuRaytracer>(params);
+void CpuRaytracer::Cancel()
+{
+	if (m_traceStatus == Status::InProgress)
+	{
+		m_cancelRequested = true;
+		m_sampleCount = 0;		// The output may have a partial sample averaged into it
+		DetachRemoteWorkers();
+	}
+}
 
-	return true;
+void CpuRaytracer::WaitForTrace()
+{
+	std::unique_lock<std::mutex> lock(m_traceFinishedMutex);
+	m_traceFinished.wait(lock, [this]()
+	{
+		return m_traceStatus != Status::InProgress;
+	});
 }
 
-bool CpuRaytracerSystem::PostInit()
+void CpuRaytracer::CancelStaleTrace()
 {
-	CreateScene();
-	return true;
+	// Interactive traces are within budget, letting them finish shows changes sooner than restarting every frame
+	if (!m_traceIsInteractive)
+	{
+		Cancel();
+	}
+	m_sampleCount = 0;
+	m_lastChangeTime = Core::Timer().GetSeconds();
 }
 
-void CpuRaytracerSystem::UpdateSceneControls()
+void CpuRaytracer::InvalidateScene()
 {
-	static bool s_controlsOpen = true;
-	m_debugGui->BeginWindow(s_controlsOpen, "Controls", { 512,512 });
+	// Jobs hold their own reference, so this is safe even if a trace is in progress
+	CancelStaleTrace();
+	if (m_sceneSnapshot != nullptr)
+	{
+		m_previousSnapshot = m_sceneSnapshot;
+	}
+	m_sceneSnapshot = nullptr;
+}
 
-	auto frand = [](float min, float max)
+void CpuRaytracer::UpdateSceneSnapshot(const Scene& scene)
+{
+	TakeRebuiltSnapshot();
+	const float rebuildThreshold = m_parameters.m_bvhRebuildThreshold;
+	if (m_sceneSnapshot == nullptr)
 	{
-		return min + (rand() / (float)RAND_MAX) * fabs(max - min);
-	};
+		if (m_previousSnapshot != nullptr && rebuildThreshold > 0.0f)
+		{
+			m_sceneSnapshot = std::make_shared<const SceneSnapshot>(scene, *m_previousSnapshot);
+		}
+		else
+		{
+			m_sceneSnapshot = std::make_shared<const SceneSnapshot>(scene);
+		}
+		m_previousSnapshot = nullptr;
+	}
+	if (!m_rebuildInProgress && rebuildThreshold > 0.0f && m_sceneSnapshot->GetBvh().Degradation() > rebuildThreshold)
+	{
+		StartBackgroundRebuild();
+	}
+}
 
-	for (int s = 0; s < m_scene.spheres.size(); ++s)
+void CpuRaytracer::TakeRebuiltSnapshot()
+{
+	std::shared_ptr<const SceneSnapshot> rebuilt;
 	{
-		char label[256] = { '\0' };
-		sprintf_s(label, "Sphere %d", s);
-		m_debugGui->DragVector(label, m_scene.spheres[s].m_sphere.m_posAndRadius, 0.25f);
-		sprintf_s(label, "Sphere Material %d", s);
-		m_debugGui->DragFloat(label, m_scene.spheres[s].m_material.m_refractiveIndex, 0.01f, -1.0f, 10.0f);
+		std::lock_guard<std::mutex> lock(m_traceFinishedMutex);
+		rebuilt.swap(m_rebuiltSnapshot);
 	}
-	if (m_debugGui->Button("Add Sphere"))
+	if (rebuilt == nullptr)
 	{
-		m_scene.spheres.push_back({
-			glm::vec4(frand(-50.0f,50.0f), frand(0.0f,50.0f), frand(0.0f,50.0f), frand(2.0, 20.0f)), {1.01f, Diffuse}
-			});
+		return;
 	}
-	m_debugGui->Separator();
-	for (int l = 0; l < m_scene.lights.size(); ++l)
+	if (m_sceneSnapshot == nullptr)
 	{
-		char label[256] = { '\0' };
-		sprintf_s(label, "Light %d Position", l);
-		m_debugGui->DragVector(label, m_scene.lights[l].m_position, 0.25f);
-		sprintf_s(label, "Light %d Colour", l);
-		m_debugGui->DragVector(label, m_scene.lights[l].m_diffuse, 0.05f, 0.0f, 1.0f);
+		m_previousSnapshot = rebuilt;	// The scene changed again, the next snapshot updates the rebuilt bvh instead
 	}
-	m_debugGui->Separator();
-	glm::vec4 c = glm::vec4(m_scene.skyColour, 1.0f);
-	m_debugGui->ColourEdit("Sky Colour", c);
-	m_scene.skyColour = { c.x, c.y, c.z };
-	if (m_debugGui->Button("Add Light"))
+	else if (m_sceneSnapshot == m_rebuildSource)
 	{
-		m_scene.lights.push_back({
-			{frand(-250.0f,250.0f),frand(50.0f,500.0f), frand(-250.0f,250.0f)},
-			{frand(0.0f,0.5f), frand(0.0f,0.5f), frand(0.0f,0.5f)}
-			});
+		m_sceneSnapshot = rebuilt;		// Same scene, so accumulated samples are still valid
 	}
-	m_debugGui->Separator();
-	glm::vec3 cameraPos = m_camera.Position();
-	m_debugGui->DragVector("Camera Position", cameraPos, 0.1f);
-	m_camera.SetPosition(cameraPos);
-	glm::vec3 cameraT = m_camera.Target();
-	m_debugGui->DragVector("Camera Target", cameraT, 0.1f);
-	m_camera.SetTarget(cameraT);
-
-	m_debugGui->EndWindow();
+	else
+	{
+		// Edits made during the rebuild are much cheaper to re-apply than the degradation they were working from
+		m_sceneSnapshot = std::make_shared<const SceneSnapshot>(m_sceneSnapshot->GetScene(), *rebuilt);
+	}
+	m_rebuildSource = nullptr;
 }
 
-void CpuRaytracerSystem::UpdateControls()
+// The source snapshot is immutable, so the job can build from it while traces and edits carry on
+void CpuRaytracer::StartBackgroundRebuild()
 {
-	static bool s_controlsOpen = true;
-	m_debugGui->BeginWindow(s_controlsOpen, "Controls", { 512,512 });
+	m_rebuildInProgress = true;
+	m_rebuildSource = m_sceneSnapshot;
+	std::shared_ptr<const SceneSnapshot> source = m_sceneSnapshot;
+	m_parameters.m_jobSystem->PushJob([this, source]()
+	{
+		auto rebuilt = std::make_shared<const SceneSnapshot>(source->GetScene());
+		std::lock_guard<std::mutex> lock(m_traceFinishedMutex);
+		m_rebuiltSnapshot = rebuilt;
+		m_rebuildInProgress = false;
+		m_traceFinished.notify_all();
+	});
+}
 
-	char text[256] = { '\0' };
-	sprintf_s(text, "Raytrace time: %fs", m_cpuTracer->GetLastDrawTime());
-	m_debugGui->Text(text);
+void CpuRaytracer::WaitForRebuild()
+{
+	std::unique_lock<std::mutex> lock(m_traceFinishedMutex);
+	m_traceFinished.wait(lock, [this]()
+	{
+		return !m_rebuildInProgress;
+	});
+}
 
-	const char* statusAsText[] = {
-		"Ready",
-		"In Progress",
-		"Complete",
-		"Paused",
-		"_unknown"
-	};
-	sprintf_s(text, "Status: %s\n", statusAsText[m_cpuTracer->GetStatus()]);
-	m_debugGui->Text(text);
+bool CpuRaytracer::TryDrawScene(const Scene& scene, Render::Camera& camera)
+{
+	if (camera.ViewMatrix() != m_sampleViewMatrix || camera.FOV() != m_sampleFov)
+	{
+		m_sampleViewMatrix = camera.ViewMatrix();
+		m_sampleFov = camera.FOV();
+		CancelStaleTrace();
+	}
+	if (m_cancelRequested)
+	{
+		// Local jobs only finish the tile they are on + remote workers were detached by the cancel, so this is short
+		WaitForTrace();
+	}
+	const double timeSinceChange = Core::Timer().GetSeconds() - m_lastChangeTime;
+	const bool interactive = m_parameters.m_interactiveTraceTime > 0.0 && timeSinceChange < m_parameters.m_refineDelay;
+	if (!interactive && m_parameters.m_progressive && m_sampleCount >= m_parameters.m_maxSamples)
+	{
+		return false;	// Converged, nothing to do until something changes
+	}
 
-	m_debugGui->Checkbox("Paused", &m_isPaused);
-	m_debugGui->EndWindow();
+	int traceReady = Status::Ready;
+	if (m_traceStatus.compare_exchange_strong(traceReady, Status::InProgress))
+	{
+		UpdateSceneSnapshot(scene);
+		SubmitRenderJobs(camera, interactive);
+		return true;
+	}
+	return false;
 }
 
-bool CpuRaytracerSystem::Tick()
+void CpuRaytracer::SubmitRenderJobs(Render::Camera& camera, bool interactive)
 {
-	UpdateControls();
-	UpdateSceneControls();
+	SDE_ASSERT(m_traceStatus == Status::InProgress);
 
-	if (!m_isPaused)
+	Core::Timer jobTimer;
+	m_traceStartTime = jobTimer.GetSeconds();
+	m_nextTile = 0;
+	m_cancelRequested = false;
+
+	// Tiles a cancelled trace finished but nobody took, this trace writes over them (Morton order starts on the same tiles)
 	{
-		m_cpuTracer->TryDrawScene(m_scene, m_camera);
+		std::lock_guard<std::mutex> lock(m_finishedTilesMutex);
+		m_finishedTiles.clear();
 	}
-	m_cpuTracer->Tick();
 
-	// Use imgui as a free blitter!
-	if (m_cpuTracer->GetTexture() != nullptr)
+	// Interactive traces may be smaller than the output, they get their own buffer + tile order
+	m_traceIsInteractive = interactive;
+	m_traceQuality = interactive ? m_budget.NextQuality(m_parameters.m_image.m_dimensions) : m_budget.FullQuality();
+	m_traceReprojected = interactive && TryReproject(camera);
+	if (m_traceReprojected)
+	{
+		m_traceQuality.m_resolutionDivisor = 1;
+	}
+	m_traceCamera = camera;
+	const glm::ivec2 imageDimensions = TraceBudget::TracedDimensions(m_parameters.m_image.m_dimensions, m_traceQuality.m_resolutionDivisor);
+	if (imageDimensions != m_tileOrderDimensions)
+	{
+		BuildTileOrder(imageDimensions);
+	}
+	std::vector<glm::vec4>* outputBuffer = &m_hdrOutput;
+	if (m_traceQuality.m_resolutionDivisor > 1)
+	{
+		m_reducedOutput.resize(imageDimensions.x * imageDimensions.y);
+		outputBuffer = &m_reducedOutput;
+	}
+	// Denoised + reprojected traces are only shown once complete, so their tiles do not flicker over the last image
+	m_historyValid = false;
+	m_traceDenoised = m_parameters.m_denoise && outputBuffer == &m_hdrOutput;
+	const bool writeFeatures = outputBuffer == &m_hdrOutput && (m_traceDenoised || ReprojectionEnabled());
+	if (writeFeatures)
 	{
-		bool stayOpen = true;
-		m_debugGui->BeginWindow(stayOpen, "Cpu Output", glm::vec2(c_outputSize + glm::ivec2(16,32)));
-		m_debugGui->Image(*m_cpuTracer->GetTexture(), glm::vec2(c_outputSize));
-		m_debugGui->EndWindow();
+		m_features.m_normalDepth.resize(m_hdrOutput.size());
+		m_features.m_material.resize(m_hdrOutput.size());
+	}
+	if (m_traceDenoised)
+	{
+		m_denoisedOutput.resize(m_hdrOutput.size());
+	}
+	const bool reportTiles = outputBuffer == &m_hdrOutput && !m_traceDenoised && !m_traceReprojected;	// Tiles written straight to the output can be shown as soon as they finish
+
+	// Each worker keeps taking the next tile until they are all gone, so slow
+	// tiles (lots of reflections, etc) do not leave the other workers idle
+	const std::vector<glm::ivec2>* tileOrigins = m_traceReprojected ? &m_reprojectedTiles : &m_tileOrigins;
+	const int tileCount = static_cast<int>(tileOrigins->size());
+	const glm::ivec2 tileSize(m_parameters.m_tileSize);
+	// Every job shares the same snapshot, the references in params stay valid as long as the job holds it
+	std::shared_ptr<const SceneSnapshot> snapshot = m_sceneSnapshot;
+	TraceParamaters params = { *outputBuffer, snapshot->GetScene(), snapshot->GetBvh(), camera, imageDimensions, glm::ivec2(0), tileSize, m_traceQuality.m_maxRecursion };
+	params.primaryRayPackets = m_parameters.m_primaryRayPackets;
+	params.lightBvh = &snapshot->GetLightBvh();
+	params.lightCutoff = m_parameters.m_lightCutoff;
+	params.lightSamples = m_parameters.m_lightSamples;
+	params.features = writeFeatures ? &m_features : nullptr;
+	if (!interactive)
+	{
+		params.adaptive = m_parameters.m_adaptive;	// Interactive traces are already within budget at one ray per pixel
+	}
+	if (m_parameters.m_progressive && !interactive)
+	{
+		// First sample goes through the pixel centre so the initial image matches a non-progressive trace
+		++m_sampleCount;
+		params.sampleOffset = m_sampleCount == 1 ? glm::vec2(0.5f) : glm::vec2(Halton(m_sampleCount, 2), Halton(m_sampleCount, 3));
+		params.sampleCount = m_sampleCount;
 	}
 
-	return true;
+	// Remote workers are only worth their round trips for full quality traces
+	std::vector<RemoteWorker*> remotes;
+	if (!interactive)
+	{
+		for (auto& remote : m_remoteWorkers)
+		{
+			if (remote->m_connected && !remote->m_busy)
+			{
+				remote->m_statsIndex = m_parameters.m_jobCount + static_cast<int>(remotes.size());
+				remotes.push_back(remote.get());
+			}
+		}
+	}
+	m_workerStats.resize(m_parameters.m_jobCount + remotes.size());
+	m_jobsInProgress = m_parameters.m_jobCount + static_cast<int>(remotes.size());
+	for (int j = 0; j < m_parameters.m_jobCount; ++j)
+	{
+		m_parameters.m_jobSystem->PushJob([=, keepAlive = snapshot]() mutable
+		{
+			Core::Timer workerTimer;
+			WorkerStats& stats = m_workerStats[j];
+			stats = WorkerStats();
+			params.rayStats = &stats.m_rayStats;
+			params.wavefront = m_parameters.m_wavefront ? &m_wavefrontQueues[j] : nullptr;
+			params.adaptiveScratch = &m_adaptiveScratch[j];
+			for (int tile = m_nextTile++; tile < tileCount && !m_cancelRequested; tile = m_nextTile++)
+			{
+				double tileStartTime = workerTimer.GetSeconds();
+				params.outputOrigin = (*tileOrigins)[tile];
+				params.outputDimensions = glm::min(tileSize, imageDimensions - params.outputOrigin);	// edge tiles may be clipped
+				TraceBoi::TraceMeSomethingNice(params);
+				stats.m_busyTime += workerTimer.GetSeconds() - tileStartTime;
+				stats.m_tilesTraced++;
+				if (reportTiles)
+				{
+					std::lock_guard<std::mutex> lock(m_finishedTilesMutex);
+					m_finishedTiles.push_back({ params.outputOrigin, params.outputDimensions });
+				}
+			}
+			OnJobFinished(jobTimer.GetSeconds());
+		});
+	}
+
+	if (!remotes.empty())
+	{
+		if (m_remoteSnapshot.lock() != snapshot)
+		{
+			// Serialised once, each worker gets a copy when its next trace starts
+			WireFormat::WriteScene(m_remoteSceneMessage, ++m_remoteSceneId, snapshot->GetScene());
+			m_remoteSnapshot = snapshot;
+		}
+		m_remoteTrace.m_traceId++;
+		m_remoteTrace.m_params = std::make_unique<TraceParamaters>(params);
+		m_remoteTrace.m_snapshot = snapshot;
+		m_remoteTrace.m_tileOrigins = tileOrigins;
+		m_remoteTrace.m_tileCount = tileCount;
+		m_remoteTrace.m_reportTiles = reportTiles;
+
+		WireFormat::TraceSettings settings;
+		settings.m_traceId = m_remoteTrace.m_traceId;
+		settings.m_sceneId = m_remoteSceneId;
+		settings.m_cameraPosition = camera.Position();
+		settings.m_cameraTarget = camera.Target();
+		settings.m_cameraUp = camera.Up();
+		settings.m_fov = camera.FOV();
+		settings.m_imageDimensions = imageDimensions;
+		settings.m_maxRecursion = m_traceQuality.m_maxRecursion;
+		settings.m_sampleOffset = params.sampleOffset;
+		settings.m_sampleCount = params.sampleCount;
+		settings.m_lightCutoff = params.lightCutoff;
+		settings.m_lightSamples = params.lightSamples;
+		settings.m_primaryRayPackets = params.primaryRayPackets;
+		settings.m_wavefront = m_parameters.m_wavefront;
+		settings.m_features = writeFeatures;
+		settings.m_adaptive = params.adaptive;
+		for (RemoteWorker* remote : remotes)
+		{
+			m_workerStats[remote->m_statsIndex] = WorkerStats();
+			StartRemoteTrace(*remote, settings);
+		}
+	}
 }
 
-void CpuRaytracerSystem::Shutdown()
+void CpuRaytracer::StartRemoteTrace(RemoteWorker& remote, const WireFormat::TraceSettings& settings)
 {
-	m_cpuTracer = nullptr;
+	bool disconnected = false;
+	{
+		std::lock_guard<std::mutex> lock(remote.m_traceMutex);
+		remote.m_traceId = settings.m_traceId;
+		remote.m_endSent = false;
+		remote.m_tilesInFlight.clear();
+		remote.m_lastMessageTime = Core::Timer().GetSeconds();
+		if (remote.m_sceneId != settings.m_sceneId)
+		{
+			std::vector<uint8_t> scene = m_remoteSceneMessage;
+			remote.m_connection->Send(std::move(scene));
+			remote.m_sceneId = settings.m_sceneId;
+		}
+		std::vector<uint8_t> trace;
+		WireFormat::WriteTrace(trace, settings);
+		remote.m_connection->Send(std::move(trace));
+
+		// If its thread saw the disconnect first, it will not finish the trace for it
+		disconnected = !remote.m_connected;
+		remote.m_inTrace = !disconnected;
+		remote.m_busy = !disconnected;
+	}
+	if (disconnected)
+	{
+		OnJobFinished(Core::Timer().GetSeconds());
+	}
 }
 
-CpuRaytracer::CpuRaytracer(const Parameters& params)
-	: m_parameters(params)
-	, m_jobsInProgress(0)
-	, m_traceStatus(Status::Ready)
-	, m_traceStartTime(0)
-	, m_lastTraceTime(0)
+// Cancelled traces finish without their remote workers, which are told to stop + kept out of new traces until they echo the end
+// Anything else they send for the cancelled trace is ignored
+void CpuRaytracer::DetachRemoteWorkers()
 {
-	m_rawOutput.resize(params.m_image.m_dimensions.x * params.m_image.m_dimensions.y);
+	for (auto& remote : m_remoteWorkers)
+	{
+		bool detached = false;
+		{
+			std::lock_guard<std::mutex> lock(remote->m_traceMutex);
+			detached = remote->m_inTrace.exchange(false);
+			if (detached && !remote->m_endSent)
+			{
+				std::vector<uint8_t> message;
+				WireFormat::WriteEndTrace(message, remote->m_traceId);
+				remote->m_connection->Send(std::move(message));
+				remote->m_endSent = true;
+			}
+		}
+		if (detached)
+		{
+			OnJobFinished(Core::Timer().GetSeconds());
+		}
+	}
 }
 
-CpuRaytracer::~CpuRaytracer()
+// Closing the connection ends the worker's thread the same way as a dropped connection, its tiles are traced locally
+void CpuRaytracer::DisconnectSilentWorkers()
 {
-	while (m_traceStatus == Status::InProgress)
+	const double now = Core::Timer().GetSeconds();
+	for (auto& remote : m_remoteWorkers)
 	{
-		Kernel::Thread::Sleep(10);	//nasty
+		if (remote->m_busy && remote->m_connected && now - remote->m_lastMessageTime > m_parameters.m_tileWorkerTimeout)
+		{
+			SDE_LOG("Tile worker has not answered for %fs, disconnecting it", now - remote->m_lastMessageTime);
+			remote->m_connection->Close();
+		}
 	}
 }
 
-Render::Texture* CpuRaytracer::GetTexture()
+// Handles one worker's messages until it disconnects. Its tiles come from m_nextTile, the same as the local jobs
+void CpuRaytracer::RemoteWorkerThread(RemoteWorker& remote)
 {
-	return m_texture.get();
+	std::vector<uint8_t> message;
+	WireFormat::TileResult result;
+	bool messageOk = true;
+	Core::Timer timer;
+	while (messageOk && remote.m_connection->Receive(message))
+	{
+		remote.m_lastMessageTime = timer.GetSeconds();
+		WireFormat::Reader reader(message);
+		WireFormat::MessageType type;
+		uint32_t value = 0;
+		if (!WireFormat::ReadMessageType(reader, type))
+		{
+			messageOk = false;
+			break;
+		}
+		bool traceFinished = false;
+		{
+			std::lock_guard<std::mutex> lock(remote.m_traceMutex);
+			const bool detached = !remote.m_inTrace;	// Cancelled, only the end echo matters now
+			switch (type)
+			{
+			case WireFormat::PullMessage:
+				messageOk = remote.m_busy && WireFormat::ReadPull(reader, value) && value > 0;
+				if (messageOk && !detached)
+				{
+					SendRemoteTiles(remote, value);
+				}
+				break;
+			case WireFormat::TileResultMessage:
+				messageOk = remote.m_busy && WireFormat::ReadTileResult(reader, result) && (detached || OutputRemoteTile(remote, result));
+				if (messageOk && !detached)
+				{
+					SendRemoteTiles(remote, 1);
+				}
+				break;
+			case WireFormat::EndTraceMessage:
+				messageOk = remote.m_busy && WireFormat::ReadEndTrace(reader, value) && value == remote.m_traceId
+					&& remote.m_endSent && (detached || remote.m_tilesInFlight.empty());
+				if (messageOk)
+				{
+					remote.m_busy = false;
+					traceFinished = remote.m_inTrace.exchange(false);
+				}
+				break;
+			default:
+				messageOk = false;		// Only sent by the coordinator
+				break;
+			}
+		}
+		if (traceFinished)
+		{
+			OnJobFinished(Core::Timer().GetSeconds());
+		}
+	}
+	if (!messageOk)
+	{
+		SDE_LOG("Bad message from a tile worker, disconnecting it");
+	}
+	remote.m_connection->Close();
+	bool traceFinished = false;
+	{
+		std::lock_guard<std::mutex> lock(remote.m_traceMutex);
+		remote.m_connected = false;
+		remote.m_busy = false;
+		traceFinished = remote.m_inTrace.exchange(false);
+		if (traceFinished)
+		{
+			TraceLostTiles(remote);
+		}
+	}
+	if (traceFinished)
+	{
+		OnJobFinished(Core::Timer().GetSeconds());
+	}
 }
 
-bool CpuRaytracer::TryDrawScene(Scene& scene, Render::Camera& camera)
+void CpuRaytracer::SendRemoteTiles(RemoteWorker& remote, uint32_t count)
 {
-	int traceReady = Status::Ready;
-	if (m_traceStatus.compare_exchange_strong(traceReady, Status::InProgress))
+	const TraceParamaters& params = *m_remoteTrace.m_params;
+	for (uint32_t i = 0; i < count && !remote.m_endSent; ++i)
 	{
-		SubmitRenderJobs(scene, camera);
-		return true;
+		const int tile = m_cancelRequested ? m_remoteTrace.m_tileCount : m_nextTile++;
+		std::vector<uint8_t> message;
+		if (tile >= m_remoteTrace.m_tileCount)
+		{
+			WireFormat::WriteEndTrace(message, remote.m_traceId);
+			remote.m_endSent = true;
+		}
+		else
+		{
+			WireFormat::TileJob job;
+			job.m_traceId = remote.m_traceId;
+			job.m_origin = (*m_remoteTrace.m_tileOrigins)[tile];
+			job.m_size = glm::min(glm::ivec2(m_parameters.m_tileSize), params.imageDimensions - job.m_origin);
+			remote.m_tilesInFlight.push_back(job);
+			WireFormat::WriteTile(message, job);
+		}
+		remote.m_connection->Send(std::move(message));
 	}
-	return false;
 }
 
-void CpuRaytracer::SubmitRenderJobs(Scene& scene, Render::Camera& camera)
+// Blended in exactly the same way as a tile traced locally
+bool CpuRaytracer::OutputRemoteTile(RemoteWorker& remote, const WireFormat::TileResult& result)
 {
-	SDE_ASSERT(m_parameters.m_image.m_dimensions.y % m_parameters.m_jobCount == 0);
-	SDE_ASSERT(m_traceStatus == Status::InProgress);
+	auto inFlight = std::find_if(remote.m_tilesInFlight.begin(), remote.m_tilesInFlight.end(), [&result](const WireFormat::TileJob& job)
+	{
+		return job.m_traceId == result.m_tile.m_traceId && job.m_origin == result.m_tile.m_origin && job.m_size == result.m_tile.m_size;
+	});
+	TraceParamaters params = *m_remoteTrace.m_params;
+	if (inFlight == remote.m_tilesInFlight.end() || (params.features != nullptr && result.m_features.m_normalDepth.empty()))
+	{
+		return false;
+	}
+	remote.m_tilesInFlight.erase(inFlight);
+	params.outputOrigin = result.m_tile.m_origin;
+	params.outputDimensions = result.m_tile.m_size;
+	TraceBoi::OutputTile(params, result.m_colour, &result.m_features);
+
+	WorkerStats& stats = m_workerStats[remote.m_statsIndex];
+	stats.m_busyTime += result.m_traceTime;
+	stats.m_tilesTraced++;
+	stats.m_rayStats += result.m_rayStats;
+	if (m_remoteTrace.m_reportTiles)
+	{
+		std::lock_guard<std::mutex> lock(m_finishedTilesMutex);
+		m_finishedTiles.push_back({ params.outputOrigin, params.outputDimensions });
+	}
+	return true;
+}
 
-	Core::Timer jobTimer;
-	m_traceStartTime = jobTimer.GetSeconds();
-	m_jobsInProgress = m_parameters.m_jobCount;
-	auto imageDimensions = glm::ivec2(m_parameters.m_image.m_dimensions.x, m_parameters.m_image.m_dimensions.y);
+// Slow, but the trace cannot complete without them
+void CpuRaytracer::TraceLostTiles(RemoteWorker& remote)
+{
+	if (m_cancelRequested || remote.m_tilesInFlight.empty())
+	{
+		return;
+	}
+	SDE_LOG("Lost a tile worker, tracing its %d tiles locally", (int)remote.m_tilesInFlight.size());
+	WorkerStats& stats = m_workerStats[remote.m_statsIndex];
+	TraceParamaters params = *m_remoteTrace.m_params;
+	params.rayStats = &stats.m_rayStats;
+	params.adaptiveScratch = &remote.m_adaptiveScratch;
+	Core::Timer timer;
+	for (const auto& tile : remote.m_tilesInFlight)
+	{
+		if (m_cancelRequested)
+		{
+			break;		// Cancelling waits for this, see DetachRemoteWorkers
+		}
+		const double tileStartTime = timer.GetSeconds();
+		params.outputOrigin = tile.m_origin;
+		params.outputDimensions = tile.m_size;
+		TraceBoi::TraceMeSomethingNice(params);
+		stats.m_busyTime += timer.GetSeconds() - tileStartTime;
+		stats.m_tilesTraced++;
+		if (m_remoteTrace.m_reportTiles)
+		{
+			std::lock_guard<std::mutex> lock(m_finishedTilesMutex);
+			m_finishedTiles.push_back({ params.outputOrigin, params.outputDimensions });
+		}
+	}
+	remote.m_tilesInFlight.clear();
+}
+
+void CpuRaytracer::OnJobFinished(double traceEndTime)
+{
+	if (--m_jobsInProgress <= 0)
+	{
+		if (m_traceDenoised && !m_cancelRequested)
+		{
+			m_denoiser.Begin(m_parameters.m_denoiser, m_parameters.m_image.m_dimensions, m_hdrOutput, m_features, m_denoisedOutput);
+			PushDenoiseStage(0);
+			return;
+		}
+		FinishTrace(traceEndTime);
+	}
+}
 
-	int rowsPerJob = m_parameters.m_image.m_dimensions.y / m_parameters.m_jobCount;
+// Each stage needs the whole of the last one, so the last job to finish a stage pushes the next
+void CpuRaytracer::PushDenoiseStage(int stage)
+{
+	m_nextDenoiseRow = 0;
+	m_jobsInProgress = m_parameters.m_jobCount;
 	for (int j = 0; j < m_parameters.m_jobCount; ++j)
 	{
-		// split the image into horizontal strips 
-		glm::ivec2 origin(0, j * rowsPerJob);
-		glm::ivec2 dimensions(m_parameters.m_image.m_dimensions.x, rowsPerJob);
-		TraceParamaters params = { m_rawOutput, scene, camera, imageDimensions, origin, dimensions, m_parameters.m_maxRecursion };
-		m_parameters.m_jobSystem->PushJob([=]()
+		m_parameters.m_jobSystem->PushJob([this, stage]()
 		{
-			TraceBoi::TraceMeSomethingNice(params);
-			if (--m_jobsInProgress <= 0)
+			const int rowCount = m_denoiser.RowCount();
+			const int bandSize = m_parameters.m_tileSize;
+			for (int row = m_nextDenoiseRow.fetch_add(bandSize); row < rowCount && !m_cancelRequested; row = m_nextDenoiseRow.fetch_add(bandSize))
 			{
-				m_lastTraceTime = jobTimer.GetSeconds() - m_traceStartTime;
-				m_traceStatus = Status::Complete;
+				m_denoiser.RunStage(stage, row, glm::min(bandSize, rowCount - row));
 			}
+			OnDenoiseJobFinished(stage);
 		});
 	}
 }
 
-void CpuRaytracer::UpdateTextureFromResult()
+void CpuRaytracer::OnDenoiseJobFinished(int stage)
 {
-	glm::uvec2 imageDims = { m_parameters.m_image.m_dimensions.x, m_parameters.m_image.m_dimensions.y };
-
-	std::vector<Render::TextureSource::MipDesc> mips;
-	mips.push_back({ imageDims.x, imageDims.y, 0, sizeof(uint32_t) * imageDims.x * imageDims.y });
-	Render::TextureSource textureDescriptor(imageDims.x, imageDims.y, Render::TextureSource::Format::RGBA8, mips, m_rawOutput);
-	std::vector<Render::TextureSource> textureSources;
-	textureSources.push_back(textureDescriptor);
-
-	CreateOrUpdateTexture(textureSources);
+	if (--m_jobsInProgress <= 0)
+	{
+		if (stage + 1 < m_denoiser.StageCount() && !m_cancelRequested)
+		{
+			PushDenoiseStage(stage + 1);
+			return;
+		}
+		FinishTrace(Core::Timer().GetSeconds());	// Denoising counts towards the trace time
+	}
 }
 
-void CpuRaytracer::CreateOrUpdateTexture(const std::vector<Render::TextureSource>& ts)
+void CpuRaytracer::FinishTrace(double traceEndTime)
 {
-	if (m_texture == nullptr)
 	{
-		m_texture = std::make_unique<Render::Texture>();
-		if (!m_texture->Create(ts))
+		// Nothing can touch this after the status changes, the owner may be waiting to destroy it
+		std::lock_guard<std::mutex> lock(m_traceFinishedMutex);
+		if (m_cancelRequested)
 		{
-			m_texture = nullptr;
+			m_traceStatus = Status::Ready;		// Skip Complete so the partial image is never used
 		}
+		else
+		{
+			m_lastTraceTime = traceEndTime - m_traceStartTime;
+			m_traceStatus = Status::Complete;
+		}
+		m_traceFinished.notify_all();
 	}
-	else
+}
+
+void CpuRaytracer::TakeFinishedTiles(std::vector<TileRect>& tiles)
+{
+	const size_t firstTile = tiles.size();
+	{
+		std::lock_guard<std::mutex> lock(m_finishedTilesMutex);
+		tiles.insert(tiles.end(), m_finishedTiles.begin(), m_finishedTiles.end());
+		m_finishedTiles.clear();
+	}
+	for (size_t t = firstTile; t < tiles.size(); ++t)
+	{
+		ToneMap::Apply(m_parameters.m_toneMap, m_hdrOutput, m_rawOutput, m_parameters.m_image.m_dimensions, tiles[t].m_origin, tiles[t].m_size);
+	}
+}
+
+bool CpuRaytracer::SetToneMap(const ToneMap::Parameters& toneMap)
+{
+	m_parameters.m_toneMap = toneMap;
+	if (m_traceStatus == Status::InProgress)
+	{
+		return false;
+	}
+	ToneMap::Apply(m_parameters.m_toneMap, GetHdrOutput().data(), m_rawOutput.data(), m_rawOutput.size());
+	return true;
+}
+
+void CpuRaytracer::SetDenoise(bool denoise)
+{
+	if (denoise != m_parameters.m_denoise)
+	{
+		m_parameters.m_denoise = denoise;
+		CancelStaleTrace();
+	}
+}
+
+void CpuRaytracer::SetAdaptiveSampling(const AdaptiveSampling& adaptive)
+{
+	const AdaptiveSampling& current = m_parameters.m_adaptive;
+	if (adaptive.m_maxSamples != current.m_maxSamples || adaptive.m_contrastThreshold != current.m_contrastThreshold || adaptive.m_budget != current.m_budget
+		|| adaptive.m_probeTileBorders != current.m_probeTileBorders)
 	{
-		m_texture->Update(ts);
+		m_parameters.m_adaptive = adaptive;
+		CancelStaleTrace();
 	}
 }
 
-void CpuRaytracer::Tick()
+void CpuRaytracer::SetLightSelection(float cutoff, int samples)
 {
+	if (cutoff != m_parameters.m_lightCutoff || samples != m_parameters.m_lightSamples)
+	{
+		m_parameters.m_lightCutoff = cutoff;
+		m_parameters.m_lightSamples = samples;
+		CancelStaleTrace();
+	}
+}
+
+bool CpuRaytracer::Tick()
+{
+	DisconnectSilentWorkers();
+
 	// If we can switch from complete -> ready, then the last job finished
 	int traceComplete = Status::Complete;
 	if (m_traceStatus.compare_exchange_strong(traceComplete, Status::Ready))
 	{
-		UpdateTextureFromResult();
+		m_lastWorkerStats = m_workerStats;
+		m_lastRayStats = RayStats();
+		for (const auto& it : m_lastWorkerStats)
+		{
+			m_lastRayStats += it.m_rayStats;
+		}
+		if (m_traceIsInteractive && !m_traceReprojected)
+		{
+			// Only part of a reprojected image is traced, so its time says little about the cost of a whole trace
+			// Full quality traces add adaptive supersampling + denoising, their cost per pixel is many times an interactive one
+			m_budget.AddTrace(m_lastTraceTime, TraceBudget::TracedDimensions(m_parameters.m_image.m_dimensions, m_traceQuality.m_resolutionDivisor));
+		}
+		if (m_traceQuality.m_resolutionDivisor > 1)
+		{
+			UpscaleReducedOutput();
+		}
+		else if (ReprojectionEnabled())
+		{
+			if (!m_traceReprojected)
+			{
+				m_reprojection.ClearAges(m_parameters.m_reprojection, m_parameters.m_image.m_dimensions, m_parameters.m_tileSize);
+			}
+			m_historyValid = true;
+			m_historyCamera = m_traceCamera;
+			m_historySnapshot = m_sceneSnapshot;
+		}
+		m_lastTraceDenoised = m_traceDenoised;
+		m_lastTraceReprojected = m_traceReprojected;
+		ToneMap::Apply(m_parameters.m_toneMap, GetHdrOutput().data(), m_rawOutput.data(), m_rawOutput.size());
+		m_lastTraceQuality = m_traceQuality;
+		return true;
+	}
+	return false;
+}
+
+// Only camera moves can be reprojected, the last image must be a complete full resolution trace of the same scene
+// Done on the main thread, as the splats are scattered + depth tested they do not split into jobs easily
+bool CpuRaytracer::TryReproject(const Render::Camera& camera)
+{
+	if (!ReprojectionEnabled() || !m_historyValid || m_historySnapshot.lock() != m_sceneSnapshot)
+	{
+		return false;
+	}
+	const glm::ivec2 dimensions = m_parameters.m_image.m_dimensions;
+	if (dimensions != m_tileOrderDimensions)
+	{
+		BuildTileOrder(dimensions);
+	}
+	return m_reprojection.Reproject(m_parameters.m_reprojection, m_historyCamera, camera, dimensions, m_parameters.m_tileSize,
+		m_tileOrigins, m_hdrOutput, m_features, m_reprojectedTiles);
+}
+
+// Nearest neighbour, cheap enough to do on the main thread and keeps interactive edges sharp
+void CpuRaytracer::UpscaleReducedOutput()
+{
+	const glm::ivec2 outputDims = m_parameters.m_image.m_dimensions;
+	const int divisor = m_traceQuality.m_resolutionDivisor;
+	const int reducedWidth = TraceBudget::TracedDimensions(outputDims, divisor).x;
+	for (int y = 0; y < outputDims.y; ++y)
+	{
+		const glm::vec4* srcRow = &m_reducedOutput[(y / divisor) * reducedWidth];
+		glm::vec4* dstRow = &m_hdrOutput[y * outputDims.x];
+		for (int x = 0; x < outputDims.x; ++x)
+		{
+			dstRow[x] = srcRow[x / divisor];
+		}
 	}
 }
\ No newline at end of file
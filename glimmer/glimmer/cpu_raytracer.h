@@ -1,39 +1,81 @@
 #pragma once
 
-#include "core/system.h"
 #include "traceboi.h"
+#include "scene_snapshot.h"
+#include "ray_queue.h"
+#include "trace_budget.h"
+#include "tone_map.h"
+#include "denoiser.h"
+#include "reprojection.h"
+#include "wire_format.h"
+#include "wire_connection.h"
+#include "render/camera.h"
 #include <memory>
 #include <atomic>
-
-namespace Render
-{
-	class Texture;
-	class TextureSource;
-	class Camera;
-}
-
-namespace DebugGui
-{
-	class DebugGuiSystem;
-}
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 namespace SDE
 {
 	class JobSystem;
-	class ScriptSystem;
 }
 
-// Owns an opengl texture + handles rendering a scene on multiple cores
+// Handles rendering a scene on multiple cores, output is RGBA8 pixels with the first row at the top
+// Traces write linear float colour, which is tone mapped into the RGBA8 output as tiles / traces complete
 class CpuRaytracer
 {
 public:
 	struct Parameters
 	{
-		int m_jobCount = 64;
+		int m_jobCount = 8;					// Number of worker jobs, each pulls tiles until none are left
+		int m_tileSize = 16;
 		int m_maxRecursion = 8;
+		bool m_primaryRayPackets = true;	// Use SIMD packets for primary rays
+		bool m_wavefront = false;			// Trace each tile iteratively in waves of packets instead of recursing per pixel
+		bool m_progressive = true;			// Accumulate jittered samples over multiple traces until something changes
+		int m_maxSamples = 256;				// Progressive traces stop once this many samples are accumulated
+		float m_lightCutoff = 0.0f;			// Skip lights contributing less than this at a hit, see TraceParamaters::lightCutoff
+		int m_lightSamples = 0;				// Lights shaded per hit, 0 = every light, see TraceParamaters::lightSamples
+		AdaptiveSampling m_adaptive;		// Extra primary rays where pixels need them, in full quality traces only. Off by default
+		// Scene edits update the last bvh instead of rebuilding it, once its cost passes this multiple of a fresh build
+		// a full rebuild runs as a background job and is swapped in when done. 0 = always rebuild immediately
+		float m_bvhRebuildThreshold = 1.5f;
+		// Interactive mode, enabled if m_interactiveTraceTime > 0
+		// While the camera or scene is changing, traces lower resolution + recursion to finish in about this long, and are upscaled to the output
+		// Full quality (+ progressive accumulation) resumes once nothing has changed for m_refineDelay seconds
+		double m_interactiveTraceTime = 0.0;
+		double m_refineDelay = 0.25;
+		// Interactive traces after a camera move warp the last full resolution image into the new view, and only trace tiles with gaps
+		// Falls back to a reduced resolution trace if there is no usable image or too much is missing, see Reprojection
+		bool m_reproject = true;
+		Reprojection::Parameters m_reprojection;
+		ToneMap::Parameters m_toneMap;
+		// Full resolution traces are filtered with m_denoiser before tone mapping, using the same jobs
+		bool m_denoise = false;
+		Denoiser::Parameters m_denoiser;
+		// Connections to TileWorkers (in other processes or on other machines), they pull tiles alongside the local jobs
+		// Only full resolution traces that are not interactive use them, the round trips would eat most of an interactive budget
+		// Workers that disconnect are dropped, any tiles they were tracing are traced locally instead
+		// Cancelled traces do not wait for them, they rejoin later traces once they have finished the cancelled one
+		std::vector<std::shared_ptr<IWireConnection>> m_tileWorkers;
+		double m_tileWorkerTimeout = 10.0;	// Workers silent for this long while tracing are disconnected, as if they had dropped
 		SDE::JobSystem* m_jobSystem = nullptr;
 		ImageParameters m_image;
 	};
+	// Per-worker timings + counters from the last completed trace, local jobs then any tile workers that joined it
+	struct WorkerStats
+	{
+		double m_busyTime = 0.0;		// Time spent tracing tiles
+		int m_tilesTraced = 0;
+		RayStats m_rayStats;			// Written directly by the worker, cache-line aligned
+	};
+	// Part of the output in pixels, first row at the top
+	struct TileRect
+	{
+		glm::ivec2 m_origin;
+		glm::ivec2 m_size;
+	};
 	enum Status : int
 	{
 		Ready = 0,
@@ -45,52 +87,147 @@ public:
 	CpuRaytracer(const Parameters& params);
 	~CpuRaytracer();
 
-	bool TryDrawScene(Scene& scene, Render::Camera& camera);	// Returns true if we can kick off a render
-	void Tick();						// Must be called every frame on render thread to handle job completion
-	Render::Texture* GetTexture();		// Can return null if no image drawn yet
+	// Returns true if we can kick off a render
+	// If the camera or scene changed since the trace in progress started, that trace is cancelled and replaced
+	bool TryDrawScene(const Scene& scene, Render::Camera& camera);
+	void InvalidateScene();				// Call when the scene changes, a new snapshot is taken on the next trace
+	void Cancel();						// Workers stop after their current tile, the output is never marked complete
+	void WaitForTrace();				// Blocks until the trace in progress (if any) completes or is cancelled
+	bool Tick();						// Must be called every frame to handle job completion, returns true when a new image is ready
+	inline const std::vector<uint32_t>& GetOutput() const	{ return m_rawOutput; }	// Complete when Tick returns true, see TakeFinishedTiles
+	// Appends the tiles written to GetOutput since the last call, they can be shown while the trace is still in progress
+	// Only full resolution traces report tiles, reduced ones are upscaled into the output all at once by Tick. Tiles not taken before the next trace starts are dropped
+	void TakeFinishedTiles(std::vector<TileRect>& tiles);
+	// Linear colour GetOutput is mapped from, the denoised copy if the last trace was denoised
+	inline const std::vector<glm::vec4>& GetHdrOutput() const	{ return m_lastTraceDenoised ? m_denoisedOutput : m_hdrOutput; }
+	// Returns true if GetOutput was re-mapped straight away, otherwise a trace is in progress and will use it when it completes
+	bool SetToneMap(const ToneMap::Parameters& toneMap);
+	inline const ToneMap::Parameters& GetToneMap() const	{ return m_parameters.m_toneMap; }
+	void SetDenoise(bool denoise);		// Restarts progressive accumulation so the change is traced
+	inline bool GetDenoise() const		{ return m_parameters.m_denoise; }
+	void SetAdaptiveSampling(const AdaptiveSampling& adaptive);	// Restarts progressive accumulation, like SetDenoise
+	inline const AdaptiveSampling& GetAdaptiveSampling() const	{ return m_parameters.m_adaptive; }
+	void SetLightSelection(float cutoff, int samples);	// Restarts progressive accumulation, see Parameters::m_lightCutoff and m_lightSamples
+	inline float GetLightCutoff() const	{ return m_parameters.m_lightCutoff; }
+	inline int GetLightSamples() const	{ return m_parameters.m_lightSamples; }
+	inline bool GetLastTraceDenoised() const	{ return m_lastTraceDenoised; }	// Denoised traces do not report tiles, see TakeFinishedTiles
+	inline bool GetLastTraceReprojected() const	{ return m_lastTraceReprojected; }	// Nor do reprojected ones
 
 	inline double GetLastDrawTime()		{ return m_lastTraceTime.load(); }
 	inline Status GetStatus()			{ return static_cast<Status>(m_traceStatus.load()); }
+	inline int GetSampleCount() const	{ return m_sampleCount; }
+	inline const TraceBudget::Quality& GetTraceQuality() const	{ return m_lastTraceQuality; }	// Of the last completed trace
+	inline const std::vector<WorkerStats>& GetWorkerStats() const	{ return m_lastWorkerStats; }
+	inline const RayStats& GetRayStats() const	{ return m_lastRayStats; }	// Sum of all workers for the last trace
+	double GetLoadBalance() const;		// Mean / max worker busy time for the last trace, 1 = perfect balance
+	inline float GetBvhDegradation() const	{ return m_sceneSnapshot != nullptr ? m_sceneSnapshot->GetBvh().Degradation() : 1.0f; }
 
 private:
-	void SubmitRenderJobs(Scene& s, Render::Camera& camera);
-	void CreateOrUpdateTexture(const std::vector<Render::TextureSource>& ts);
-	void UpdateTextureFromResult();
+	void BuildTileOrder(glm::ivec2 imageDims);
+	void SubmitRenderJobs(Render::Camera& camera, bool interactive);
+	void CancelStaleTrace();
+	void UpdateSceneSnapshot(const Scene& scene);
+	void TakeRebuiltSnapshot();
+	void StartBackgroundRebuild();
+	void WaitForRebuild();
+	void UpscaleReducedOutput();
+	bool TryReproject(const Render::Camera& camera);
+	inline bool ReprojectionEnabled() const		{ return m_parameters.m_reproject && m_parameters.m_interactiveTraceTime > 0.0; }	// Only interactive traces reproject
+	void OnJobFinished(double traceEndTime);
+	struct RemoteWorker;
+	void StartRemoteTrace(RemoteWorker& remote, const WireFormat::TraceSettings& settings);
+	void RemoteWorkerThread(RemoteWorker& remote);
+	void SendRemoteTiles(RemoteWorker& remote, uint32_t count);
+	bool OutputRemoteTile(RemoteWorker& remote, const WireFormat::TileResult& result);
+	void TraceLostTiles(RemoteWorker& remote);
+	void DetachRemoteWorkers();
+	void DisconnectSilentWorkers();
+	void PushDenoiseStage(int stage);
+	void OnDenoiseJobFinished(int stage);
+	void FinishTrace(double traceEndTime);
 
 	Parameters m_parameters;
-	std::unique_ptr<Render::Texture> m_texture;
 
-	std::vector<uint32_t> m_rawOutput;			// Raw output from trace
+	std::vector<uint32_t> m_rawOutput;			// Tone mapped from m_hdrOutput
+	std::vector<glm::vec4> m_hdrOutput;			// Written by the trace, the average of all samples since the last reset if progressive
+	std::vector<glm::vec4> m_reducedOutput;		// Interactive traces below full resolution, upscaled into m_hdrOutput when complete
+	TraceBudget m_budget;
+	TraceBudget::Quality m_traceQuality;		// Used by the trace in progress
+	TraceBudget::Quality m_lastTraceQuality;	// Used by the last completed trace
+	bool m_traceIsInteractive = false;
+	double m_lastChangeTime = 0.0;				// When the camera or scene last changed
+	int m_sampleCount = 0;						// Samples averaged in m_hdrOutput, 0 = reset on next trace
+	glm::mat4 m_sampleViewMatrix;				// Camera used for the accumulated samples
+	float m_sampleFov = 0.0f;
+	std::shared_ptr<const SceneSnapshot> m_sceneSnapshot;	// Shared with all jobs in a trace, only replaced when the scene changes
+	std::shared_ptr<const SceneSnapshot> m_previousSnapshot;	// Last snapshot before the scene changed, the next one updates its bvh
+	std::shared_ptr<const SceneSnapshot> m_rebuildSource;	// Snapshot the background rebuild started from
+	std::shared_ptr<const SceneSnapshot> m_rebuiltSnapshot;	// Set by the rebuild job while holding m_traceFinishedMutex
+	std::atomic<bool> m_rebuildInProgress;
+	std::vector<glm::ivec2> m_tileOrigins;		// In morton order so neighbouring tiles are traced close together in time
+	glm::ivec2 m_tileOrderDimensions;			// Image size m_tileOrigins was built for
+	std::atomic<int> m_nextTile;				// Workers take tiles from here until it passes the end of m_tileOrigins
+	std::vector<WorkerStats> m_workerStats;		// Written by each worker at the end of a trace
+	std::vector<WorkerStats> m_lastWorkerStats;	// Copied from m_workerStats when a trace completes
+	std::vector<WavefrontQueues> m_wavefrontQueues;	// One per worker, only used if m_wavefront is set
+	std::vector<AdaptiveScratch> m_adaptiveScratch;	// One per worker, only used by adaptive traces
+	RayStats m_lastRayStats;
+	std::mutex m_finishedTilesMutex;			// workers add to m_finishedTiles while holding this
+	std::vector<TileRect> m_finishedTiles;
+	FeatureBuffers m_features;					// Written by denoised traces
+	Denoiser m_denoiser;
+	std::vector<glm::vec4> m_denoisedOutput;	// Filtered from m_hdrOutput once a denoised trace completes
+	bool m_traceDenoised = false;				// The trace in progress will be denoised
+	bool m_lastTraceDenoised = false;
+	std::atomic<int> m_nextDenoiseRow;			// Denoise jobs take bands of rows from here, like m_nextTile
+	Reprojection m_reprojection;
+	std::vector<glm::ivec2> m_reprojectedTiles;	// Tiles a reprojected trace still has to trace, a subset of m_tileOrigins
+	Render::Camera m_traceCamera;				// Used by the trace in progress
+	Render::Camera m_historyCamera;				// m_hdrOutput + m_features are a complete trace from here if m_historyValid
+	std::weak_ptr<const SceneSnapshot> m_historySnapshot;	// Of the scene m_hdrOutput shows, reprojection only works if it has not changed
+	bool m_historyValid = false;
+	bool m_traceReprojected = false;
+	bool m_lastTraceReprojected = false;
+
+	// Coordinator side of a tile worker connection, its messages are handled on a thread of its own
+	struct RemoteWorker
+	{
+		std::shared_ptr<IWireConnection> m_connection;
+		std::thread m_thread;
+		std::atomic<bool> m_connected = { true };
+		std::atomic<bool> m_inTrace = { false };	// Counted in m_jobsInProgress until it echoes the end of the trace, disconnects or the trace is cancelled
+		std::atomic<bool> m_busy = { false };		// Tracing on its side until it echoes the end of the trace, even a cancelled one
+		std::atomic<double> m_lastMessageTime = { 0.0 };	// Sent or received, for m_tileWorkerTimeout
+		std::mutex m_traceMutex;					// Held while handling a message of the trace, so it can be detached between messages
+		uint32_t m_traceId = 0;						// Of the last trace sent
+		uint32_t m_sceneId = 0;						// Last scene sent, only used on the main thread
+		int m_statsIndex = 0;						// Into m_workerStats for the trace in progress
+		bool m_endSent = false;						// Everything below is protected by m_traceMutex once the trace is sent
+		std::vector<WireFormat::TileJob> m_tilesInFlight;	// Sent + not returned yet, traced locally if the connection drops
+		AdaptiveScratch m_adaptiveScratch;			// For tracing them
+	};
+	std::vector<std::unique_ptr<RemoteWorker>> m_remoteWorkers;
+	// Written before the trace is sent to any remote worker, then read only by their threads until it finishes
+	struct RemoteTrace
+	{
+		uint32_t m_traceId = 0;
+		std::unique_ptr<TraceParamaters> m_params;	// For blending results into the output + tracing lost tiles
+		std::shared_ptr<const SceneSnapshot> m_snapshot;	// Keeps the references in m_params valid
+		const std::vector<glm::ivec2>* m_tileOrigins = nullptr;
+		int m_tileCount = 0;
+		bool m_reportTiles = false;
+	};
+	RemoteTrace m_remoteTrace;
+	std::weak_ptr<const SceneSnapshot> m_remoteSnapshot;	// Snapshot m_remoteSceneMessage was written from
+	std::vector<uint8_t> m_remoteSceneMessage;	// Serialised once per snapshot + sent to each worker that needs it
+	uint32_t m_remoteSceneId = 0;
 
-	std::atomic<int> m_jobsInProgress;			// how many jobs in flight, the last one sets status to Complete
+	std::atomic<int> m_jobsInProgress;			// how many jobs in flight, the last one starts denoising or sets status to Complete
 	std::atomic<int> m_traceStatus;				// overal status
+	std::atomic<bool> m_cancelRequested;		// checked by workers before each tile, cleared when a trace starts
+	std::mutex m_traceFinishedMutex;			// the last job sets the status + notifies while holding this, as does the bvh rebuild job
+	std::condition_variable m_traceFinished;
 
 	std::atomic<double> m_traceStartTime;		// when did the current trace start
 	std::atomic<double> m_lastTraceTime;		// how long did the last trace take
-};
-
-class CpuRaytracerSystem : public Core::ISystem
-{
-public:
-	CpuRaytracerSystem() = default;
-	virtual ~CpuRaytracerSystem() = default;
-
-	virtual bool PreInit(Core::ISystemEnumerator& systemEnumerator);
-	virtual bool PostInit();
-	virtual bool Tick();
-	virtual void Shutdown();
-
-private:
-	void CreateScene();
-
-	void UpdateControls();
-	void UpdateSceneControls();
-
-	Scene m_scene;
-	Render::Camera m_camera;
-	std::unique_ptr<CpuRaytracer> m_cpuTracer;
-
-	bool m_isPaused = false;
-	DebugGui::DebugGuiSystem* m_debugGui = nullptr;
-	SDE::ScriptSystem* m_scriptSystem = nullptr;
 };
\ No newline at end of file
@@ -0,0 +1,291 @@
+#include "cpu_raytracer_system.h"
+#include "render/texture.h"
+#include "render/texture_source.h"
+#include "core/system_enumerator.h"
+#include "sde/script_system.h"
+#include "debug_gui/debug_gui_system.h"
+#include "scene_cache.h"
+
+const glm::ivec2 c_outputSize = { 512, 512 };
+const int c_adaptiveMaxSamples = 8;		// Primary rays per pixel when adaptive supersampling is enabled
+
+CpuRaytracerSystem::CpuRaytracerSystem()
+{
+}
+
+CpuRaytracerSystem::~CpuRaytracerSystem()
+{
+}
+
+void CpuRaytracerSystem::CreateScene()
+{
+	// Load the scene, the script only runs if it changed since the cache was written
+	std::string errorText;
+	bool fromCache = false;
+	if (!SceneCache::LoadScene(*m_scriptSystem, "scene.lua", "scene.lua.cache", m_scene, fromCache, errorText))
+	{
+		SDE_LOG("Error loading scene.lua - %s", errorText.data());
+	}
+
+	// Setup the camera
+	m_camera.SetFOVAndAspectRatio(51.52f, (float)c_outputSize.x / (float)c_outputSize.y);
+	m_camera.LookAt({ 0.0f, 50.0f, -200.0f }, { 0.0f, 50.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+}
+
+bool CpuRaytracerSystem::PreInit(Core::ISystemEnumerator& systemEnumerator)
+{
+	m_debugGui = (DebugGui::DebugGuiSystem*)systemEnumerator.GetSystem("DebugGui");
+	m_scriptSystem = (SDE::ScriptSystem*)systemEnumerator.GetSystem("Script");
+
+	// Set up cpu ray tracer
+	CpuRaytracer::Parameters params;
+	params.m_jobSystem = (SDE::JobSystem*)systemEnumerator.GetSystem("Jobs");
+	params.m_maxRecursion = 6;
+	params.m_interactiveTraceTime = 1.0 / 30.0;		// Stay responsive while dragging things around
+	params.m_image.m_dimensions = c_outputSize;
+	m_cpuTracer = std::make_unique<CpuRaytracer>(params);
+
+	return true;
+}
+
+bool CpuRaytracerSystem::PostInit()
+{
+	CreateScene();
+	return true;
+}
+
+bool CpuRaytracerSystem::UpdateSceneControls()
+{
+	bool sceneChanged = false;
+	static bool s_controlsOpen = true;
+	m_debugGui->BeginWindow(s_controlsOpen, "Controls", { 512,512 });
+
+	auto frand = [](float min, float max)
+	{
+		return min + (rand() / (float)RAND_MAX) * fabs(max - min);
+	};
+
+	for (int s = 0; s < m_scene.spheres.size(); ++s)
+	{
+		char label[256] = { '\0' };
+		sprintf_s(label, "Sphere %d", s);
+		sceneChanged |= m_debugGui->DragVector(label, m_scene.spheres[s].m_sphere.m_posAndRadius, 0.25f);
+		sprintf_s(label, "Sphere Material %d", s);
+		sceneChanged |= m_debugGui->DragFloat(label, m_scene.spheres[s].m_material.m_refractiveIndex, 0.01f, -1.0f, 10.0f);
+	}
+	if (m_debugGui->Button("Add Sphere"))
+	{
+		sceneChanged = true;
+		m_scene.spheres.push_back({
+			glm::vec4(frand(-50.0f,50.0f), frand(0.0f,50.0f), frand(0.0f,50.0f), frand(2.0, 20.0f)), {1.01f, Diffuse}
+			});
+	}
+	m_debugGui->Separator();
+	for (int l = 0; l < m_scene.lights.size(); ++l)
+	{
+		char label[256] = { '\0' };
+		sprintf_s(label, "Light %d Position", l);
+		sceneChanged |= m_debugGui->DragVector(label, m_scene.lights[l].m_position, 0.25f);
+		sprintf_s(label, "Light %d Colour", l);
+		sceneChanged |= m_debugGui->DragVector(label, m_scene.lights[l].m_diffuse, 0.05f, 0.0f, 1.0f);
+		sprintf_s(label, "Light %d Range", l);
+		sceneChanged |= m_debugGui->DragFloat(label, m_scene.lights[l].m_range, 1.0f, 0.0f, 10000.0f);
+	}
+	for (int i = 0; i < m_scene.meshInstances.size(); ++i)
+	{
+		// Moving an instance only changes the top level of the bvh
+		char label[256] = { '\0' };
+		sprintf_s(label, "Instance %d Position", i);
+		glm::vec3 position(m_scene.meshInstances[i].m_transform[3]);
+		if (m_debugGui->DragVector(label, position, 0.25f))
+		{
+			m_scene.meshInstances[i].m_transform[3] = glm::vec4(position, 1.0f);
+			sceneChanged = true;
+		}
+	}
+	for (int v = 0; v < m_scene.voxelVolumes.size(); ++v)
+	{
+		char label[256] = { '\0' };
+		sprintf_s(label, "Voxel Volume %d Position", v);
+		sceneChanged |= m_debugGui->DragVector(label, m_scene.voxelVolumes[v].m_position, 0.25f);
+	}
+	m_debugGui->Separator();
+	glm::vec4 c = glm::vec4(m_scene.skyColour, 1.0f);
+	sceneChanged |= m_debugGui->ColourEdit("Sky Colour", c);
+	m_scene.skyColour = { c.x, c.y, c.z };
+	if (m_debugGui->Button("Add Light"))
+	{
+		sceneChanged = true;
+		m_scene.lights.push_back({
+			{frand(-250.0f,250.0f),frand(50.0f,500.0f), frand(-250.0f,250.0f)},
+			{frand(0.0f,0.5f), frand(0.0f,0.5f), frand(0.0f,0.5f)}
+			});
+	}
+	m_debugGui->Separator();
+	glm::vec3 cameraPos = m_camera.Position();
+	m_debugGui->DragVector("Camera Position", cameraPos, 0.1f);
+	m_camera.SetPosition(cameraPos);
+	glm::vec3 cameraT = m_camera.Target();
+	m_debugGui->DragVector("Camera Target", cameraT, 0.1f);
+	m_camera.SetTarget(cameraT);
+
+	m_debugGui->EndWindow();
+	return sceneChanged;
+}
+
+void CpuRaytracerSystem::UpdateControls()
+{
+	static bool s_controlsOpen = true;
+	m_debugGui->BeginWindow(s_controlsOpen, "Controls", { 512,512 });
+
+	char text[256] = { '\0' };
+	sprintf_s(text, "Raytrace time: %fs", m_cpuTracer->GetLastDrawTime());
+	m_debugGui->Text(text);
+
+	const char* statusAsText[] = {
+		"Ready",
+		"In Progress",
+		"Complete",
+		"Paused",
+		"_unknown"
+	};
+	sprintf_s(text, "Status: %s\n", statusAsText[m_cpuTracer->GetStatus()]);
+	m_debugGui->Text(text);
+
+	sprintf_s(text, "Samples: %d", m_cpuTracer->GetSampleCount());
+	m_debugGui->Text(text);
+
+	const TraceBudget::Quality& quality = m_cpuTracer->GetTraceQuality();
+	sprintf_s(text, "Quality: 1/%d resolution, %d bounces%s", quality.m_resolutionDivisor, quality.m_maxRecursion, m_cpuTracer->GetLastTraceReprojected() ? ", reprojected" : "");
+	m_debugGui->Text(text);
+
+	const RayStats& rayStats = m_cpuTracer->GetRayStats();
+	const double traceTime = m_cpuTracer->GetLastDrawTime();
+	const double raysPerSecond = traceTime > 0.0 ? rayStats.TotalRays() / traceTime : 0.0;
+	sprintf_s(text, "Rays/s: %.2fM (%llu primary, %llu secondary, %llu shadow, %llu missed)", raysPerSecond / 1000000.0,
+		rayStats.m_primaryRays, rayStats.m_secondaryRays, rayStats.m_shadowRays, rayStats.m_missedRays);
+	m_debugGui->Text(text);
+	sprintf_s(text, "Tests: %llu box, %llu sphere, %llu plane, %llu triangle, %llu voxel", rayStats.m_boxTests, rayStats.m_sphereTests, rayStats.m_planeTests, rayStats.m_triangleTests, rayStats.m_voxelTests);
+	m_debugGui->Text(text);
+
+	sprintf_s(text, "Load balance: %.1f%%", m_cpuTracer->GetLoadBalance() * 100.0);
+	m_debugGui->Text(text);
+	sprintf_s(text, "Bvh cost: %.2fx fresh build", m_cpuTracer->GetBvhDegradation());
+	m_debugGui->Text(text);
+	const auto& workerStats = m_cpuTracer->GetWorkerStats();
+	for (int w = 0; w < workerStats.size(); ++w)
+	{
+		sprintf_s(text, "Worker %d: %fs busy, %d tiles", w, workerStats[w].m_busyTime, workerStats[w].m_tilesTraced);
+		m_debugGui->Text(text);
+	}
+
+	// Tone mapping only touches the last output, no need to trace again
+	ToneMap::Parameters toneMap = m_cpuTracer->GetToneMap();
+	bool toneMapChanged = m_debugGui->DragFloat("Exposure", toneMap.m_exposure, 0.01f, 0.0f, 16.0f);
+	toneMapChanged |= m_debugGui->Checkbox("Reinhard", &toneMap.m_reinhard);
+	toneMapChanged |= m_debugGui->Checkbox("Gamma correct", &toneMap.m_gammaCorrect);
+	if (toneMapChanged && m_cpuTracer->SetToneMap(toneMap))
+	{
+		m_outputRemapped = true;
+	}
+
+	bool denoise = m_cpuTracer->GetDenoise();
+	if (m_debugGui->Checkbox("Denoise", &denoise))
+	{
+		m_cpuTracer->SetDenoise(denoise);
+	}
+
+	AdaptiveSampling adaptive = m_cpuTracer->GetAdaptiveSampling();
+	bool adaptiveEnabled = adaptive.m_maxSamples > 1;
+	if (m_debugGui->Checkbox("Adaptive supersampling", &adaptiveEnabled))
+	{
+		adaptive.m_maxSamples = adaptiveEnabled ? c_adaptiveMaxSamples : 1;
+	}
+	if (adaptiveEnabled)
+	{
+		m_debugGui->DragFloat("Adaptive contrast", adaptive.m_contrastThreshold, 0.005f, 0.0f, 1.0f);
+		m_debugGui->DragFloat("Adaptive budget", adaptive.m_budget, 0.05f, 0.0f, 16.0f);
+		m_debugGui->Checkbox("Probe tile borders", &adaptive.m_probeTileBorders);
+	}
+	m_cpuTracer->SetAdaptiveSampling(adaptive);
+
+	float lightCutoff = m_cpuTracer->GetLightCutoff();
+	int lightSamples = m_cpuTracer->GetLightSamples();
+	m_debugGui->DragFloat("Light cutoff", lightCutoff, 0.001f, 0.0f, 1.0f);
+	m_debugGui->DragInt("Light samples (0 = all)", lightSamples, 1, 0, 8);
+	m_cpuTracer->SetLightSelection(lightCutoff, lightSamples);
+
+	m_debugGui->Checkbox("Paused", &m_isPaused);
+	m_debugGui->EndWindow();
+}
+
+bool CpuRaytracerSystem::Tick()
+{
+	UpdateControls();
+	if (UpdateSceneControls())
+	{
+		m_cpuTracer->InvalidateScene();
+	}
+
+	if (!m_isPaused)
+	{
+		m_cpuTracer->TryDrawScene(m_scene, m_camera);
+	}
+	UpdateTextureFromResult(m_cpuTracer->Tick());
+
+	// Use imgui as a free blitter!
+	if (m_texture != nullptr)
+	{
+		bool stayOpen = true;
+		m_debugGui->BeginWindow(stayOpen, "Cpu Output", glm::vec2(c_outputSize + glm::ivec2(16,32)));
+		m_debugGui->Image(*m_texture, glm::vec2(c_outputSize));
+		m_debugGui->EndWindow();
+	}
+
+	return true;
+}
+
+void CpuRaytracerSystem::Shutdown()
+{
+	m_cpuTracer = nullptr;
+	m_texture = nullptr;
+}
+
+// Tiles are uploaded as they finish, so the image fills in while a trace runs and each frame only uploads new pixels
+// Reduced resolution, denoised and reprojected traces change the whole output when they complete, so that gets uploaded in one go,
+// as do tone mapping changes
+void CpuRaytracerSystem::UpdateTextureFromResult(bool traceComplete)
+{
+	const std::vector<uint32_t>& output = m_cpuTracer->GetOutput();
+	if (m_texture == nullptr)
+	{
+		glm::uvec2 imageDims(c_outputSize);
+		std::vector<Render::TextureSource::MipDesc> mips;
+		mips.push_back({ imageDims.x, imageDims.y, 0, sizeof(uint32_t) * imageDims.x * imageDims.y });
+		Render::TextureSource textureDescriptor(imageDims.x, imageDims.y, Render::TextureSource::Format::RGBA8, mips, output);
+		std::vector<Render::TextureSource> textureSources;
+		textureSources.push_back(textureDescriptor);
+
+		m_texture = std::make_unique<Render::Texture>();
+		if (!m_texture->Create(textureSources))
+		{
+			m_texture = nullptr;
+			return;
+		}
+	}
+
+	m_finishedTiles.clear();
+	m_cpuTracer->TakeFinishedTiles(m_finishedTiles);
+	const bool wholeTraceChanged = m_cpuTracer->GetTraceQuality().m_resolutionDivisor > 1 || m_cpuTracer->GetLastTraceDenoised() || m_cpuTracer->GetLastTraceReprojected();
+	if (m_outputRemapped || (traceComplete && wholeTraceChanged))
+	{
+		m_texture->Update(0, 0, c_outputSize.x, c_outputSize.y, output.data(), c_outputSize.x);
+		m_outputRemapped = false;
+		return;
+	}
+	for (const auto& tile : m_finishedTiles)
+	{
+		const uint32_t* tilePixels = output.data() + tile.m_origin.y * c_outputSize.x + tile.m_origin.x;
+		m_texture->Update(tile.m_origin.x, tile.m_origin.y, tile.m_size.x, tile.m_size.y, tilePixels, c_outputSize.x);
+	}
+}
\ No newline at end of file
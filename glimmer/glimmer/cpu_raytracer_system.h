@@ -0,0 +1,52 @@
+#pragma once
+
+#include "core/system.h"
+#include "cpu_raytracer.h"
+#include "render/camera.h"
+#include <memory>
+
+namespace Render
+{
+	class Texture;
+}
+
+namespace DebugGui
+{
+	class DebugGuiSystem;
+}
+
+namespace SDE
+{
+	class ScriptSystem;
+}
+
+// Drives a CpuRaytracer from the debug gui and shows the result in an opengl texture
+class CpuRaytracerSystem : public Core::ISystem
+{
+public:
+	CpuRaytracerSystem();
+	virtual ~CpuRaytracerSystem();
+
+	virtual bool PreInit(Core::ISystemEnumerator& systemEnumerator);
+	virtual bool PostInit();
+	virtual bool Tick();
+	virtual void Shutdown();
+
+private:
+	void CreateScene();
+
+	void UpdateControls();
+	bool UpdateSceneControls();			// Returns true if the scene was modified
+	void UpdateTextureFromResult(bool traceComplete);	// Call every frame, traceComplete = CpuRaytracer::Tick result
+
+	Scene m_scene;
+	Render::Camera m_camera;
+	std::unique_ptr<CpuRaytracer> m_cpuTracer;
+	std::unique_ptr<Render::Texture> m_texture;
+	std::vector<CpuRaytracer::TileRect> m_finishedTiles;	// Reused each frame
+
+	bool m_isPaused = false;
+	bool m_outputRemapped = false;		// The whole output changed outside of a trace and needs uploading
+	DebugGui::DebugGuiSystem* m_debugGui = nullptr;
+	SDE::ScriptSystem* m_scriptSystem = nullptr;
+};
\ No newline at end of file
@@ -0,0 +1,191 @@
+#include "denoiser.h"
+#include "simd.h"
+#include "kernel/assert.h"
+#include <float.h>
+
+namespace
+{
+	const float c_kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };	// B3 spline
+	const float c_materialWeight = 100.0f;		// Different materials barely blur together
+	const float c_paddingMaterial = 10000.0f;	// Apron pixels are so far from everything their weight is effectively 0
+	const float c_minDepth = 0.001f;
+
+	// Stand-in for exp(-x) using the first terms of its series, close enough for edge weights and stays in SIMD
+	template<class FloatType>
+	inline FloatType EdgeWeight(const FloatType& x)
+	{
+		const FloatType one(1.0f);
+		return one / (one + x * (one + x * (FloatType(0.5f) + x * FloatType(1.0f / 6.0f))));
+	}
+
+	template<class FloatType>
+	inline FloatType Square(const FloatType& x)
+	{
+		return x * x;
+	}
+}
+
+void Denoiser::Begin(const Parameters& params, glm::ivec2 dimensions, const std::vector<glm::vec4>& colour, const FeatureBuffers& features, std::vector<glm::vec4>& output)
+{
+	SDE_ASSERT(colour.size() == dimensions.x * dimensions.y && output.size() == colour.size());
+	SDE_ASSERT(features.m_normalDepth.size() == colour.size() && features.m_material.size() == colour.size());
+	m_parameters = params;
+	m_parameters.m_passes = glm::clamp(params.m_passes, 1, c_maxPasses);
+	m_colour = &colour;
+	m_features = &features;
+	m_output = &output;
+	Resize(dimensions);
+}
+
+void Denoiser::Resize(glm::ivec2 dimensions)
+{
+	if (dimensions == m_dimensions)
+	{
+		return;
+	}
+	m_dimensions = dimensions;
+	m_rowStride = c_apron + ((dimensions.x + 7) & ~7) + c_apron;	// room for the last Float8 of a row
+	const size_t planeSize = m_rowStride * dimensions.y;
+	for (auto& plane : m_planes)
+	{
+		plane.assign(planeSize, 0.0f);
+	}
+	// Only real pixels are ever written, so everything else keeps the padding material
+	m_planes[MaterialId].assign(planeSize, c_paddingMaterial);
+}
+
+void Denoiser::GatherRows(int firstRow, int rowCount)
+{
+	for (int y = firstRow; y < firstRow + rowCount; ++y)
+	{
+		for (int x = 0; x < m_dimensions.x; ++x)
+		{
+			const size_t src = (y * m_dimensions.x) + x;
+			const size_t dst = PlaneIndex(x, y);
+			const glm::vec4& colour = (*m_colour)[src];
+			const glm::vec4& normalDepth = m_features->m_normalDepth[src];
+			m_planes[ColourR][dst] = colour.r;
+			m_planes[ColourG][dst] = colour.g;
+			m_planes[ColourB][dst] = colour.b;
+			m_planes[NormalX][dst] = normalDepth.x;
+			m_planes[NormalY][dst] = normalDepth.y;
+			m_planes[NormalZ][dst] = normalDepth.z;
+			m_planes[Depth][dst] = normalDepth.w;
+			m_planes[MaterialId][dst] = m_features->m_material[src];
+		}
+	}
+}
+
+// Filters FloatType::Width pixels of a row at a time, every tap of the kernel is one unaligned load per plane
+template<class FloatType>
+void Denoiser::FilterRows(int pass, int firstRow, int rowCount)
+{
+	const int c_width = FloatType::Width;
+	const int step = 1 << pass;
+	const bool lastPass = pass == m_parameters.m_passes - 1;
+	const int srcPlane = (pass & 1) ? FilteredR : ColourR;
+	const int dstPlane = (pass & 1) ? ColourR : FilteredR;
+	const float colourSigma = m_parameters.m_colourSigma / step;
+	const FloatType invColourSigma2(1.0f / glm::max(colourSigma * colourSigma, FLT_MIN));
+	const FloatType invNormalSigma2(1.0f / glm::max(m_parameters.m_normalSigma * m_parameters.m_normalSigma, FLT_MIN));
+	const FloatType invDepthSigma2(1.0f / glm::max(m_parameters.m_depthSigma * m_parameters.m_depthSigma, FLT_MIN));
+	const FloatType materialWeight(c_materialWeight);
+	const float* colourIn[c_colourPlanes] = { m_planes[srcPlane].data(), m_planes[srcPlane + 1].data(), m_planes[srcPlane + 2].data() };
+	const float* normalX = m_planes[NormalX].data();
+	const float* normalY = m_planes[NormalY].data();
+	const float* normalZ = m_planes[NormalZ].data();
+	const float* depth = m_planes[Depth].data();
+	const float* material = m_planes[MaterialId].data();
+
+	alignas(32) float result[c_colourPlanes][c_width];
+	for (int y = firstRow; y < firstRow + rowCount; ++y)
+	{
+		for (int x = 0; x < m_dimensions.x; x += c_width)
+		{
+			const size_t p = PlaneIndex(x, y);
+			FloatType centreColour[c_colourPlanes];
+			for (int c = 0; c < c_colourPlanes; ++c)
+			{
+				centreColour[c] = FloatType::Load(colourIn[c] + p);
+			}
+			const FloatType centreNX = FloatType::Load(normalX + p);
+			const FloatType centreNY = FloatType::Load(normalY + p);
+			const FloatType centreNZ = FloatType::Load(normalZ + p);
+			const FloatType centreDepth = FloatType::Load(depth + p);
+			const FloatType centreMaterial = FloatType::Load(material + p);
+			const FloatType invCentreDepth = FloatType(1.0f) / FloatType::Max(centreDepth, FloatType(c_minDepth));
+
+			FloatType sum[c_colourPlanes] = { FloatType(0.0f), FloatType(0.0f), FloatType(0.0f) };
+			FloatType weightSum(0.0f);
+			for (int ky = 0; ky < 5; ++ky)
+			{
+				const int qy = y + (ky - 2) * step;
+				if (qy < 0 || qy >= m_dimensions.y)
+				{
+					continue;
+				}
+				for (int kx = 0; kx < 5; ++kx)
+				{
+					const size_t q = PlaneIndex(x + (kx - 2) * step, qy);
+					FloatType tapColour[c_colourPlanes];
+					FloatType distance(0.0f);
+					for (int c = 0; c < c_colourPlanes; ++c)
+					{
+						tapColour[c] = FloatType::Load(colourIn[c] + q);
+						distance = distance + Square(tapColour[c] - centreColour[c]) * invColourSigma2;
+					}
+					const FloatType normalDistance = Square(FloatType::Load(normalX + q) - centreNX) + Square(FloatType::Load(normalY + q) - centreNY) + Square(FloatType::Load(normalZ + q) - centreNZ);
+					distance = distance + normalDistance * invNormalSigma2;
+					distance = distance + Square((FloatType::Load(depth + q) - centreDepth) * invCentreDepth) * invDepthSigma2;
+					distance = distance + Square(FloatType::Load(material + q) - centreMaterial) * materialWeight;
+
+					const FloatType weight = FloatType(c_kernel[kx] * c_kernel[ky]) * EdgeWeight(distance);
+					for (int c = 0; c < c_colourPlanes; ++c)
+					{
+						sum[c] = sum[c] + tapColour[c] * weight;
+					}
+					weightSum = weightSum + weight;
+				}
+			}
+
+			// The centre tap always has weight, so weightSum > 0
+			const FloatType invWeightSum = FloatType(1.0f) / weightSum;
+			if (!lastPass)
+			{
+				for (int c = 0; c < c_colourPlanes; ++c)
+				{
+					(sum[c] * invWeightSum).Store(m_planes[dstPlane + c].data() + p);
+				}
+				continue;
+			}
+			for (int c = 0; c < c_colourPlanes; ++c)
+			{
+				(sum[c] * invWeightSum).Store(result[c]);
+			}
+			const int laneCount = glm::min(c_width, m_dimensions.x - x);
+			glm::vec4* out = m_output->data() + (y * m_dimensions.x) + x;
+			for (int lane = 0; lane < laneCount; ++lane)
+			{
+				out[lane] = glm::vec4(result[0][lane], result[1][lane], result[2][lane], 1.0f);
+			}
+		}
+	}
+}
+
+void Denoiser::RunStage(int stage, int firstRow, int rowCount)
+{
+	SDE_ASSERT(stage >= 0 && stage < StageCount());
+	SDE_ASSERT(firstRow >= 0 && firstRow + rowCount <= m_dimensions.y);
+	if (stage == 0)
+	{
+		GatherRows(firstRow, rowCount);
+	}
+	else if (Simd::HasAvx())
+	{
+		FilterRows<Simd::Float8>(stage - 1, firstRow, rowCount);
+	}
+	else
+	{
+		FilterRows<Simd::Float4>(stage - 1, firstRow, rowCount);
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "traceboi.h"
+#include "math/glm_headers.h"
+#include <vector>
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010), cleans up traces with only a few samples per pixel
+// Each pass blurs with a 5x5 B-spline kernel whose taps are 2^pass pixels apart, so a few passes cover a wide area cheaply
+// Taps are weighted down across differences in colour, normal, depth + material, so edges stay sharp
+// The work is split into stages that must run in order, but the rows within a stage can be run on any number of jobs
+class Denoiser
+{
+public:
+	struct Parameters
+	{
+		int m_passes = 4;					// 1 to c_maxPasses, the last pass reaches 2^(passes + 1) pixels away
+		float m_colourSigma = 0.5f;			// How different colours can be and still blur together, halves every pass
+		float m_normalSigma = 0.3f;
+		float m_depthSigma = 0.05f;			// Relative to the depth of the pixel being filtered
+	};
+	static const int c_maxPasses = 5;
+
+	// Sets up filtering colour into output, the buffers must all be dimensions in size and stay alive until the last stage is done
+	void Begin(const Parameters& params, glm::ivec2 dimensions, const std::vector<glm::vec4>& colour, const FeatureBuffers& features, std::vector<glm::vec4>& output);
+	inline int StageCount() const		{ return m_parameters.m_passes + 1; }
+	inline int RowCount() const			{ return m_dimensions.y; }
+	void RunStage(int stage, int firstRow, int rowCount);	// Stage 0 gathers the inputs, the rest are filter passes
+
+private:
+	// Everything is stored in planes so a row of pixels can be loaded straight into SIMD registers
+	// Colour is ping-ponged between passes, the features are read-only
+	enum Plane
+	{
+		ColourR,
+		ColourG,
+		ColourB,
+		FilteredR,
+		FilteredG,
+		FilteredB,
+		NormalX,
+		NormalY,
+		NormalZ,
+		Depth,
+		MaterialId,
+		PlaneCount
+	};
+	static const int c_colourPlanes = 3;
+	static const int c_apron = 2 << (c_maxPasses - 1);	// Rows are padded by the widest tap on each side
+
+	void Resize(glm::ivec2 dimensions);
+	void GatherRows(int firstRow, int rowCount);
+	template<class FloatType>
+	void FilterRows(int pass, int firstRow, int rowCount);
+	inline size_t PlaneIndex(int x, int y) const	{ return (y * m_rowStride) + c_apron + x; }
+
+	Parameters m_parameters;
+	glm::ivec2 m_dimensions = glm::ivec2(0);
+	int m_rowStride = 0;
+	std::vector<float> m_planes[PlaneCount];
+	const std::vector<glm::vec4>* m_colour = nullptr;
+	const FeatureBuffers* m_features = nullptr;
+	std::vector<glm::vec4>* m_output = nullptr;
+};
@@ -3,51 +3,61 @@
 
 namespace Geometry
 {
-	// https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
-	bool RayTriangleIntersect(const Ray& ray, const Triangle& tri, float& t, glm::vec3& normal)
+	namespace
 	{
-		const float EPSILON = 0.0000001f;
-		auto vertex0 = tri.m_v0;
-		auto vertex1 = tri.m_v1;
-		auto vertex2 = tri.m_v2;
-		glm::vec3 edge1, edge2, h, s, q;
-		float a, f, u, v;
-		edge1 = vertex1 - vertex0;
-		edge2 = vertex2 - vertex0;
-		h = glm::cross(ray.m_direction,edge2);
-		a = glm::dot(edge1,h);
-		if (a > -EPSILON && a < EPSILON)
-		{
-			return false;    // This ray is parallel to this triangle.
-		}
-		f = 1.0f / a;
-		s = ray.m_origin - vertex0;
-		u = f * glm::dot(s,h);
-		if (u < 0.0f || u > 1.0f)
-		{
-			return false;
-		}
-		q = glm::cross(s,edge1);
-		v = f * glm::dot(ray.m_direction,q);
-		if (v < 0.0f || u + v > 1.0f)
+		// Watertight ray/triangle test using Plucker coordinates (as in Embree)
+		// Both triangles sharing an edge compute exactly the same edge function with the sign flipped,
+		// so rays cannot slip through the gap between them. Both sides of the triangle are hit
+		// normal can be any length, only its direction is used
+		inline bool PluckerIntersect(const Ray& ray, const glm::vec3& vertex0, const glm::vec3& vertex1, const glm::vec3& vertex2, const glm::vec3& normal, float& t)
 		{
-			return false;
-		}
-		// At this stage we can compute t to find out where the intersection point is on the line.
-		float tFinal = f * glm::dot(edge2,q);
-		if (tFinal > EPSILON) // ray intersection
-		{
-			t = tFinal + 0.001f;
-			normal = glm::normalize(glm::cross(edge1,edge2));
+			const glm::vec3 v0 = vertex0 - ray.m_origin;
+			const glm::vec3 v1 = vertex1 - ray.m_origin;
+			const glm::vec3 v2 = vertex2 - ray.m_origin;
+			const float u = glm::dot(glm::cross(v2 - v0, v2 + v0), ray.m_direction);
+			const float v = glm::dot(glm::cross(v0 - v1, v0 + v1), ray.m_direction);
+			const float w = glm::dot(glm::cross(v1 - v2, v1 + v2), ray.m_direction);
+			if (glm::min(u, glm::min(v, w)) < 0.0f && glm::max(u, glm::max(v, w)) > 0.0f)
+			{
+				return false;	// the ray passes outside at least one edge
+			}
+			const float denom = glm::dot(normal, ray.m_direction);
+			const float hitT = glm::dot(v0, normal) / denom;
+			if (denom == 0.0f || !(hitT >= c_triangleMinT))		// parallel, degenerate or behind the origin
+			{
+				return false;
+			}
+			t = hitT;
 			return true;
 		}
-		else // This means that there is a line intersection but not a ray intersection.
+	}
+
+	PrecomputedTriangle PrecomputeTriangle(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2)
+	{
+		return { v0, v1, v2, glm::normalize(glm::cross(v1 - v0, v2 - v0)) };
+	}
+
+	bool RayTriangleIntersect(const Ray& ray, const PrecomputedTriangle& tri, float& t)
+	{
+		return PluckerIntersect(ray, tri.m_v0, tri.m_v1, tri.m_v2, tri.m_normal, t);
+	}
+
+	bool RayTriangleIntersect(const Ray& ray, const Triangle& tri, float& t)
+	{
+		return PluckerIntersect(ray, tri.m_v0, tri.m_v1, tri.m_v2, glm::cross(tri.m_v1 - tri.m_v0, tri.m_v2 - tri.m_v0), t);
+	}
+
+	bool RayTriangleIntersect(const Ray& ray, const Triangle& tri, float& t, glm::vec3& normal)
+	{
+		if (RayTriangleIntersect(ray, tri, t))
 		{
-			return false;
+			normal = glm::normalize(glm::cross(tri.m_v1 - tri.m_v0, tri.m_v2 - tri.m_v0));
+			return true;
 		}
+		return false;
 	}
 
-	bool RayPlaneIntersect(const Ray& ray, const Plane& plane, float& tOut, glm::vec3& normal)
+	bool RayPlaneIntersect(const Ray& ray, const Plane& plane, float& tOut)
 	{
 		float denom = glm::dot(plane.m_normal, ray.m_direction);
 
@@ -58,7 +68,6 @@ namespace Geometry
 			if (t >= 0.001f && t < 10000.0f)
 			{
 				tOut = t;
-				normal = plane.m_normal;
 				return true;
 			}
 		}
@@ -66,7 +75,17 @@ namespace Geometry
 		return false;
 	}
 
-	bool RaySphereIntersect(const Ray& ray, const Sphere& sphere, float &t, glm::vec3& normal)
+	bool RayPlaneIntersect(const Ray& ray, const Plane& plane, float& tOut, glm::vec3& normal)
+	{
+		if (RayPlaneIntersect(ray, plane, tOut))
+		{
+			normal = plane.m_normal;
+			return true;
+		}
+		return false;
+	}
+
+	bool RaySphereIntersect(const Ray& ray, const Sphere& sphere, float &t)
 	{
 		float radius2 = sphere.m_posAndRadius.w * sphere.m_posAndRadius.w;
 		glm::vec3 l = glm::vec3(sphere.m_posAndRadius) - ray.m_origin;
@@ -96,10 +115,18 @@ namespace Geometry
 			}
 		}
 		t = t0;
-		auto spherePos = glm::vec3(sphere.m_posAndRadius);
-		auto hitPos = ray.m_origin + ray.m_direction * t;
-		auto hitLength = glm::length(hitPos - spherePos);
-		normal = glm::normalize(hitPos - spherePos);
 		return true;
 	}
-}
\ No newline at end of file
+
+	bool RaySphereIntersect(const Ray& ray, const Sphere& sphere, float &t, glm::vec3& normal)
+	{
+		if (RaySphereIntersect(ray, sphere, t))
+		{
+			auto spherePos = glm::vec3(sphere.m_posAndRadius);
+			auto hitPos = ray.m_origin + ray.m_direction * t;
+			normal = glm::normalize(hitPos - spherePos);
+			return true;
+		}
+		return false;
+	}
+}
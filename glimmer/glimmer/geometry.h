@@ -27,7 +27,28 @@ namespace Geometry
 		glm::vec3 m_v2;
 	};
 
+	// Triangle with its unit normal worked out up front, for meshes that are traced many times
+	// The vertices are kept rather than edges, the watertight test needs them relative to the ray origin
+	struct PrecomputedTriangle
+	{
+		glm::vec3 m_v0;
+		glm::vec3 m_v1;
+		glm::vec3 m_v2;
+		glm::vec3 m_normal;		// normalize(cross(v1 - v0, v2 - v0))
+	};
+
+	PrecomputedTriangle PrecomputeTriangle(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2);
+
+	// Triangle hits closer than this are ignored, so rays leaving a surface do not hit it again
+	const float c_triangleMinT = 0.001f;
+
 	bool RayPlaneIntersect(const Ray& ray, const Plane& plane, float& t, glm::vec3& normal);
 	bool RaySphereIntersect(const Ray& ray, const Sphere& sphere, float &t, glm::vec3& normal);
 	bool RayTriangleIntersect(const Ray& ray, const Triangle& tri, float& t, glm::vec3& normal);
+
+	// Distance only, for occlusion tests that do not care about the surface
+	bool RayPlaneIntersect(const Ray& ray, const Plane& plane, float& t);
+	bool RaySphereIntersect(const Ray& ray, const Sphere& sphere, float& t);
+	bool RayTriangleIntersect(const Ray& ray, const Triangle& tri, float& t);
+	bool RayTriangleIntersect(const Ray& ray, const PrecomputedTriangle& tri, float& t);
 }
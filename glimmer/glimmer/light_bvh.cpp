@@ -0,0 +1,80 @@
+#include "light_bvh.h"
+#include <algorithm>
+#include <float.h>
+
+namespace
+{
+	const uint32_t c_maxLeafLights = 4;
+	const uint32_t c_maxBuildDepth = 30;		// Traversal stack is 64 entries
+}
+
+void LightBvh::Build(const std::vector<Light>& lights)
+{
+	m_nodes.clear();
+	m_roots.clear();
+	m_lights = lights;
+	// Mixing the two would give every node with an infinite light an infinite range, so they get a tree each
+	const auto firstInfinite = std::stable_partition(m_lights.begin(), m_lights.end(), [](const Light& l)
+	{
+		return l.m_range > 0.0f;
+	});
+	const uint32_t rangedCount = static_cast<uint32_t>(firstInfinite - m_lights.begin());
+	const uint32_t infiniteCount = static_cast<uint32_t>(m_lights.end() - firstInfinite);
+
+	m_nodes.reserve(m_lights.size() * 2);
+	if (rangedCount > 0)
+	{
+		m_roots.push_back(static_cast<uint32_t>(m_nodes.size()));
+		m_nodes.push_back(Node());
+		BuildRecursive(m_roots.back(), 0, rangedCount, 0);
+	}
+	if (infiniteCount > 0)
+	{
+		m_roots.push_back(static_cast<uint32_t>(m_nodes.size()));
+		m_nodes.push_back(Node());
+		BuildRecursive(m_roots.back(), rangedCount, infiniteCount, 0);
+	}
+}
+
+// Lights are few compared to primitives, so a median split on the widest axis is good enough
+void LightBvh::BuildRecursive(uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth)
+{
+	Math::Box3 bounds(glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX));
+	float range = 0.0f, brightest = -FLT_MAX, power = 0.0f;
+	for (uint32_t l = first; l < first + count; ++l)
+	{
+		const Light& light = m_lights[l];
+		bounds.Min() = glm::min(bounds.Min(), light.m_position);
+		bounds.Max() = glm::max(bounds.Max(), light.m_position);
+		range = glm::max(range, light.m_range);
+		brightest = glm::max(brightest, Brightness(light));
+		power += glm::max(Brightness(light), 0.0f);
+	}
+	Node& node = m_nodes[nodeIndex];
+	node.m_bounds = bounds;
+	node.m_range = range;
+	node.m_brightest = brightest;
+	node.m_power = power;
+	node.m_firstChildOrLight = first;
+	node.m_lightCount = count;
+	if (count <= c_maxLeafLights || depth >= c_maxBuildDepth)
+	{
+		return;
+	}
+
+	const glm::vec3 extents = bounds.Size();
+	const int axis = extents.x > extents.y ? (extents.x > extents.z ? 0 : 2) : (extents.y > extents.z ? 1 : 2);
+	const uint32_t mid = first + count / 2;
+	std::nth_element(m_lights.begin() + first, m_lights.begin() + mid, m_lights.begin() + first + count, [axis](const Light& a, const Light& b)
+	{
+		return a.m_position[axis] < b.m_position[axis];
+	});
+
+	const uint32_t leftChild = static_cast<uint32_t>(m_nodes.size());
+	m_nodes.push_back(Node());
+	m_nodes.push_back(Node());
+	m_nodes[nodeIndex].m_firstChildOrLight = leftChild;
+	m_nodes[nodeIndex].m_lightCount = 0;
+	BuildRecursive(leftChild, first, mid - first, depth + 1);
+	BuildRecursive(leftChild + 1, mid, first + count - mid, depth + 1);
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "traceboi.h"
+#include "math/box3.h"
+#include "kernel/assert.h"
+#include <vector>
+#include <stdint.h>
+
+// Finds the lights that can reach a point, so shading cost depends on nearby and bright lights rather than every light in the scene
+// Ranged and infinite range lights are stored in separate trees over their positions, each node bounds the range and brightness of the lights below it
+// Once built it is read-only, and can be shared between any number of trace jobs
+class LightBvh
+{
+public:
+	LightBvh() = default;
+	~LightBvh() = default;
+
+	void Build(const std::vector<Light>& lights);	// Rebuilds everything from scratch
+
+	// Calls fn(const Light& light, float falloff) for every light where brightness * falloff at point is > 0 and >= minBrightness
+	// Brightness is the largest of the light's r,g,b, whole nodes are skipped when their bound is below minBrightness
+	template<class Fn>
+	void ForEachLight(const glm::vec3& point, float minBrightness, Fn&& fn) const;
+
+	// Picks one light that passes the same test, in proportion to a conservative bound on its brightness * falloff at point
+	// u is uniform in [0, 1), probability is set to the chance of picking the returned light. Returns nullptr if no light passes
+	inline const Light* SampleLight(const glm::vec3& point, float minBrightness, float u, float& probability) const;
+
+	// 1 for infinite range lights, smoothly fades to 0 at the light's range
+	static inline float Falloff(const Light& light, const glm::vec3& point);
+	static inline float Brightness(const Light& light)	{ return glm::max(light.m_diffuse.r, glm::max(light.m_diffuse.g, light.m_diffuse.b)); }
+
+	inline size_t NodeCount() const			{ return m_nodes.size(); }
+	inline size_t LightCount() const		{ return m_lights.size(); }
+
+private:
+	// Same layout as SceneBvh, count == 0 means interior node with 2 adjacent children
+	struct Node
+	{
+		Math::Box3 m_bounds;			// Of the light positions
+		float m_range = 0.0f;			// Longest range of any light below, 0 if they are infinite
+		float m_brightest = 0.0f;		// Largest Brightness of any light below, for the cutoff
+		float m_power = 0.0f;			// Sum of Brightness of every light below, for sampling
+		uint32_t m_firstChildOrLight = 0;
+		uint32_t m_lightCount = 0;
+	};
+
+	// Upper bound on Falloff at point for every light below node
+	static inline float FalloffBound(const Node& node, const glm::vec3& point);
+	void BuildRecursive(uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth);
+
+	std::vector<Node> m_nodes;
+	std::vector<uint32_t> m_roots;		// Ranged tree first, then infinite
+	std::vector<Light> m_lights;		// in leaf order
+};
+
+#include "light_bvh.inl"
@@ -0,0 +1,148 @@
+inline float LightBvh::Falloff(const Light& light, const glm::vec3& point)
+{
+	if (light.m_range <= 0.0f)
+	{
+		return 1.0f;
+	}
+	const glm::vec3 toLight = light.m_position - point;
+	const float distanceSq = glm::dot(toLight, toLight);
+	float window = glm::max(0.0f, 1.0f - distanceSq / (light.m_range * light.m_range));
+	return window * window;
+}
+
+// Falloff only decreases with distance, so the nearest point of the bounds and the longest range give the largest value
+inline float LightBvh::FalloffBound(const Node& node, const glm::vec3& point)
+{
+	if (node.m_range <= 0.0f)
+	{
+		return 1.0f;
+	}
+	const glm::vec3 toBounds = glm::max(glm::max(node.m_bounds.Min() - point, point - node.m_bounds.Max()), glm::vec3(0.0f));
+	const float distanceSq = glm::dot(toBounds, toBounds);
+	float window = glm::max(0.0f, 1.0f - distanceSq / (node.m_range * node.m_range));
+	return window * window;
+}
+
+template<class Fn>
+void LightBvh::ForEachLight(const glm::vec3& point, float minBrightness, Fn&& fn) const
+{
+	const uint32_t c_maxStack = 64;
+	uint32_t nodeStack[c_maxStack];
+	int stackSize = 0;
+	for (uint32_t root : m_roots)
+	{
+		nodeStack[stackSize++] = root;
+	}
+	while (stackSize > 0)
+	{
+		const Node& node = m_nodes[nodeStack[--stackSize]];
+		const float falloffBound = FalloffBound(node, point);
+		if (falloffBound <= 0.0f || node.m_brightest * falloffBound < minBrightness)
+		{
+			continue;
+		}
+		if (node.m_lightCount > 0)
+		{
+			const uint32_t lastLight = node.m_firstChildOrLight + node.m_lightCount;
+			for (uint32_t l = node.m_firstChildOrLight; l < lastLight; ++l)
+			{
+				const Light& light = m_lights[l];
+				const float falloff = Falloff(light, point);
+				if (falloff > 0.0f && Brightness(light) * falloff >= minBrightness)
+				{
+					fn(light, falloff);
+				}
+			}
+		}
+		else
+		{
+			SDE_ASSERT(stackSize + 2 <= c_maxStack);
+			nodeStack[stackSize++] = node.m_firstChildOrLight + 1;
+			nodeStack[stackSize++] = node.m_firstChildOrLight;
+		}
+	}
+}
+
+// Walks down one path picking a child in proportion to its power * falloff bound, then a light in the leaf in proportion to its own
+// u is rescaled after each choice so one random number is enough for the whole walk
+inline const Light* LightBvh::SampleLight(const glm::vec3& point, float minBrightness, float u, float& probability) const
+{
+	auto importance = [&](uint32_t nodeIndex)
+	{
+		const Node& node = m_nodes[nodeIndex];
+		const float falloffBound = FalloffBound(node, point);
+		return (falloffBound > 0.0f && node.m_brightest * falloffBound >= minBrightness) ? node.m_power * falloffBound : 0.0f;
+	};
+	auto pick = [&](float a, float b)
+	{
+		const float total = a + b;
+		if (total <= 0.0f)
+		{
+			return -1;
+		}
+		const float firstChance = a / total;
+		if (u < firstChance)
+		{
+			probability *= firstChance;
+			u = u / firstChance;
+			return 0;
+		}
+		probability *= 1.0f - firstChance;
+		u = glm::min((u - firstChance) / (1.0f - firstChance), 0.99999994f);		// Rounding must not give exactly 1
+		return 1;
+	};
+
+	probability = 1.0f;
+	if (m_roots.size() == 0)
+	{
+		return nullptr;
+	}
+	int child = pick(importance(m_roots[0]), m_roots.size() > 1 ? importance(m_roots[1]) : 0.0f);
+	if (child < 0)
+	{
+		return nullptr;
+	}
+	uint32_t nodeIndex = m_roots[child];
+	while (m_nodes[nodeIndex].m_lightCount == 0)
+	{
+		const uint32_t leftChild = m_nodes[nodeIndex].m_firstChildOrLight;
+		child = pick(importance(leftChild), importance(leftChild + 1));
+		if (child < 0)
+		{
+			return nullptr;		// Bounds are tighter further down, so both children can fail where the parent passed
+		}
+		nodeIndex = leftChild + child;
+	}
+
+	const Node& leaf = m_nodes[nodeIndex];
+	const uint32_t lastLight = leaf.m_firstChildOrLight + leaf.m_lightCount;
+	auto lightImportance = [&](const Light& light)
+	{
+		const float contribution = Brightness(light) * Falloff(light, point);
+		return (contribution > 0.0f && contribution >= minBrightness) ? contribution : 0.0f;
+	};
+	float total = 0.0f;
+	for (uint32_t l = leaf.m_firstChildOrLight; l < lastLight; ++l)
+	{
+		total += lightImportance(m_lights[l]);
+	}
+	if (total <= 0.0f)
+	{
+		return nullptr;
+	}
+	float target = u * total;
+	const Light* picked = nullptr;
+	float pickedImportance = 0.0f;
+	for (uint32_t l = leaf.m_firstChildOrLight; l < lastLight && target >= 0.0f; ++l)
+	{
+		const float weight = lightImportance(m_lights[l]);
+		if (weight > 0.0f)
+		{
+			picked = &m_lights[l];		// Keeps the last candidate if rounding runs target past the end
+			pickedImportance = weight;
+		}
+		target -= weight;
+	}
+	probability *= pickedImportance / total;
+	return picked;
+}
@@ -8,7 +8,7 @@
 #include "input/input_system.h"
 #include "core/system_registrar.h"
 #include "glimmer.h"
-#include "cpu_raytracer.h"
+#include "cpu_raytracer_system.h"
 
 class SystemRegistration : public Engine::IAppSystemRegistrar
 {
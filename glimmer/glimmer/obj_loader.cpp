@@ -0,0 +1,96 @@
+#include "obj_loader.h"
+#include "traceboi.h"
+#include "kernel/file_io.h"
+#include "kernel/log.h"
+#include <stdlib.h>
+
+namespace ObjLoader
+{
+	namespace
+	{
+		inline const char* SkipSpaces(const char* c)
+		{
+			while (*c == ' ' || *c == '\t')
+			{
+				++c;
+			}
+			return c;
+		}
+
+		inline const char* NextLine(const char* c)
+		{
+			while (*c != '\0' && *c != '\n')
+			{
+				++c;
+			}
+			return *c == '\n' ? c + 1 : c;
+		}
+	}
+
+	bool LoadMesh(const char* path, Mesh& mesh)
+	{
+		// Loaded as binary, large meshes are much quicker to read in one go than line by line
+		std::vector<uint8_t> objText;
+		if (!Kernel::FileIO::LoadBinaryFile(path, objText))
+		{
+			SDE_LOG("Failed to load %s", path);
+			return false;
+		}
+		objText.push_back('\0');
+		if (!ParseMesh(reinterpret_cast<const char*>(objText.data()), mesh))
+		{
+			SDE_LOG("Failed to parse %s", path);
+			return false;
+		}
+		return true;
+	}
+
+	bool ParseMesh(const char* objText, Mesh& mesh)
+	{
+		std::vector<glm::vec3> positions;
+		uint32_t faceVertices[64];
+		int lineNumber = 1;
+		for (const char* line = objText; *line != '\0'; line = NextLine(line), ++lineNumber)
+		{
+			const char* c = SkipSpaces(line);
+			if (c[0] == 'v' && (c[1] == ' ' || c[1] == '\t'))
+			{
+				char* end = nullptr;
+				glm::vec3 p;
+				p.x = strtof(c + 1, &end);
+				p.y = strtof(end, &end);
+				p.z = strtof(end, &end);
+				positions.push_back(p);
+			}
+			else if (c[0] == 'f' && (c[1] == ' ' || c[1] == '\t'))
+			{
+				// Each vertex is v, v/vt, v//vn or v/vt/vn, negative indices count back from the latest vertex
+				int vertexCount = 0;
+				c = SkipSpaces(c + 1);
+				while (*c != '\0' && *c != '\n' && *c != '\r' && *c != '#')
+				{
+					char* end = nullptr;
+					const long index = strtol(c, &end, 10);
+					const long resolved = index < 0 ? (long)positions.size() + index : index - 1;
+					if (end == c || resolved < 0 || resolved >= (long)positions.size() || vertexCount == 64)
+					{
+						SDE_LOG("Bad face on line %d", lineNumber);
+						return false;
+					}
+					faceVertices[vertexCount++] = static_cast<uint32_t>(resolved);
+					c = end;
+					while (*c != '\0' && *c != ' ' && *c != '\t' && *c != '\n' && *c != '\r')
+					{
+						++c;	// skip texture + normal indices
+					}
+					c = SkipSpaces(c);
+				}
+				for (int v = 2; v < vertexCount; ++v)
+				{
+					mesh.m_triangles.push_back(Geometry::PrecomputeTriangle(positions[faceVertices[0]], positions[faceVertices[v - 1]], positions[faceVertices[v]]));
+				}
+			}
+		}
+		return true;
+	}
+}
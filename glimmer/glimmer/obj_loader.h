@@ -0,0 +1,12 @@
+#pragma once
+
+struct Mesh;
+
+// Minimal Wavefront .obj reader, only vertex positions + faces are used (normals, uvs + materials are ignored)
+// Faces with more than 3 vertices are split into fans, and triangles are precomputed as they are read
+namespace ObjLoader
+{
+	// Appends the triangles to mesh, the material is left alone
+	bool LoadMesh(const char* path, Mesh& mesh);
+	bool ParseMesh(const char* objText, Mesh& mesh);		// objText must be null terminated
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "ray_packet.h"
+#include "simd.h"
+
+// Loops shared by the triangle + sphere blocks, which only differ in their intersection kernel
+// One ray is tested against FloatType::Width lanes of the block at a time
+namespace Geometry
+{
+	template<class FloatType, class BlockType>
+	using RayBlockIntersectFn = FloatType (*)(const Ray& ray, const BlockType& block, int firstLane, FloatType& t);
+
+	// Finds the closest lane that is nearer than closestT
+	template<class FloatType, class BlockType, RayBlockIntersectFn<FloatType, BlockType> Intersect>
+	inline bool RayBlockHit(const Ray& ray, const BlockType& block, float& closestT, int& hitLane)
+	{
+		bool hit = false;
+		for (int firstLane = 0; firstLane < block.m_count; firstLane += FloatType::Width)
+		{
+			FloatType t(closestT);
+			FloatType hitMask = Intersect(ray, block, firstLane, t);
+			hitMask = hitMask & (t < FloatType(closestT));
+			const int laneBits = hitMask.MoveMask();
+			if (laneBits == 0)
+			{
+				continue;
+			}
+			closestT = Simd::MaskedMin(hitMask, t);
+			alignas(32) float laneT[FloatType::Width];
+			t.Store(laneT);
+			for (int lane = 0; lane < FloatType::Width; ++lane)
+			{
+				if ((laneBits & (1 << lane)) && laneT[lane] == closestT)
+				{
+					hitLane = firstLane + lane;
+					break;
+				}
+			}
+			hit = true;
+		}
+		return hit;
+	}
+
+	// Returns true if any lane is nearer than maxT
+	template<class FloatType, class BlockType, RayBlockIntersectFn<FloatType, BlockType> Intersect>
+	inline bool RayBlockOccluded(const Ray& ray, const BlockType& block, float maxT)
+	{
+		for (int firstLane = 0; firstLane < block.m_count; firstLane += FloatType::Width)
+		{
+			FloatType t(maxT);
+			FloatType hitMask = Intersect(ray, block, firstLane, t);
+			if ((hitMask & (t < FloatType(maxT))).MoveMask() != 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+}
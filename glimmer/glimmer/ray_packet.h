@@ -0,0 +1,60 @@
+#pragma once
+#include "geometry.h"
+
+// Packets of coherent rays (e.g. neighbouring primary rays) stored as structure-of-arrays
+// so the same primitive can be tested against every lane at once
+// FloatType is one of the Simd:: float wrappers, which determines the packet width
+namespace Geometry
+{
+	template<class FloatType>
+	struct RayPacket
+	{
+		static const int Width = FloatType::Width;
+
+		// directions are SoA, one entry per lane
+		RayPacket(const glm::vec3& sharedOrigin, const float* dirX, const float* dirY, const float* dirZ);
+
+		// incoherent rays (e.g. secondary rays from a ray queue) with an origin per lane
+		RayPacket(const float* originX, const float* originY, const float* originZ, const float* dirX, const float* dirY, const float* dirZ);
+
+		// rays that are already loaded, e.g. after moving them into an instance's object space
+		RayPacket(const FloatType& originX, const FloatType& originY, const FloatType& originZ, const FloatType& dirX, const FloatType& dirY, const FloatType& dirZ);
+
+		FloatType m_originX, m_originY, m_originZ;
+		FloatType m_dirX, m_dirY, m_dirZ;
+		FloatType m_invDirX, m_invDirY, m_invDirZ;		// for slab tests
+	};
+
+	// A vec3 with one value per lane, for kernels where either the rays or the primitives are SoA
+	template<class FloatType>
+	struct PacketVec3
+	{
+		static inline PacketVec3 Broadcast(const glm::vec3& v)	{ return { FloatType(v.x), FloatType(v.y), FloatType(v.z) }; }
+		inline PacketVec3 operator+(const PacketVec3& o) const	{ return { m_x + o.m_x, m_y + o.m_y, m_z + o.m_z }; }
+		inline PacketVec3 operator-(const PacketVec3& o) const	{ return { m_x - o.m_x, m_y - o.m_y, m_z - o.m_z }; }
+
+		FloatType m_x, m_y, m_z;
+	};
+
+	// Each returns a lane mask of hits, with t written for those lanes only
+	// Results match the scalar versions in geometry.h
+	template<class FloatType>
+	FloatType RayPacketPlaneIntersect(const RayPacket<FloatType>& rays, const Plane& plane, FloatType& t);
+
+	template<class FloatType>
+	FloatType RayPacketSphereIntersect(const RayPacket<FloatType>& rays, const Sphere& sphere, FloatType& t);
+
+	template<class FloatType>
+	FloatType RayPacketTriangleIntersect(const RayPacket<FloatType>& rays, const PrecomputedTriangle& tri, FloatType& t);
+
+	// The watertight triangle test from geometry.cpp, shared by the packet + triangle block kernels
+	template<class FloatType>
+	FloatType PluckerIntersect(const PacketVec3<FloatType>& origin, const PacketVec3<FloatType>& direction,
+		const PacketVec3<FloatType>& vertex0, const PacketVec3<FloatType>& vertex1, const PacketVec3<FloatType>& vertex2, const PacketVec3<FloatType>& normal, FloatType& t);
+
+	// Slab test against an AABB, returns mask of lanes that enter the box before maxT
+	template<class FloatType>
+	FloatType RayPacketBoxIntersect(const RayPacket<FloatType>& rays, const glm::vec3& boxMin, const glm::vec3& boxMax, const FloatType& maxT, FloatType& tNear);
+}
+
+#include "ray_packet.inl"
@@ -0,0 +1,142 @@
+namespace Geometry
+{
+	template<class FloatType>
+	RayPacket<FloatType>::RayPacket(const glm::vec3& sharedOrigin, const float* dirX, const float* dirY, const float* dirZ)
+		: m_originX(sharedOrigin.x)
+		, m_originY(sharedOrigin.y)
+		, m_originZ(sharedOrigin.z)
+		, m_dirX(FloatType::Load(dirX))
+		, m_dirY(FloatType::Load(dirY))
+		, m_dirZ(FloatType::Load(dirZ))
+	{
+		const FloatType one(1.0f);
+		m_invDirX = one / m_dirX;
+		m_invDirY = one / m_dirY;
+		m_invDirZ = one / m_dirZ;
+	}
+
+	template<class FloatType>
+	RayPacket<FloatType>::RayPacket(const float* originX, const float* originY, const float* originZ, const float* dirX, const float* dirY, const float* dirZ)
+		: m_originX(FloatType::Load(originX))
+		, m_originY(FloatType::Load(originY))
+		, m_originZ(FloatType::Load(originZ))
+		, m_dirX(FloatType::Load(dirX))
+		, m_dirY(FloatType::Load(dirY))
+		, m_dirZ(FloatType::Load(dirZ))
+	{
+		const FloatType one(1.0f);
+		m_invDirX = one / m_dirX;
+		m_invDirY = one / m_dirY;
+		m_invDirZ = one / m_dirZ;
+	}
+
+	template<class FloatType>
+	RayPacket<FloatType>::RayPacket(const FloatType& originX, const FloatType& originY, const FloatType& originZ, const FloatType& dirX, const FloatType& dirY, const FloatType& dirZ)
+		: m_originX(originX)
+		, m_originY(originY)
+		, m_originZ(originZ)
+		, m_dirX(dirX)
+		, m_dirY(dirY)
+		, m_dirZ(dirZ)
+	{
+		const FloatType one(1.0f);
+		m_invDirX = one / m_dirX;
+		m_invDirY = one / m_dirY;
+		m_invDirZ = one / m_dirZ;
+	}
+
+	template<class FloatType>
+	FloatType RayPacketPlaneIntersect(const RayPacket<FloatType>& rays, const Plane& plane, FloatType& t)
+	{
+		const FloatType nx(plane.m_normal.x), ny(plane.m_normal.y), nz(plane.m_normal.z);
+		FloatType denom = nx * rays.m_dirX + ny * rays.m_dirY + nz * rays.m_dirZ;
+		FloatType toPlane = (FloatType(plane.m_point.x) - rays.m_originX) * nx +
+			(FloatType(plane.m_point.y) - rays.m_originY) * ny +
+			(FloatType(plane.m_point.z) - rays.m_originZ) * nz;
+		FloatType planeT = toPlane / denom;
+		FloatType mask = (FloatType::Abs(denom) > FloatType(0.0001f)) & (planeT >= FloatType(0.001f)) & (planeT < FloatType(10000.0f));
+		t = FloatType::Select(mask, planeT, t);
+		return mask;
+	}
+
+	template<class FloatType>
+	FloatType RayPacketSphereIntersect(const RayPacket<FloatType>& rays, const Sphere& sphere, FloatType& t)
+	{
+		const FloatType radius2(sphere.m_posAndRadius.w * sphere.m_posAndRadius.w);
+		FloatType lx = FloatType(sphere.m_posAndRadius.x) - rays.m_originX;
+		FloatType ly = FloatType(sphere.m_posAndRadius.y) - rays.m_originY;
+		FloatType lz = FloatType(sphere.m_posAndRadius.z) - rays.m_originZ;
+		FloatType tca = lx * rays.m_dirX + ly * rays.m_dirY + lz * rays.m_dirZ;
+		FloatType d2 = (lx * lx + ly * ly + lz * lz) - tca * tca;
+		FloatType mask = (tca >= FloatType(0.0f)) & (d2 <= radius2);
+		if (mask.MoveMask() == 0)
+		{
+			return mask;
+		}
+		FloatType thc = FloatType::Sqrt(radius2 - d2);
+		FloatType t0 = tca - thc;
+		FloatType t1 = tca + thc;
+		FloatType sphereT = FloatType::Select(t0 < FloatType(0.0f), t1, t0);	// origin inside the sphere
+		t = FloatType::Select(mask, sphereT, t);
+		return mask;
+	}
+
+	template<class FloatType>
+	inline FloatType Dot(const PacketVec3<FloatType>& a, const PacketVec3<FloatType>& b)
+	{
+		return a.m_x * b.m_x + a.m_y * b.m_y + a.m_z * b.m_z;
+	}
+
+	template<class FloatType>
+	inline PacketVec3<FloatType> Cross(const PacketVec3<FloatType>& a, const PacketVec3<FloatType>& b)
+	{
+		return { a.m_y * b.m_z - a.m_z * b.m_y, a.m_z * b.m_x - a.m_x * b.m_z, a.m_x * b.m_y - a.m_y * b.m_x };
+	}
+
+	template<class FloatType>
+	FloatType PluckerIntersect(const PacketVec3<FloatType>& origin, const PacketVec3<FloatType>& direction,
+		const PacketVec3<FloatType>& vertex0, const PacketVec3<FloatType>& vertex1, const PacketVec3<FloatType>& vertex2, const PacketVec3<FloatType>& normal, FloatType& t)
+	{
+		const PacketVec3<FloatType> v0 = vertex0 - origin;
+		const PacketVec3<FloatType> v1 = vertex1 - origin;
+		const PacketVec3<FloatType> v2 = vertex2 - origin;
+		const FloatType u = Dot(Cross(v2 - v0, v2 + v0), direction);
+		const FloatType v = Dot(Cross(v0 - v1, v0 + v1), direction);
+		const FloatType w = Dot(Cross(v1 - v2, v1 + v2), direction);
+		const FloatType zero(0.0f);
+		FloatType mask = (FloatType::Min(u, FloatType::Min(v, w)) >= zero) | (FloatType::Max(u, FloatType::Max(v, w)) <= zero);
+		if (mask.MoveMask() == 0)
+		{
+			return mask;
+		}
+		const FloatType denom = Dot(normal, direction);
+		const FloatType hitT = Dot(v0, normal) / denom;
+		mask = mask & (FloatType::Abs(denom) > zero) & (hitT >= FloatType(c_triangleMinT));
+		t = FloatType::Select(mask, hitT, t);
+		return mask;
+	}
+
+	template<class FloatType>
+	FloatType RayPacketTriangleIntersect(const RayPacket<FloatType>& rays, const PrecomputedTriangle& tri, FloatType& t)
+	{
+		typedef PacketVec3<FloatType> Vec3;
+		const Vec3 origin = { rays.m_originX, rays.m_originY, rays.m_originZ };
+		const Vec3 direction = { rays.m_dirX, rays.m_dirY, rays.m_dirZ };
+		return PluckerIntersect(origin, direction, Vec3::Broadcast(tri.m_v0), Vec3::Broadcast(tri.m_v1), Vec3::Broadcast(tri.m_v2), Vec3::Broadcast(tri.m_normal), t);
+	}
+
+	template<class FloatType>
+	FloatType RayPacketBoxIntersect(const RayPacket<FloatType>& rays, const glm::vec3& boxMin, const glm::vec3& boxMax, const FloatType& maxT, FloatType& tNear)
+	{
+		FloatType tx0 = (FloatType(boxMin.x) - rays.m_originX) * rays.m_invDirX;
+		FloatType tx1 = (FloatType(boxMax.x) - rays.m_originX) * rays.m_invDirX;
+		FloatType ty0 = (FloatType(boxMin.y) - rays.m_originY) * rays.m_invDirY;
+		FloatType ty1 = (FloatType(boxMax.y) - rays.m_originY) * rays.m_invDirY;
+		FloatType tz0 = (FloatType(boxMin.z) - rays.m_originZ) * rays.m_invDirZ;
+		FloatType tz1 = (FloatType(boxMax.z) - rays.m_originZ) * rays.m_invDirZ;
+		FloatType enter = FloatType::Max(FloatType::Max(FloatType::Min(tx0, tx1), FloatType::Min(ty0, ty1)), FloatType::Max(FloatType::Min(tz0, tz1), FloatType(0.0f)));
+		FloatType exit = FloatType::Min(FloatType::Min(FloatType::Max(tx0, tx1), FloatType::Max(ty0, ty1)), FloatType::Min(FloatType::Max(tz0, tz1), maxT));
+		tNear = enter;
+		return enter <= exit;
+	}
+}
@@ -0,0 +1,54 @@
+#include "ray_queue.h"
+
+void RayQueue::Clear()
+{
+	// clear() keeps the capacity, so queues stop allocating once they have grown to fit a tile
+	m_originX.clear();
+	m_originY.clear();
+	m_originZ.clear();
+	m_dirX.clear();
+	m_dirY.clear();
+	m_dirZ.clear();
+	m_maxT.clear();
+	m_pathNode.clear();
+	m_contribution.clear();
+	m_count = 0;
+}
+
+void RayQueue::Push(const glm::vec3& origin, const glm::vec3& direction, float maxT, uint32_t pathNode, const glm::vec3& contribution)
+{
+	m_originX.push_back(origin.x);
+	m_originY.push_back(origin.y);
+	m_originZ.push_back(origin.z);
+	m_dirX.push_back(direction.x);
+	m_dirY.push_back(direction.y);
+	m_dirZ.push_back(direction.z);
+	m_maxT.push_back(maxT);
+	m_pathNode.push_back(pathNode);
+	m_contribution.push_back(contribution);
+	++m_count;
+}
+
+void RayQueue::Pad(int width)
+{
+	if (m_count == 0)
+	{
+		return;
+	}
+	const size_t last = m_count - 1;
+	while (m_originX.size() % width != 0)
+	{
+		m_originX.push_back(m_originX[last]);
+		m_originY.push_back(m_originY[last]);
+		m_originZ.push_back(m_originZ[last]);
+		m_dirX.push_back(m_dirX[last]);
+		m_dirY.push_back(m_dirY[last]);
+		m_dirZ.push_back(m_dirZ[last]);
+		m_maxT.push_back(m_maxT[last]);
+		m_pathNode.push_back(m_pathNode[last]);
+		m_contribution.push_back(m_contribution[last]);
+	}
+	m_hitT.resize(m_originX.size());
+	m_hitPrimitive.resize(m_originX.size());
+	m_hitPlane.resize(m_originX.size());
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "math/glm_headers.h"
+#include <vector>
+#include <stdint.h>
+
+// Structure-of-arrays storage for a batch of rays, so whole packets can be loaded straight out of it
+// Used by the wavefront integrator, which intersects + shades a full queue at a time instead of recursing
+class RayQueue
+{
+public:
+	void Clear();
+	void Push(const glm::vec3& origin, const glm::vec3& direction, float maxT, uint32_t pathNode, const glm::vec3& contribution = glm::vec3(0.0f));
+
+	// Repeats the last ray until the storage is a multiple of width, so the last packet can be loaded safely
+	// Also sizes the hit arrays. Padded rays are not included in Count(), do not Push after padding
+	void Pad(int width);
+
+	inline size_t Count() const		{ return m_count; }
+	inline glm::vec3 Origin(size_t i) const		{ return { m_originX[i], m_originY[i], m_originZ[i] }; }
+	inline glm::vec3 Direction(size_t i) const	{ return { m_dirX[i], m_dirY[i], m_dirZ[i] }; }
+
+	std::vector<float> m_originX, m_originY, m_originZ;
+	std::vector<float> m_dirX, m_dirY, m_dirZ;
+	std::vector<float> m_maxT;					// Hits further away than this are ignored
+	std::vector<uint32_t> m_pathNode;			// The path node this ray belongs to (or contributes to, for shadow rays)
+	std::vector<glm::vec3> m_contribution;		// Shadow rays only, added to the path node if nothing is hit
+
+	// Written when the queue is intersected
+	std::vector<float> m_hitT;
+	std::vector<uint32_t> m_hitPrimitive;		// SceneBvh primitive or SceneBvh::c_noHit
+	std::vector<int32_t> m_hitPlane;			// Index into Scene::planes, or -1
+
+private:
+	size_t m_count = 0;
+};
+
+// One entry per ray traced in a pixel's path tree, parents always come before their children
+// The final colour is resolved once every wave is done, by walking the nodes backwards
+struct PathNode
+{
+	static const uint32_t c_noParent = ~0u;
+	uint32_t m_parent = c_noParent;		// Primary rays have no parent, they are stored first in pixel order
+	float m_weight = 1.0f;				// How much of this ray's colour goes to the parent
+	glm::vec3 m_colour = glm::vec3(0.0f);	// Direct light + weighted child colours, then the final colour after resolving
+	glm::vec3 m_specular = glm::vec3(0.0f);
+};
+
+// Scratch memory for wavefront tracing, give each worker its own
+// Storage is kept between traces so steady-state tracing does not allocate
+struct WavefrontQueues
+{
+	RayQueue m_rays[2];				// Current wave + the secondary rays it spawns
+	RayQueue m_shadowRays;
+	std::vector<PathNode> m_nodes;
+};
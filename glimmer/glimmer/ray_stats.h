@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+
+// Ray + intersection test counts for one worker
+// Padded to a cache line so workers writing their own counters never share one
+struct alignas(64) RayStats
+{
+	uint64_t m_primaryRays = 0;
+	uint64_t m_secondaryRays = 0;		// reflection + refraction
+	uint64_t m_shadowRays = 0;
+	uint64_t m_missedRays = 0;			// primary or secondary rays that hit nothing
+	uint64_t m_boxTests = 0;			// bvh nodes
+	uint64_t m_sphereTests = 0;
+	uint64_t m_planeTests = 0;
+	uint64_t m_triangleTests = 0;
+	uint64_t m_voxelTests = 0;			// voxels visited inside voxel volumes
+
+	inline uint64_t TotalRays() const
+	{
+		return m_primaryRays + m_secondaryRays + m_shadowRays;
+	}
+
+	inline RayStats& operator+=(const RayStats& other)
+	{
+		m_primaryRays += other.m_primaryRays;
+		m_secondaryRays += other.m_secondaryRays;
+		m_shadowRays += other.m_shadowRays;
+		m_missedRays += other.m_missedRays;
+		m_boxTests += other.m_boxTests;
+		m_sphereTests += other.m_sphereTests;
+		m_planeTests += other.m_planeTests;
+		m_triangleTests += other.m_triangleTests;
+		m_voxelTests += other.m_voxelTests;
+		return *this;
+	}
+};
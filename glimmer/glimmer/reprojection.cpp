@@ -0,0 +1,227 @@
+#include "reprojection.h"
+#include "render/camera.h"
+#include "kernel/assert.h"
+#include <float.h>
+#include <limits>
+#include <string.h>
+
+namespace
+{
+	const float c_noSplat = std::numeric_limits<float>::infinity();
+	const float c_skyDepth = FLT_MAX;		// Misses can be reprojected too, but anything with a hit is in front of them
+	const float c_minDepth = 0.0001f;
+
+	// Must match the primary rays generated by TraceBoi, so the reprojected pixels line up with traced ones
+	class View
+	{
+	public:
+		View(const Render::Camera& camera, glm::ivec2 dimensions)
+			: m_worldToCamera(camera.ViewMatrix())
+			, m_cameraToWorld(glm::inverse(camera.ViewMatrix()))
+			, m_dimensions(dimensions)
+		{
+			const float scale = tan(glm::radians(camera.FOV() * 0.5f));
+			const float aspectRatio = dimensions.x > dimensions.y ? (float)dimensions.x / dimensions.y : (float)dimensions.y / dimensions.x;
+			m_scale = glm::vec2(aspectRatio * scale, scale);
+			m_origin = glm::vec3(m_cameraToWorld * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+		}
+		inline const glm::vec3& Origin() const	{ return m_origin; }
+		glm::vec3 Direction(glm::vec2 pixelPos) const
+		{
+			const glm::vec2 ndc = glm::vec2(2.0f * pixelPos.x / m_dimensions.x - 1.0f, 1.0f - 2.0f * pixelPos.y / m_dimensions.y);
+			return glm::normalize(glm::mat3(m_cameraToWorld) * glm::vec3(ndc * m_scale, -1.0f));
+		}
+		// Returns false for points behind the camera
+		bool Project(const glm::vec3& cameraSpace, glm::vec2& pixelPos) const
+		{
+			if (cameraSpace.z > -c_minDepth)
+			{
+				return false;
+			}
+			const glm::vec2 ndc = glm::vec2(cameraSpace) / (-cameraSpace.z * m_scale);
+			pixelPos = glm::vec2((ndc.x + 1.0f) * 0.5f * m_dimensions.x, (1.0f - ndc.y) * 0.5f * m_dimensions.y);
+			return true;
+		}
+		inline glm::vec3 PointToCamera(const glm::vec3& p) const		{ return glm::vec3(m_worldToCamera * glm::vec4(p, 1.0f)); }
+		inline glm::vec3 DirectionToCamera(const glm::vec3& d) const	{ return glm::mat3(m_worldToCamera) * d; }
+
+	private:
+		glm::mat4 m_worldToCamera;
+		glm::mat4 m_cameraToWorld;
+		glm::vec2 m_dimensions;
+		glm::vec2 m_scale;
+		glm::vec3 m_origin;
+	};
+}
+
+// Ages start staggered per tile, so a few tiles expire on each reprojection instead of all of them at once
+void Reprojection::ClearAges(const Parameters& params, glm::ivec2 dimensions, int tileSize)
+{
+	m_age.resize(dimensions.x * dimensions.y);
+	const int maxAge = glm::max(params.m_maxAge, 1);
+	for (int y = 0; y < dimensions.y; ++y)
+	{
+		for (int x = 0; x < dimensions.x; ++x)
+		{
+			const glm::ivec2 tile = glm::ivec2(x, y) / tileSize;
+			m_age[(y * dimensions.x) + x] = static_cast<uint8_t>(((tile.x * 3) + (tile.y * 5)) % maxAge);
+		}
+	}
+}
+
+// Forward warp, each source pixel lands on the one target pixel containing its hit point
+void Reprojection::Splat(const Parameters& params, const Render::Camera& from, const Render::Camera& to, glm::ivec2 dimensions,
+	const std::vector<glm::vec4>& colour, const FeatureBuffers& features)
+{
+	const size_t pixelCount = dimensions.x * dimensions.y;
+	m_colour.resize(pixelCount);
+	m_features.m_normalDepth.resize(pixelCount);
+	m_features.m_material.resize(pixelCount);
+	m_warpedAge.resize(pixelCount);
+	m_splatDepth.assign(pixelCount, c_noSplat);
+
+	const View fromView(from, dimensions);
+	const View toView(to, dimensions);
+	for (int y = 0; y < dimensions.y; ++y)
+	{
+		for (int x = 0; x < dimensions.x; ++x)
+		{
+			const size_t src = (y * dimensions.x) + x;
+			const glm::vec4& normalDepth = features.m_normalDepth[src];
+			if (features.m_material[src] > 0.0f || m_age[src] >= params.m_maxAge)
+			{
+				continue;
+			}
+			const glm::vec3 direction = fromView.Direction(glm::vec2(x, y) + 0.5f);
+			const bool isSky = normalDepth.w <= 0.0f;
+			glm::vec3 cameraSpace;
+			float depth;
+			if (isSky)
+			{
+				cameraSpace = toView.DirectionToCamera(direction);
+				depth = c_skyDepth;
+			}
+			else
+			{
+				const glm::vec3 hitPos = fromView.Origin() + direction * normalDepth.w;
+				cameraSpace = toView.PointToCamera(hitPos);
+				depth = glm::length(hitPos - toView.Origin());
+			}
+			glm::vec2 pixelPos;
+			if (!toView.Project(cameraSpace, pixelPos) || pixelPos.x < 0.0f || pixelPos.y < 0.0f)
+			{
+				continue;
+			}
+			const glm::ivec2 target(pixelPos);
+			if (target.x >= dimensions.x || target.y >= dimensions.y)
+			{
+				continue;
+			}
+			const size_t dst = (target.y * dimensions.x) + target.x;
+			if (depth < m_splatDepth[dst])
+			{
+				m_splatDepth[dst] = depth;
+				m_colour[dst] = colour[src];
+				m_features.m_normalDepth[dst] = glm::vec4(glm::vec3(normalDepth), isSky ? 0.0f : depth);
+				m_features.m_material[dst] = features.m_material[src];
+				m_warpedAge[dst] = m_age[src] + 1;
+			}
+		}
+	}
+}
+
+// Surfaces seen closer or at more of an angle than before spread out, leaving single pixel cracks between their splats
+// They are filled in from the neighbours on either side, unless those are on different surfaces (a real disocclusion)
+void Reprojection::FillGaps(const Parameters& params, glm::ivec2 dimensions)
+{
+	auto canFill = [this, &params](size_t a, size_t b)
+	{
+		const float depthA = m_splatDepth[a], depthB = m_splatDepth[b];
+		return depthA != c_noSplat && depthB != c_noSplat && glm::abs(depthA - depthB) <= params.m_gapDepthTolerance * glm::min(depthA, depthB);
+	};
+	const int width = dimensions.x;
+	for (int y = 1; y < dimensions.y - 1; ++y)
+	{
+		for (int x = 1; x < width - 1; ++x)
+		{
+			const size_t p = (y * width) + x;
+			if (m_splatDepth[p] != c_noSplat)
+			{
+				continue;
+			}
+			size_t a = p - 1, b = p + 1;
+			if (!canFill(a, b))
+			{
+				a = p - width;
+				b = p + width;
+				if (!canFill(a, b))
+				{
+					continue;
+				}
+			}
+			m_splatDepth[p] = glm::min(m_splatDepth[a], m_splatDepth[b]);
+			m_colour[p] = (m_colour[a] + m_colour[b]) * 0.5f;
+			m_features.m_normalDepth[p] = (m_features.m_normalDepth[a] + m_features.m_normalDepth[b]) * 0.5f;
+			m_features.m_material[p] = 0.0f;
+			m_warpedAge[p] = glm::max(m_warpedAge[a], m_warpedAge[b]);
+		}
+	}
+}
+
+bool Reprojection::IsTileValid(glm::ivec2 origin, glm::ivec2 size, int imageWidth) const
+{
+	for (int y = origin.y; y < origin.y + size.y; ++y)
+	{
+		const float* row = m_splatDepth.data() + (y * imageWidth);
+		for (int x = origin.x; x < origin.x + size.x; ++x)
+		{
+			if (row[x] == c_noSplat)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool Reprojection::Reproject(const Parameters& params, const Render::Camera& from, const Render::Camera& to, glm::ivec2 dimensions, int tileSize,
+	const std::vector<glm::ivec2>& tileOrigins, std::vector<glm::vec4>& colour, FeatureBuffers& features, std::vector<glm::ivec2>& tilesToTrace)
+{
+	const size_t pixelCount = dimensions.x * dimensions.y;
+	SDE_ASSERT(colour.size() == pixelCount && features.m_normalDepth.size() == pixelCount && features.m_material.size() == pixelCount);
+	if (m_age.size() != pixelCount)
+	{
+		ClearAges(params, dimensions, tileSize);
+	}
+	Splat(params, from, to, dimensions, colour, features);
+	FillGaps(params, dimensions);
+
+	tilesToTrace.clear();
+	const size_t maxTilesToTrace = static_cast<size_t>(tileOrigins.size() * params.m_maxTraceFraction);
+	for (const auto& origin : tileOrigins)
+	{
+		if (!IsTileValid(origin, glm::min(glm::ivec2(tileSize), dimensions - origin), dimensions.x))
+		{
+			tilesToTrace.push_back(origin);
+			if (tilesToTrace.size() > maxTilesToTrace)
+			{
+				tilesToTrace.clear();
+				return false;
+			}
+		}
+	}
+
+	colour.swap(m_colour);
+	features.m_normalDepth.swap(m_features.m_normalDepth);
+	features.m_material.swap(m_features.m_material);
+	m_age.swap(m_warpedAge);
+	for (const auto& origin : tilesToTrace)
+	{
+		const glm::ivec2 size = glm::min(glm::ivec2(tileSize), dimensions - origin);
+		for (int y = origin.y; y < origin.y + size.y; ++y)
+		{
+			memset(m_age.data() + (y * dimensions.x) + origin.x, 0, size.x);
+		}
+	}
+	return true;
+}
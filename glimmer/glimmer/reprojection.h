@@ -0,0 +1,45 @@
+#pragma once
+#include "traceboi.h"
+#include "math/glm_headers.h"
+#include <vector>
+#include <stdint.h>
+
+namespace Render
+{
+	class Camera;
+}
+
+// Warps the last full resolution trace into a new camera view, so small camera moves only need the gaps tracing
+// Each pixel with a primary hit moves to where that hit lands in the new view, the nearest hit wins where they overlap
+// Pixels nothing lands on (disocclusions, new edges of the view), reflective surfaces whose colour depends on the view,
+// and pixels that have been reprojected too many times in a row are invalid, their tiles need tracing again
+class Reprojection
+{
+public:
+	struct Parameters
+	{
+		int m_maxAge = 8;					// Pixels are traced again after being reprojected this many times in a row
+		float m_maxTraceFraction = 0.5f;	// Give up if more than this fraction of the tiles would need tracing
+		float m_gapDepthTolerance = 0.05f;	// 1 pixel gaps between neighbours this close in (relative) depth are filled in
+	};
+
+	// Warps colour + features traced from camera 'from' into the view from 'to', all must be dimensions in size
+	// tilesToTrace is filled with the tiles from tileOrigins containing invalid pixels, in the same order
+	// Returns false without touching anything if too many tiles would need tracing
+	bool Reproject(const Parameters& params, const Render::Camera& from, const Render::Camera& to, glm::ivec2 dimensions, int tileSize,
+		const std::vector<glm::ivec2>& tileOrigins, std::vector<glm::vec4>& colour, FeatureBuffers& features, std::vector<glm::ivec2>& tilesToTrace);
+	void ClearAges(const Parameters& params, glm::ivec2 dimensions, int tileSize);	// Call when the whole image has been traced from scratch
+
+private:
+	void Splat(const Parameters& params, const Render::Camera& from, const Render::Camera& to, glm::ivec2 dimensions,
+		const std::vector<glm::vec4>& colour, const FeatureBuffers& features);
+	void FillGaps(const Parameters& params, glm::ivec2 dimensions);
+	bool IsTileValid(glm::ivec2 origin, glm::ivec2 size, int imageWidth) const;
+
+	// Written by Splat, swapped with the callers buffers if the reprojection is used
+	std::vector<glm::vec4> m_colour;
+	FeatureBuffers m_features;
+	std::vector<uint8_t> m_warpedAge;
+	std::vector<float> m_splatDepth;	// Distance to the nearest hit landing on each pixel, infinity if none did
+	std::vector<uint8_t> m_age;			// How many times in a row each pixel of the callers buffers has been reprojected
+};
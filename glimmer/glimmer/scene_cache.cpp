@@ -0,0 +1,94 @@
+#include "scene_cache.h"
+#include "traceboi.h"
+#include "wire_format.h"
+#include "kernel/file_io.h"
+#include "kernel/log.h"
+#include "sde/script_system.h"
+
+namespace
+{
+	const uint32_t c_cacheMagic = 0x4e435347;	// 'GSCN'
+}
+
+namespace SceneCache
+{
+	// 64 bit FNV-1a, a 32 bit hash collides too easily for a key that silently picks the wrong scene
+	uint64_t HashScript(const std::string& scriptText)
+	{
+		uint64_t hash = 14695981039346656037ull;
+		for (const char c : scriptText)
+		{
+			hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	bool Load(const char* cachePath, uint64_t scriptHash, Scene& scene)
+	{
+		std::vector<uint8_t> cache;
+		if (!Kernel::FileIO::LoadBinaryFile(cachePath, cache))
+		{
+			return false;
+		}
+		WireFormat::Reader reader(cache);
+		uint32_t magic = 0, sceneId = 0;
+		uint64_t hash = 0;
+		WireFormat::MessageType type;
+		if (!reader.Read(magic) || magic != c_cacheMagic || !reader.Read(hash) || hash != scriptHash)
+		{
+			return false;
+		}
+		Scene loaded;
+		if (!WireFormat::ReadMessageType(reader, type) || type != WireFormat::SceneMessage || !WireFormat::ReadScene(reader, sceneId, loaded) || !reader.AtEnd())
+		{
+			return false;
+		}
+		scene = std::move(loaded);
+		return true;
+	}
+
+	bool Save(const char* cachePath, uint64_t scriptHash, const Scene& scene)
+	{
+		if (!WireFormat::CanWriteScene(scene))
+		{
+			return false;	// Load would always reject it, so the script would run + rewrite the cache every time
+		}
+		std::vector<uint8_t> sceneMessage;
+		WireFormat::WriteScene(sceneMessage, 0, scene);
+		std::vector<uint8_t> cache;
+		cache.reserve(sizeof(c_cacheMagic) + sizeof(scriptHash) + sceneMessage.size());
+		WireFormat::Writer writer(cache);
+		writer.Write(c_cacheMagic);
+		writer.Write(scriptHash);
+		writer.WriteBytes(sceneMessage.data(), sceneMessage.size());
+		return Kernel::FileIO::SaveBinaryFile(cachePath, cache);
+	}
+
+	bool LoadScene(SDE::ScriptSystem& scripts, const char* scriptPath, const char* cachePath, Scene& scene, bool& fromCache, std::string& errorText)
+	{
+		fromCache = false;
+		std::string scriptText;
+		if (!Kernel::FileIO::LoadTextFromFile(scriptPath, scriptText))
+		{
+			errorText = "Failed to load the script";
+			return false;
+		}
+		const uint64_t hash = HashScript(scriptText);
+		if (cachePath != nullptr && Load(cachePath, hash, scene))
+		{
+			fromCache = true;
+			return true;
+		}
+
+		TraceBoi::RegisterScriptTypes(scripts.Globals(), scene);
+		if (!scripts.RunScript(scriptText.data(), errorText))
+		{
+			return false;
+		}
+		if (cachePath != nullptr && !Save(cachePath, hash, scene))
+		{
+			SDE_LOG("Failed to write the scene cache %s", cachePath);
+		}
+		return true;
+	}
+}
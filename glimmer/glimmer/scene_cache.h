@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+#include <stdint.h>
+
+struct Scene;
+
+namespace SDE
+{
+	class ScriptSystem;
+}
+
+// Binary copies of scenes built by scripts, so an unchanged script loads without running it again
+// Caches are keyed by a hash of the script text + stored in the WireFormat scene encoding, a new WireFormat::c_version invalidates them
+// Files the script loads itself (.obj meshes) are not part of the key, and the script must build the same scene every time it runs
+namespace SceneCache
+{
+	uint64_t HashScript(const std::string& scriptText);
+
+	// Returns false if the file is missing, was saved for a different script hash or is not a valid cache
+	bool Load(const char* cachePath, uint64_t scriptHash, Scene& scene);
+	bool Save(const char* cachePath, uint64_t scriptHash, const Scene& scene);	// Fails for scenes WireFormat::CanWriteScene rejects
+
+	// Loads scene from cachePath if it matches the script, otherwise runs the script with TraceBoi::RegisterScriptTypes + saves the cache
+	// cachePath may be null to always run the script. scene should be empty, fromCache is set if the script was not run
+	bool LoadScene(SDE::ScriptSystem& scripts, const char* scriptPath, const char* cachePath, Scene& scene, bool& fromCache, std::string& errorText);
+}
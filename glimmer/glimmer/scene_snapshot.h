@@ -0,0 +1,39 @@
+#pragma once
+#include "traceboi.h"
+#include "bvh.h"
+#include "light_bvh.h"
+
+// Immutable copy of a scene and its bvhs, shared by every job in a trace
+// Take a new one when the source scene changes, traces still in flight keep the old one alive
+class SceneSnapshot
+{
+public:
+	explicit SceneSnapshot(const Scene& scene)
+		: m_scene(scene)
+	{
+		m_bvh.Build(m_scene);
+		m_lightBvh.Build(m_scene.lights);
+	}
+	// Cheaper snapshot after a live edit, updates a copy of the previous bvh instead of building a new one
+	SceneSnapshot(const Scene& scene, const SceneSnapshot& previous)
+		: m_scene(scene)
+		, m_bvh(previous.m_bvh)
+	{
+		if (!m_bvh.Update(m_scene))
+		{
+			m_bvh.Build(m_scene);
+		}
+		m_lightBvh.Build(m_scene.lights);
+	}
+	SceneSnapshot(const SceneSnapshot&) = delete;
+	SceneSnapshot& operator=(const SceneSnapshot&) = delete;
+
+	inline const Scene& GetScene() const	{ return m_scene; }
+	inline const SceneBvh& GetBvh() const	{ return m_bvh; }
+	inline const LightBvh& GetLightBvh() const	{ return m_lightBvh; }
+
+private:
+	Scene m_scene;
+	SceneBvh m_bvh;
+	LightBvh m_lightBvh;
+};
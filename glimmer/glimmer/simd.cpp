@@ -0,0 +1,24 @@
+#include "simd.h"
+#include <intrin.h>
+
+namespace Simd
+{
+	bool HasAvx()
+	{
+		static const bool s_hasAvx = []()
+		{
+			// cpu must support avx, and the OS must be saving the ymm registers (osxsave + xcr0)
+			int cpuInfo[4] = { 0 };
+			__cpuid(cpuInfo, 1);
+			const bool osxsave = (cpuInfo[2] & (1 << 27)) != 0;
+			const bool avx = (cpuInfo[2] & (1 << 28)) != 0;
+			if (!osxsave || !avx)
+			{
+				return false;
+			}
+			const unsigned long long xcr0 = _xgetbv(0);
+			return (xcr0 & 0x6) == 0x6;
+		}();
+		return s_hasAvx;
+	}
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <immintrin.h>
+#include <stdint.h>
+#include <float.h>
+
+// Thin wrappers around SSE/AVX registers so packet kernels can be written once as templates
+// Comparisons return lane masks (all bits set for true), use Select/MoveMask to consume them
+// Float8 requires AVX at runtime, check Simd::HasAvx() before using it!
+namespace Simd
+{
+	bool HasAvx();		// Cached cpuid + OS support check
+
+	class Float4
+	{
+	public:
+		static const int Width = 4;
+
+		Float4() = default;
+		explicit Float4(__m128 v) : m_v(v) { }
+		explicit Float4(float f) : m_v(_mm_set1_ps(f)) { }
+
+		static inline Float4 Load(const float* src)		{ return Float4(_mm_loadu_ps(src)); }
+		inline void Store(float* dst) const				{ _mm_storeu_ps(dst, m_v); }
+		inline int MoveMask() const						{ return _mm_movemask_ps(m_v); }
+
+		// mask ? a : b, per lane. Masks are all or nothing, so SSE2 and/andnot/or works without needing SSE4.1 blendv
+		static inline Float4 Select(const Float4& mask, const Float4& a, const Float4& b)	{ return Float4(_mm_or_ps(_mm_and_ps(mask.m_v, a.m_v), _mm_andnot_ps(mask.m_v, b.m_v))); }
+		static inline Float4 Min(const Float4& a, const Float4& b)	{ return Float4(_mm_min_ps(a.m_v, b.m_v)); }
+		static inline Float4 Max(const Float4& a, const Float4& b)	{ return Float4(_mm_max_ps(a.m_v, b.m_v)); }
+		static inline Float4 Sqrt(const Float4& a)					{ return Float4(_mm_sqrt_ps(a.m_v)); }
+		static inline Float4 Abs(const Float4& a)					{ return Float4(_mm_andnot_ps(_mm_set1_ps(-0.0f), a.m_v)); }
+
+		// Truncates each lane to an int, then saturates them to bytes packed into a uint32, lane 0 in the low byte
+		inline uint32_t PackBytes() const
+		{
+			__m128i i = _mm_cvttps_epi32(m_v);
+			i = _mm_packs_epi32(i, i);
+			return static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_packus_epi16(i, i)));
+		}
+
+		inline Float4 operator+(const Float4& o) const	{ return Float4(_mm_add_ps(m_v, o.m_v)); }
+		inline Float4 operator-(const Float4& o) const	{ return Float4(_mm_sub_ps(m_v, o.m_v)); }
+		inline Float4 operator*(const Float4& o) const	{ return Float4(_mm_mul_ps(m_v, o.m_v)); }
+		inline Float4 operator/(const Float4& o) const	{ return Float4(_mm_div_ps(m_v, o.m_v)); }
+		inline Float4 operator<(const Float4& o) const	{ return Float4(_mm_cmplt_ps(m_v, o.m_v)); }
+		inline Float4 operator<=(const Float4& o) const	{ return Float4(_mm_cmple_ps(m_v, o.m_v)); }
+		inline Float4 operator>(const Float4& o) const	{ return Float4(_mm_cmpgt_ps(m_v, o.m_v)); }
+		inline Float4 operator>=(const Float4& o) const	{ return Float4(_mm_cmpge_ps(m_v, o.m_v)); }
+		inline Float4 operator&(const Float4& o) const	{ return Float4(_mm_and_ps(m_v, o.m_v)); }
+		inline Float4 operator|(const Float4& o) const	{ return Float4(_mm_or_ps(m_v, o.m_v)); }
+
+	private:
+		__m128 m_v;
+	};
+
+	class Float8
+	{
+	public:
+		static const int Width = 8;
+
+		Float8() = default;
+		explicit Float8(__m256 v) : m_v(v) { }
+		explicit Float8(float f) : m_v(_mm256_set1_ps(f)) { }
+
+		static inline Float8 Load(const float* src)		{ return Float8(_mm256_loadu_ps(src)); }
+		inline void Store(float* dst) const				{ _mm256_storeu_ps(dst, m_v); }
+		inline int MoveMask() const						{ return _mm256_movemask_ps(m_v); }
+
+		static inline Float8 Select(const Float8& mask, const Float8& a, const Float8& b)	{ return Float8(_mm256_blendv_ps(b.m_v, a.m_v, mask.m_v)); }
+		static inline Float8 Min(const Float8& a, const Float8& b)	{ return Float8(_mm256_min_ps(a.m_v, b.m_v)); }
+		static inline Float8 Max(const Float8& a, const Float8& b)	{ return Float8(_mm256_max_ps(a.m_v, b.m_v)); }
+		static inline Float8 Sqrt(const Float8& a)					{ return Float8(_mm256_sqrt_ps(a.m_v)); }
+		static inline Float8 Abs(const Float8& a)					{ return Float8(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.m_v)); }
+
+		inline Float8 operator+(const Float8& o) const	{ return Float8(_mm256_add_ps(m_v, o.m_v)); }
+		inline Float8 operator-(const Float8& o) const	{ return Float8(_mm256_sub_ps(m_v, o.m_v)); }
+		inline Float8 operator*(const Float8& o) const	{ return Float8(_mm256_mul_ps(m_v, o.m_v)); }
+		inline Float8 operator/(const Float8& o) const	{ return Float8(_mm256_div_ps(m_v, o.m_v)); }
+		inline Float8 operator<(const Float8& o) const	{ return Float8(_mm256_cmp_ps(m_v, o.m_v, _CMP_LT_OQ)); }
+		inline Float8 operator<=(const Float8& o) const	{ return Float8(_mm256_cmp_ps(m_v, o.m_v, _CMP_LE_OQ)); }
+		inline Float8 operator>(const Float8& o) const	{ return Float8(_mm256_cmp_ps(m_v, o.m_v, _CMP_GT_OQ)); }
+		inline Float8 operator>=(const Float8& o) const	{ return Float8(_mm256_cmp_ps(m_v, o.m_v, _CMP_GE_OQ)); }
+		inline Float8 operator&(const Float8& o) const	{ return Float8(_mm256_and_ps(m_v, o.m_v)); }
+		inline Float8 operator|(const Float8& o) const	{ return Float8(_mm256_or_ps(m_v, o.m_v)); }
+
+	private:
+		__m256 m_v;
+	};
+
+	// Smallest value in any lane set in mask, or FLT_MAX if mask is empty
+	template<class FloatType>
+	inline float MaskedMin(const FloatType& mask, const FloatType& v)
+	{
+		alignas(32) float lanes[FloatType::Width];
+		FloatType::Select(mask, v, FloatType(FLT_MAX)).Store(lanes);
+		float result = lanes[0];
+		for (int i = 1; i < FloatType::Width; ++i)
+		{
+			result = lanes[i] < result ? lanes[i] : result;
+		}
+		return result;
+	}
+}
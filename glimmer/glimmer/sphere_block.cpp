@@ -0,0 +1,33 @@
+#include "sphere_block.h"
+#include "simd.h"
+#include "kernel/assert.h"
+
+namespace Geometry
+{
+	void SphereBlock::Add(const Sphere& sphere, uint32_t sphereIndex)
+	{
+		SDE_ASSERT(m_count < Width);
+		m_sphereIndex[m_count] = sphereIndex;
+		Set(m_count++, sphere);
+	}
+
+	void SphereBlock::Set(int lane, const Sphere& sphere)
+	{
+		SDE_ASSERT(lane < m_count);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			m_centre[axis][lane] = sphere.m_posAndRadius[axis];
+		}
+		m_radiusSquared[lane] = sphere.m_posAndRadius.w * sphere.m_posAndRadius.w;
+	}
+
+	bool RaySphereBlockHit(const Ray& ray, const SphereBlock& block, float& closestT, int& hitLane)
+	{
+		return Simd::HasAvx() ? RaySphereBlockHit<Simd::Float8>(ray, block, closestT, hitLane) : RaySphereBlockHit<Simd::Float4>(ray, block, closestT, hitLane);
+	}
+
+	bool RaySphereBlockOccluded(const Ray& ray, const SphereBlock& block, float maxT)
+	{
+		return Simd::HasAvx() ? RaySphereBlockOccluded<Simd::Float8>(ray, block, maxT) : RaySphereBlockOccluded<Simd::Float4>(ray, block, maxT);
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "ray_packet.h"
+#include "primitive_block.h"
+#include <stdint.h>
+
+// Small batches of spheres stored as structure-of-arrays, so one ray can be tested against all of them at once
+// The bvh packs the spheres in each leaf into blocks, each lane remembers which scene sphere it came from
+namespace Geometry
+{
+	struct SphereBlock
+	{
+		static const int Width = 8;
+
+		void Add(const Sphere& sphere, uint32_t sphereIndex);
+		void Set(int lane, const Sphere& sphere);
+
+		// [axis][lane], lanes past m_count have a negative radius squared, which every kernel treats as a miss
+		float m_centre[3][Width] = {};
+		float m_radiusSquared[Width] = { -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f };
+		uint32_t m_sphereIndex[Width] = {};
+		int m_count = 0;
+	};
+
+	// Tests one ray against FloatType::Width spheres from the block, starting at firstLane
+	// Returns a lane mask of hits, with t written for those lanes only. Matches RaySphereIntersect
+	template<class FloatType>
+	FloatType RaySphereBlockIntersect(const Ray& ray, const SphereBlock& block, int firstLane, FloatType& t);
+
+	// Finds the closest sphere in the block that is nearer than closestT
+	// The non-template version picks AVX if the cpu has it, traversal picks the width once per ray instead
+	template<class FloatType>
+	bool RaySphereBlockHit(const Ray& ray, const SphereBlock& block, float& closestT, int& hitLane);
+	bool RaySphereBlockHit(const Ray& ray, const SphereBlock& block, float& closestT, int& hitLane);
+
+	// Returns true if any sphere in the block is nearer than maxT
+	template<class FloatType>
+	bool RaySphereBlockOccluded(const Ray& ray, const SphereBlock& block, float maxT);
+	bool RaySphereBlockOccluded(const Ray& ray, const SphereBlock& block, float maxT);
+}
+
+#include "sphere_block.inl"
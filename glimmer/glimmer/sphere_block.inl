@@ -0,0 +1,35 @@
+namespace Geometry
+{
+	template<class FloatType>
+	FloatType RaySphereBlockIntersect(const Ray& ray, const SphereBlock& block, int firstLane, FloatType& t)
+	{
+		const FloatType radius2 = FloatType::Load(&block.m_radiusSquared[firstLane]);
+		const FloatType lx = FloatType::Load(&block.m_centre[0][firstLane]) - FloatType(ray.m_origin.x);
+		const FloatType ly = FloatType::Load(&block.m_centre[1][firstLane]) - FloatType(ray.m_origin.y);
+		const FloatType lz = FloatType::Load(&block.m_centre[2][firstLane]) - FloatType(ray.m_origin.z);
+		const FloatType tca = lx * FloatType(ray.m_direction.x) + ly * FloatType(ray.m_direction.y) + lz * FloatType(ray.m_direction.z);
+		const FloatType d2 = (lx * lx + ly * ly + lz * lz) - tca * tca;
+		const FloatType mask = (tca >= FloatType(0.0f)) & (d2 <= radius2);
+		if (mask.MoveMask() == 0)
+		{
+			return mask;
+		}
+		const FloatType thc = FloatType::Sqrt(radius2 - d2);
+		const FloatType t0 = tca - thc;
+		const FloatType sphereT = FloatType::Select(t0 < FloatType(0.0f), tca + thc, t0);	// origin inside the sphere
+		t = FloatType::Select(mask, sphereT, t);
+		return mask;
+	}
+
+	template<class FloatType>
+	inline bool RaySphereBlockHit(const Ray& ray, const SphereBlock& block, float& closestT, int& hitLane)
+	{
+		return RayBlockHit<FloatType, SphereBlock, RaySphereBlockIntersect<FloatType>>(ray, block, closestT, hitLane);
+	}
+
+	template<class FloatType>
+	inline bool RaySphereBlockOccluded(const Ray& ray, const SphereBlock& block, float maxT)
+	{
+		return RayBlockOccluded<FloatType, SphereBlock, RaySphereBlockIntersect<FloatType>>(ray, block, maxT);
+	}
+}
@@ -0,0 +1,197 @@
+#include "tile_worker.h"
+#include "kernel/assert.h"
+#include "kernel/log.h"
+#include "core/timer.h"
+#include "sde/job_system.h"
+
+TileWorker::TileWorker(const Parameters& params, std::shared_ptr<IWireConnection> connection)
+	: m_parameters(params)
+	, m_connection(connection)
+{
+	SDE_ASSERT(params.m_jobSystem != nullptr && params.m_maxTilesInFlight > 0);
+	m_slots.resize(params.m_maxTilesInFlight);
+	for (auto& slot : m_slots)
+	{
+		m_freeSlots.push_back(&slot);
+	}
+}
+
+TileWorker::~TileWorker()
+{
+	// Jobs reference this + the slots
+	WaitForTiles();
+}
+
+void TileWorker::WaitForTiles()
+{
+	std::unique_lock<std::mutex> lock(m_slotsMutex);
+	m_tileSent.wait(lock, [this]()
+	{
+		return m_tilesInFlight == 0;
+	});
+}
+
+bool TileWorker::Run()
+{
+	std::vector<uint8_t> message;
+	bool messageOk = true;
+	while (messageOk && m_connection->Receive(message))
+	{
+		WireFormat::Reader reader(message);
+		WireFormat::MessageType type;
+		if (!WireFormat::ReadMessageType(reader, type))
+		{
+			messageOk = false;
+			break;
+		}
+		switch (type)
+		{
+		case WireFormat::SceneMessage:
+			messageOk = OnScene(reader);
+			break;
+		case WireFormat::TraceMessage:
+			messageOk = OnTrace(reader);
+			break;
+		case WireFormat::TileMessage:
+			messageOk = OnTile(reader);
+			break;
+		case WireFormat::EndTraceMessage:
+			messageOk = OnEndTrace(reader);
+			break;
+		default:
+			messageOk = false;		// Only sent by workers
+			break;
+		}
+	}
+	WaitForTiles();
+	if (!messageOk)
+	{
+		SDE_LOG("Tile worker received a bad message, closing the connection");
+		m_connection->Close();
+	}
+	return messageOk;
+}
+
+bool TileWorker::OnScene(WireFormat::Reader& reader)
+{
+	if (m_traceActive)
+	{
+		return false;
+	}
+	Scene scene;
+	uint32_t sceneId = 0;
+	if (!WireFormat::ReadScene(reader, sceneId, scene))
+	{
+		return false;
+	}
+	m_snapshot = std::make_shared<const SceneSnapshot>(scene);
+	m_sceneId = sceneId;
+	return true;
+}
+
+bool TileWorker::OnTrace(WireFormat::Reader& reader)
+{
+	WireFormat::TraceSettings settings;
+	if (m_traceActive || !WireFormat::ReadTrace(reader, settings) || m_snapshot == nullptr || settings.m_sceneId != m_sceneId)
+	{
+		return false;
+	}
+	m_trace = settings;
+	m_camera.SetFOVAndAspectRatio(settings.m_fov, (float)settings.m_imageDimensions.x / (float)settings.m_imageDimensions.y);
+	m_camera.LookAt(settings.m_cameraPosition, settings.m_cameraTarget, settings.m_cameraUp);
+	m_traceActive = true;
+
+	std::vector<uint8_t> pull;
+	WireFormat::WritePull(pull, static_cast<uint32_t>(m_slots.size()));
+	m_connection->Send(std::move(pull));
+	return true;
+}
+
+bool TileWorker::OnTile(WireFormat::Reader& reader)
+{
+	WireFormat::TileJob tile;
+	if (!m_traceActive || !WireFormat::ReadTile(reader, tile) || tile.m_traceId != m_trace.m_traceId)
+	{
+		return false;
+	}
+	if (glm::any(glm::lessThan(tile.m_origin, glm::ivec2(0))) || glm::any(glm::greaterThan(tile.m_origin + tile.m_size, m_trace.m_imageDimensions)))
+	{
+		return false;
+	}
+	TileSlot* slot = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_slotsMutex);
+		if (m_freeSlots.empty())
+		{
+			return false;	// More tiles than were pulled
+		}
+		slot = m_freeSlots.back();
+		m_freeSlots.pop_back();
+		++m_tilesInFlight;
+	}
+	slot->m_result.m_tile = tile;
+	m_parameters.m_jobSystem->PushJob([this, slot, snapshot = m_snapshot]()
+	{
+		std::vector<uint8_t> message;
+		TraceTile(*slot, *snapshot, message);
+		{
+			// Freed before sending, the coordinator answers with the next tile straight away
+			std::lock_guard<std::mutex> lock(m_slotsMutex);
+			m_freeSlots.push_back(slot);
+		}
+		m_connection->Send(std::move(message));
+		std::lock_guard<std::mutex> lock(m_slotsMutex);
+		--m_tilesInFlight;
+		m_tileSent.notify_all();
+	});
+	return true;
+}
+
+bool TileWorker::OnEndTrace(WireFormat::Reader& reader)
+{
+	uint32_t traceId = 0;
+	if (!m_traceActive || !WireFormat::ReadEndTrace(reader, traceId) || traceId != m_trace.m_traceId)
+	{
+		return false;
+	}
+	// The coordinator counts this worker as busy until every tile it pulled is back
+	WaitForTiles();
+	m_traceActive = false;
+	std::vector<uint8_t> endTrace;
+	WireFormat::WriteEndTrace(endTrace, traceId);
+	m_connection->Send(std::move(endTrace));
+	return true;
+}
+
+// Traced into the slot's own buffers without blending, the coordinator blends the result message into its output
+void TileWorker::TraceTile(TileSlot& slot, const SceneSnapshot& snapshot, std::vector<uint8_t>& message)
+{
+	WireFormat::TileResult& result = slot.m_result;
+	const glm::ivec2 tileSize = result.m_tile.m_size;
+	const size_t pixelCount = tileSize.x * tileSize.y;
+	result.m_colour.resize(pixelCount);
+	result.m_features.m_normalDepth.resize(m_trace.m_features ? pixelCount : 0);
+	result.m_features.m_material.resize(m_trace.m_features ? pixelCount : 0);
+	result.m_rayStats = RayStats();
+
+	TraceParamaters params = { result.m_colour, snapshot.GetScene(), snapshot.GetBvh(), m_camera, m_trace.m_imageDimensions, result.m_tile.m_origin, tileSize, m_trace.m_maxRecursion };
+	params.rayStats = &result.m_rayStats;
+	params.primaryRayPackets = m_trace.m_primaryRayPackets;
+	params.sampleOffset = m_trace.m_sampleOffset;
+	params.sampleCount = m_trace.m_sampleCount;
+	params.features = m_trace.m_features ? &result.m_features : nullptr;
+	params.lightBvh = &snapshot.GetLightBvh();
+	params.lightCutoff = m_trace.m_lightCutoff;
+	params.lightSamples = m_trace.m_lightSamples;
+	params.adaptive = m_trace.m_adaptive;
+	params.adaptiveScratch = &slot.m_adaptive;
+	params.wavefront = m_trace.m_wavefront ? &slot.m_wavefront : nullptr;
+	params.tileOutput = true;
+	params.blendSamples = false;
+
+	Core::Timer timer;
+	const double startTime = timer.GetSeconds();
+	TraceBoi::TraceMeSomethingNice(params);
+	result.m_traceTime = timer.GetSeconds() - startTime;
+	WireFormat::WriteTileResult(message, result);
+}
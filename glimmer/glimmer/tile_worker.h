@@ -0,0 +1,62 @@
+#pragma once
+#include "wire_format.h"
+#include "wire_connection.h"
+#include "scene_snapshot.h"
+#include "ray_queue.h"
+#include "render/camera.h"
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+namespace SDE
+{
+	class JobSystem;
+}
+
+// Worker side of distributed rendering, traces tiles for a CpuRaytracer on the other end of a connection
+// Tiles are traced by jobs on the worker's own job system, each is sent back as soon as it is done
+// Run it on the main thread of a worker process (glimmer_cli -workerPort), or on a thread of its own with a loopback connection
+class TileWorker
+{
+public:
+	struct Parameters
+	{
+		SDE::JobSystem* m_jobSystem = nullptr;
+		int m_maxTilesInFlight = 8;		// Tiles pulled ahead, more than the job system's thread count hides the round trips
+	};
+
+	TileWorker(const Parameters& params, std::shared_ptr<IWireConnection> connection);
+	~TileWorker();
+
+	// Handles messages until the connection closes, returns false if it was closed here because of a bad message
+	bool Run();
+
+private:
+	// Output + scratch memory for one tile in flight, reused so steady-state tracing does not allocate
+	struct TileSlot
+	{
+		WireFormat::TileResult m_result;
+		WavefrontQueues m_wavefront;
+		AdaptiveScratch m_adaptive;
+	};
+
+	bool OnScene(WireFormat::Reader& reader);
+	bool OnTrace(WireFormat::Reader& reader);
+	bool OnTile(WireFormat::Reader& reader);
+	bool OnEndTrace(WireFormat::Reader& reader);
+	void TraceTile(TileSlot& slot, const SceneSnapshot& snapshot, std::vector<uint8_t>& message);
+	void WaitForTiles();				// Until every tile received has been sent back
+
+	Parameters m_parameters;
+	std::shared_ptr<IWireConnection> m_connection;
+	uint32_t m_sceneId = 0;
+	std::shared_ptr<const SceneSnapshot> m_snapshot;	// Of the last scene received
+	WireFormat::TraceSettings m_trace;		// Only changed while no tiles are in flight, so jobs can read it
+	Render::Camera m_camera;
+	bool m_traceActive = false;				// Between a trace message + its end
+	std::vector<TileSlot> m_slots;
+	std::mutex m_slotsMutex;				// Protects m_freeSlots + m_tilesInFlight
+	std::vector<TileSlot*> m_freeSlots;		// Jobs return their slot once the result is written, before sending it
+	int m_tilesInFlight = 0;				// Tiles received whose result has not been sent yet
+	std::condition_variable m_tileSent;
+};
@@ -0,0 +1,56 @@
+#include "tone_map.h"
+#include "simd.h"
+#include "kernel/assert.h"
+
+namespace ToneMap
+{
+	namespace
+	{
+		// One pixel per register, the options are template parameters so the loop has no branches
+		template<bool Reinhard, bool GammaCorrect>
+		void ApplyPixels(float exposure, const glm::vec4* src, uint32_t* dst, size_t count)
+		{
+			const Simd::Float4 scale(exposure);
+			const Simd::Float4 zero(0.0f);
+			const Simd::Float4 one(1.0f);
+			const Simd::Float4 maxByte(255.0f);
+			for (size_t p = 0; p < count; ++p)
+			{
+				Simd::Float4 c = Simd::Float4::Max(Simd::Float4::Load(&src[p].x) * scale, zero);	// NaN becomes 0 too
+				if (Reinhard)
+				{
+					c = c / (one + c);
+				}
+				c = Simd::Float4::Min(c, one);
+				if (GammaCorrect)
+				{
+					c = Simd::Float4::Sqrt(c);
+				}
+				dst[p] = (c * maxByte).PackBytes() | 0xff000000;
+			}
+		}
+	}
+
+	void Apply(const Parameters& params, const glm::vec4* src, uint32_t* dst, size_t count)
+	{
+		if (params.m_reinhard)
+		{
+			params.m_gammaCorrect ? ApplyPixels<true, true>(params.m_exposure, src, dst, count) : ApplyPixels<true, false>(params.m_exposure, src, dst, count);
+		}
+		else
+		{
+			params.m_gammaCorrect ? ApplyPixels<false, true>(params.m_exposure, src, dst, count) : ApplyPixels<false, false>(params.m_exposure, src, dst, count);
+		}
+	}
+
+	void Apply(const Parameters& params, const std::vector<glm::vec4>& src, std::vector<uint32_t>& dst, glm::ivec2 imageDims, glm::ivec2 origin, glm::ivec2 size)
+	{
+		SDE_ASSERT(src.size() == imageDims.x * imageDims.y && dst.size() == src.size());
+		SDE_ASSERT(origin.x >= 0 && origin.y >= 0 && origin.x + size.x <= imageDims.x && origin.y + size.y <= imageDims.y);
+		for (int y = origin.y; y < origin.y + size.y; ++y)
+		{
+			const size_t rowStart = (y * imageDims.x) + origin.x;
+			Apply(params, src.data() + rowStart, dst.data() + rowStart, size.x);
+		}
+	}
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include "math/glm_headers.h"
+#include <vector>
+#include <stdint.h>
+
+// Converts the tracer's linear HDR colour into RGBA8 for display / writing to files
+// Runs as a separate pass over finished pixels, so the float data is still there for accumulation, filtering, etc
+namespace ToneMap
+{
+	struct Parameters
+	{
+		float m_exposure = 1.0f;		// Colour is scaled by this first
+		bool m_reinhard = false;		// Compress highlights with x / (1 + x) instead of clamping them to 1
+		bool m_gammaCorrect = false;	// Square root (gamma 2) approximation of sRGB, otherwise the output stays linear
+	};
+
+	// Converts count pixels, alpha is always 255
+	void Apply(const Parameters& params, const glm::vec4* src, uint32_t* dst, size_t count);
+
+	// Converts a rectangle of an image, src + dst have the same dimensions
+	void Apply(const Parameters& params, const std::vector<glm::vec4>& src, std::vector<uint32_t>& dst, glm::ivec2 imageDims, glm::ivec2 origin, glm::ivec2 size);
+}
@@ -0,0 +1,70 @@
+#include "trace_budget.h"
+#include <algorithm>
+
+// Highest resolution first, with finer steps near full resolution where the difference is most visible
+const int c_resolutionDivisors[] = { 1, 2, 3, 4, 6, 8 };
+const int c_resolutionDivisorCount = sizeof(c_resolutionDivisors) / sizeof(c_resolutionDivisors[0]);
+const int c_initialDivisor = 4;			// Used until something has been measured
+const double c_raiseRecursionHeadroom = 0.5;	// Bounces come back when full resolution fits in this fraction of the budget
+
+TraceBudget::TraceBudget(double targetTime, int maxRecursion)
+	: m_targetTime(targetTime)
+	, m_maxRecursion(maxRecursion)
+	, m_recursion(maxRecursion)
+{
+	m_costPerPixel.reserve(c_historySize);
+}
+
+glm::ivec2 TraceBudget::TracedDimensions(glm::ivec2 outputDimensions, int resolutionDivisor)
+{
+	return glm::max((outputDimensions + glm::ivec2(resolutionDivisor - 1)) / resolutionDivisor, glm::ivec2(1));
+}
+
+void TraceBudget::AddTrace(double traceTime, glm::ivec2 tracedDimensions)
+{
+	const double cost = traceTime / ((double)tracedDimensions.x * tracedDimensions.y);
+	if (m_costPerPixel.size() < c_historySize)
+	{
+		m_costPerPixel.push_back(cost);
+	}
+	else
+	{
+		m_costPerPixel[m_nextHistoryEntry] = cost;
+	}
+	m_nextHistoryEntry = (m_nextHistoryEntry + 1) % c_historySize;
+}
+
+double TraceBudget::MedianCostPerPixel() const
+{
+	// Median so one trace interrupted by something else does not cause a big jump in quality
+	std::vector<double> sorted = m_costPerPixel;
+	std::sort(sorted.begin(), sorted.end());
+	return sorted[sorted.size() / 2];
+}
+
+TraceBudget::Quality TraceBudget::NextQuality(glm::ivec2 outputDimensions)
+{
+	if (m_costPerPixel.size() == 0)
+	{
+		return { c_initialDivisor, m_recursion };
+	}
+
+	const double costPerPixel = MedianCostPerPixel();
+	for (int d = 0; d < c_resolutionDivisorCount; ++d)
+	{
+		const glm::ivec2 dims = TracedDimensions(outputDimensions, c_resolutionDivisors[d]);
+		const double predictedTime = costPerPixel * dims.x * dims.y;
+		if (predictedTime <= m_targetTime)
+		{
+			if (d == 0 && predictedTime < m_targetTime * c_raiseRecursionHeadroom && m_recursion < m_maxRecursion)
+			{
+				++m_recursion;
+			}
+			return { c_resolutionDivisors[d], m_recursion };
+		}
+	}
+
+	// Too slow even at the lowest resolution, drop a bounce
+	m_recursion = glm::max(1, m_recursion - 1);
+	return { c_resolutionDivisors[c_resolutionDivisorCount - 1], m_recursion };
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "math/glm_headers.h"
+#include <vector>
+
+// Picks the internal resolution + recursion depth for interactive traces, so they finish within a target time
+// Decisions come from the measured cost per pixel of recent traces, so slow scenes / machines adapt automatically
+class TraceBudget
+{
+public:
+	struct Quality
+	{
+		int m_resolutionDivisor = 1;	// Traced size is the output size / this, rounded up
+		int m_maxRecursion = 0;
+	};
+
+	TraceBudget(double targetTime, int maxRecursion);
+
+	void AddTrace(double traceTime, glm::ivec2 tracedDimensions);	// Call for every completed interactive trace, at any resolution
+	// Highest resolution predicted to fit the budget. Recursion is lowered if even the lowest resolution does not fit,
+	// and raised again once full resolution fits with plenty of headroom
+	Quality NextQuality(glm::ivec2 outputDimensions);
+	inline Quality FullQuality() const		{ return { 1, m_maxRecursion }; }
+
+	static glm::ivec2 TracedDimensions(glm::ivec2 outputDimensions, int resolutionDivisor);
+
+private:
+	double MedianCostPerPixel() const;
+
+	static const int c_historySize = 8;
+	double m_targetTime;
+	int m_maxRecursion;
+	int m_recursion;						// Used for interactive traces, lowered when over budget
+	std::vector<double> m_costPerPixel;		// Seconds per pixel of the last c_historySize traces
+	int m_nextHistoryEntry = 0;
+};
@@ -1,7 +1,14 @@
 #include "traceboi.h"
+#include "bvh.h"
+#include "simd.h"
+#include "ray_packet.h"
+#include "ray_queue.h"
+#include "light_bvh.h"
+#include "kernel/assert.h"
 #include <iostream>
+#include <algorithm>
 #include <stdint.h>
-#include <atomic>
+#include <string.h>
 
 struct RenderParams
 {
@@ -22,8 +29,8 @@ float GetAspectRatio(const RenderParams& globals)
 
 glm::vec3 GeneratePrimaryRayDirection(const RenderParams& globals, glm::vec2 pixelPos)
 {
-	float x = (2.0f * (pixelPos.x + 0.5f) / (float)globals.m_imageDimensions.x - 1.0f) * globals.m_aspectRatio * globals.m_scale;
-	float y = (1.0f - 2.0f * (pixelPos.y + 0.5f) / (float)globals.m_imageDimensions.y) * globals.m_scale;
+	float x = (2.0f * pixelPos.x / (float)globals.m_imageDimensions.x - 1.0f) * globals.m_aspectRatio * globals.m_scale;
+	float y = (1.0f - 2.0f * pixelPos.y / (float)globals.m_imageDimensions.y) * globals.m_scale;
 	glm::vec3 direction = (glm::mat3x3)globals.m_cameraToWorld * glm::vec3(x, y, -1);
 	direction = glm::normalize(direction);
 	return direction;
@@ -37,21 +44,9 @@ bool RayHitObject(const Geometry::Ray& ray, const TraceParamaters& globals, floa
 	glm::vec3 normal;
 	bool hit = false;
 
-	for (auto s : globals.scene.spheres)
-	{
-		if (Geometry::RaySphereIntersect(ray, s.m_sphere, t, normal))
-		{
-			if (t < closestT)
-			{
-				closestNormal = normal;
-				closestT = t;
-				closestMaterial = s.m_material;
-				hit = true;
-			}
-		}
-	}
-
-	for (auto p : globals.scene.planes)
+	// planes are unbounded so they live outside the bvh
+	globals.rayStats->m_planeTests += globals.scene.planes.size();
+	for (const auto& p : globals.scene.planes)
 	{
 		if (Geometry::RayPlaneIntersect(ray, p.m_plane, t, normal))
 		{
@@ -63,25 +58,10 @@ bool RayHitObject(const Geometry::Ray& ray, const TraceParamaters& globals, floa
 				hit = true;
 			}
 		}
-	}	
-
-	for (auto m : globals.scene.meshes)
-	{
-		for (auto tri : m.m_triangles)
-		{
-			if (Geometry::RayTriangleIntersect(ray, tri, t, normal))
-			{
-				if (t < closestT)
-				{
-					closestNormal = normal;
-					closestT = t;
-					closestMaterial = m.m_material;
-					hit = true;
-				}
-			}
-		}
 	}
 
+	hit |= globals.bvh.RayHit(ray, closestT, closestNormal, closestMaterial, *globals.rayStats);
+
 	if (hit)
 	{
 		t = closestT;
@@ -91,6 +71,22 @@ bool RayHitObject(const Geometry::Ray& ray, const TraceParamaters& globals, floa
 	return hit;
 }
 
+// Any-hit test for shadow rays, stops at the first thing closer than maxT
+bool RayOccluded(const Geometry::Ray& ray, const TraceParamaters& globals, float maxT)
+{
+	++globals.rayStats->m_shadowRays;
+	float t = 0.0f;
+	for (const auto& p : globals.scene.planes)
+	{
+		++globals.rayStats->m_planeTests;
+		if (Geometry::RayPlaneIntersect(ray, p.m_plane, t) && t < maxT)
+		{
+			return true;
+		}
+	}
+	return globals.bvh.RayOccluded(ray, maxT, *globals.rayStats);
+}
+
 float fresnel(const glm::vec3 direction, const glm::vec3 hitnormal, const float refractiveIndex)
 {
 	float result = 0.0f;
@@ -115,113 +111,713 @@ float fresnel(const glm::vec3 direction, const glm::vec3 hitnormal, const float
 	return result;
 }
 
-std::atomic<int> m_raycastCount = 0;
-glm::vec3 CastRay(const Geometry::Ray& ray, const TraceParamaters& globals, int depth)
+// Highlight from a light as seen along the ray, not shadowed
+float SpecularPower(const glm::vec3& pointToLight, const glm::vec3& hitNormal, const glm::vec3& rayDirection)
+{
+	glm::vec3 idealReflection = glm::reflect(pointToLight, hitNormal);
+	return glm::pow(glm::max(0.0f, glm::dot(idealReflection, rayDirection)), 10.0f);
+}
+
+// Rays leaving a ReflectRefract surface, the refraction ray is only valid if m_fresnel < 1 (not total internal reflection)
+struct SecondaryRays
+{
+	Geometry::Ray m_reflection;
+	Geometry::Ray m_refraction;
+	float m_fresnel;
+};
+
+SecondaryRays GenerateSecondaryRays(const Geometry::Ray& ray, const glm::vec3& hitPosition, const glm::vec3& hitNormal, const Material& hitMaterial)
+{
+	static float bias = 0.001f;
+	SecondaryRays result;
+	result.m_fresnel = fresnel(ray.m_direction, hitNormal, hitMaterial.m_refractiveIndex);
+	float dirDotNormal = glm::dot(ray.m_direction, hitNormal);
+	bool outside = dirDotNormal < 0;
+	glm::vec3 biasVec = bias * hitNormal;
+
+	auto reflectionDir = glm::reflect(ray.m_direction, hitNormal);
+	auto reflectionOrigin = outside ? hitPosition + biasVec : hitPosition - biasVec;
+	result.m_reflection = { reflectionOrigin, reflectionDir };
+
+	if (result.m_fresnel < 1.0f)
+	{
+		glm::vec3 refractionDir = (refract(ray.m_direction, hitNormal, hitMaterial.m_refractiveIndex));
+		glm::vec3 refractionOrig = outside ? hitPosition - biasVec : hitPosition + biasVec;
+		result.m_refraction = { refractionOrig, refractionDir };
+	}
+	return result;
+}
+
+// Calls fn(const Light& light, float falloff) for every light that reaches point with a brightness of at least minBrightness, see LightBvh
+template<class Fn>
+void ForEachLight(const TraceParamaters& globals, const glm::vec3& point, float minBrightness, Fn&& fn)
+{
+	if (globals.lightBvh != nullptr)
+	{
+		globals.lightBvh->ForEachLight(point, minBrightness, fn);
+		return;
+	}
+	for (const auto& l : globals.scene.lights)
+	{
+		float falloff = LightBvh::Falloff(l, point);
+		if (falloff > 0.0f && LightBvh::Brightness(l) * falloff >= minBrightness)
+		{
+			fn(l, falloff);
+		}
+	}
+}
+
+// Cheap xorshift generator for stochastic light selection
+// Seeded from the hit position + sample index, so results are repeatable without threading state through every ray
+class HitRandom
+{
+public:
+	HitRandom(const glm::vec3& hitPosition, int sampleIndex)
+	{
+		uint32_t hash = static_cast<uint32_t>(sampleIndex) * 0x9e3779b9u;
+		for (int i = 0; i < 3; ++i)
+		{
+			uint32_t bits;
+			memcpy(&bits, &hitPosition[i], sizeof(bits));
+			hash = (hash ^ bits) * 0x85ebca6bu;
+			hash ^= hash >> 13;
+		}
+		m_state = hash | 1;		// xorshift gets stuck at 0
+	}
+	inline float Next()		// [0, 1)
+	{
+		m_state ^= m_state << 13;
+		m_state ^= m_state >> 17;
+		m_state ^= m_state << 5;
+		return (m_state >> 8) * (1.0f / 16777216.0f);
+	}
+
+private:
+	uint32_t m_state;
+};
+
+const int c_maxLightSamples = 8;
+
+// Calls fn(const Light& light, float falloff, float scale) for the lights to shade at point, see ForEachLight
+// With lightSamples and a light bvh set, only that many lights are picked through the bvh. scale divides by the chance of picking each one so the average stays the same
+// Otherwise every light is visited with a scale of 1
+template<class Fn>
+void ShadeLights(const TraceParamaters& globals, const glm::vec3& point, float minBrightness, Fn&& fn)
+{
+	const int sampleCount = glm::min(globals.lightSamples, c_maxLightSamples);
+	if (sampleCount == 0 || globals.lightBvh == nullptr)
+	{
+		ForEachLight(globals, point, minBrightness, [&](const Light& l, float falloff)
+		{
+			fn(l, falloff, 1.0f);
+		});
+		return;
+	}
+	HitRandom random(point, globals.sampleCount);
+	for (int s = 0; s < sampleCount; ++s)
+	{
+		float probability = 0.0f;
+		const Light* light = globals.lightBvh->SampleLight(point, minBrightness, random.Next(), probability);
+		if (light != nullptr)
+		{
+			fn(*light, LightBvh::Falloff(*light, point), 1.0f / (probability * sampleCount));
+		}
+	}
+}
+
+// Direct lighting at a diffuse hit, returns the specular highlights (which are not shadowed)
+// castShadowRay(const Geometry::Ray& toLight, float lightDistance, const glm::vec3& diffuse) is called for each light that needs a shadow test,
+// the diffuse term should only be added if nothing is in the way
+template<class ShadowFn>
+glm::vec3 DiffuseLighting(const TraceParamaters& globals, const glm::vec3& hitPosition, const glm::vec3& hitNormal, const glm::vec3& rayDirection, ShadowFn&& castShadowRay)
+{
+	glm::vec3 specular(0.0f);
+	// |nDotL| + specularPow is at most 2, so lights below half the cutoff are skipped without looking at them
+	ShadeLights(globals, hitPosition, globals.lightCutoff * 0.5f, [&](const Light& l, float falloff, float scale)
+	{
+		auto toLight = l.m_position - hitPosition;
+		float lightDistance = glm::length(toLight);
+		auto pointToLight = toLight / lightDistance;
+		auto nDotL = glm::dot(hitNormal, pointToLight);
+		float specularPow = SpecularPower(pointToLight, hitNormal, rayDirection);
+		if (LightBvh::Brightness(l) * falloff * (glm::abs(nDotL) + specularPow) < globals.lightCutoff)
+		{
+			return;
+		}
+
+		specular += /*shadow **/ l.m_diffuse * (falloff * specularPow * scale);
+
+		// shadow, only things between the point and the light count
+		Geometry::Ray pointToLightRay = { hitPosition, pointToLight };
+		castShadowRay(pointToLightRay, lightDistance, (nDotL * l.m_diffuse) * (falloff * scale));
+	});
+	return specular;
+}
+
+// Highlights on a ReflectRefract surface, these are not shadowed so no shadow rays are needed
+glm::vec3 SpecularLighting(const TraceParamaters& globals, const glm::vec3& hitPosition, const glm::vec3& hitNormal, const glm::vec3& rayDirection)
+{
+	glm::vec3 specular(0.0f);
+	ShadeLights(globals, hitPosition, globals.lightCutoff, [&](const Light& l, float falloff, float scale)
+	{
+		auto pointToLight = glm::normalize(l.m_position - hitPosition);
+		float specularPow = falloff * SpecularPower(pointToLight, hitNormal, rayDirection);
+		if (LightBvh::Brightness(l) * specularPow < globals.lightCutoff)
+		{
+			return;
+		}
+		specular += l.m_diffuse * (specularPow * scale);
+	});
+	return specular;
+}
+
+// Where a primary ray hit, for the feature buffers
+struct PrimaryHit
+{
+	float m_t = 0.0f;
+	glm::vec3 m_normal = glm::vec3(0.0f);
+	Material m_material = { 0.0f, Diffuse };
+};
+
+glm::vec3 CastRay(const Geometry::Ray& ray, const TraceParamaters& globals, int depth, PrimaryHit* primaryHit = nullptr);
+
+// Calculates the colour of a ray hitting a surface, casting any secondary rays required
+glm::vec3 ShadeHit(const Geometry::Ray& ray, float hitT, const glm::vec3& hitNormal, const Material& hitMaterial, const TraceParamaters& globals, int depth)
+{
+	glm::vec3 outColour(0.0f);
+	auto hitPosition = ray.m_origin + ray.m_direction * hitT;
+	if (hitMaterial.m_type == Diffuse)
+	{
+		glm::vec3 diffuse(0.0f);
+		glm::vec3 specular = DiffuseLighting(globals, hitPosition, hitNormal, ray.m_direction, [&](const Geometry::Ray& toLight, float lightDistance, const glm::vec3& lightDiffuse)
+		{
+			if (!RayOccluded(toLight, globals, lightDistance))
+			{
+				diffuse += lightDiffuse;
+			}
+		});
+		outColour = diffuse + specular;
+	}
+	else if (hitMaterial.m_type == ReflectRefract)
+	{
+		SecondaryRays secondary = GenerateSecondaryRays(ray, hitPosition, hitNormal, hitMaterial);
+		float frenelFactor = secondary.m_fresnel;
+		glm::vec3 reflectionColour = CastRay(secondary.m_reflection, globals, depth + 1);
+
+		glm::vec3 refractionColor(0.0f);
+		if (frenelFactor < 1.0f)	// Not total internal reflection
+		{
+			refractionColor = CastRay(secondary.m_refraction, globals, depth + 1);
+		}
+		
+		glm::vec3 mixed = (reflectionColour * frenelFactor) + (refractionColor * (1.0f - frenelFactor));
+
+		glm::vec3 specular = SpecularLighting(globals, hitPosition, hitNormal, ray.m_direction);
+		outColour = mixed + specular;
+	}
+
+	return outColour;
+}
+
+glm::vec3 CastRay(const Geometry::Ray& ray, const TraceParamaters& globals, int depth, PrimaryHit* primaryHit)
 {
 	if (depth >= globals.maxRecursions)
 	{
 		return globals.scene.skyColour;
 	}
 
-	++m_raycastCount;
+	if (depth == 0)
+	{
+		++globals.rayStats->m_primaryRays;
+	}
+	else
+	{
+		++globals.rayStats->m_secondaryRays;
+	}
 
 	float hitT = 0.0f;
 	glm::vec3 hitNormal(0.0f);
 	Material hitMaterial;
-	bool rayHitObject = RayHitObject(ray, globals, hitT, hitNormal, hitMaterial);
-	glm::vec3 outColour(0.0f);
-	if (rayHitObject)
+	if (RayHitObject(ray, globals, hitT, hitNormal, hitMaterial))
 	{
-		auto hitPosition = ray.m_origin + ray.m_direction * hitT;
-		if (hitMaterial.m_type == Diffuse)
+		if (primaryHit != nullptr)
+		{
+			*primaryHit = { hitT, hitNormal, hitMaterial };
+		}
+		return ShadeHit(ray, hitT, hitNormal, hitMaterial, globals, depth);
+	}
+	else
+	{
+		++globals.rayStats->m_missedRays;
+		return globals.scene.skyColour;
+	}
+}
+
+// Index of an image pixel in outputBuffer + features
+inline size_t OutputIndex(const TraceParamaters& parameters, glm::ivec2 pos)
+{
+	if (parameters.tileOutput)
+	{
+		pos -= parameters.outputOrigin;
+		return (pos.y * parameters.outputDimensions.x) + pos.x;
+	}
+	return (pos.y * parameters.imageDimensions.x) + pos.x;
+}
+
+// Keeps a running average of all samples so far if accumulating, otherwise just writes this one
+void OutputSample(const TraceParamaters& parameters, glm::ivec2 pos, glm::vec3 colour)
+{
+	glm::vec4& pixel = parameters.outputBuffer[OutputIndex(parameters, pos)];
+	if (parameters.sampleCount > 1 && parameters.blendSamples)
+	{
+		pixel += (glm::vec4(colour, 1.0f) - pixel) / (float)parameters.sampleCount;
+	}
+	else
+	{
+		pixel = glm::vec4(colour, 1.0f);
+	}
+}
+
+// Averages the primary hit into the feature buffers, the same way as OutputSample
+void OutputFeatures(const TraceParamaters& parameters, glm::ivec2 pos, const PrimaryHit& hit)
+{
+	const size_t pixelIndex = OutputIndex(parameters, pos);
+	const glm::vec4 normalDepth(hit.m_normal, hit.m_t);
+	const float material = hit.m_material.m_type == ReflectRefract ? 1.0f : 0.0f;
+	glm::vec4& pixelNormalDepth = parameters.features->m_normalDepth[pixelIndex];
+	float& pixelMaterial = parameters.features->m_material[pixelIndex];
+	if (parameters.sampleCount > 1 && parameters.blendSamples)
+	{
+		const float scale = 1.0f / parameters.sampleCount;
+		pixelNormalDepth += (normalDepth - pixelNormalDepth) * scale;
+		pixelMaterial += (material - pixelMaterial) * scale;
+	}
+	else
+	{
+		pixelNormalDepth = normalDepth;
+		pixelMaterial = material;
+	}
+}
+
+// Packet version of RayHitObject, closestT must be initialised to the max distance per lane
+// Lanes that hit nothing have bvhHits[lane] == SceneBvh::c_noHit and planeHits[lane] == -1
+template<class FloatType>
+void RayPacketHitObject(const Geometry::RayPacket<FloatType>& packet, const TraceParamaters& parameters, FloatType& closestT, int32_t* planeHits, uint32_t* bvhHits)
+{
+	const int c_width = FloatType::Width;
+	RayStats& stats = *parameters.rayStats;
+	for (int lane = 0; lane < c_width; ++lane)
+	{
+		planeHits[lane] = -1;
+	}
+	stats.m_planeTests += c_width * parameters.scene.planes.size();
+	for (int p = 0; p < parameters.scene.planes.size(); ++p)
+	{
+		FloatType t = closestT;
+		FloatType hitMask = Geometry::RayPacketPlaneIntersect(packet, parameters.scene.planes[p].m_plane, t);
+		hitMask = hitMask & (t < closestT);
+		int laneBits = hitMask.MoveMask();
+		closestT = FloatType::Select(hitMask, t, closestT);
+		for (int lane = 0; lane < c_width; ++lane)
+		{
+			planeHits[lane] = (laneBits & (1 << lane)) ? p : planeHits[lane];
+		}
+	}
+	parameters.bvh.RayPacketHit(packet, closestT, bvhHits, stats);
+}
+
+// Packet version of RayOccluded, returns a bit per lane that hit something closer than maxT
+template<class FloatType>
+int RayPacketOccluded(const Geometry::RayPacket<FloatType>& packet, const TraceParamaters& parameters, const FloatType& maxT)
+{
+	const int c_allLanes = (1 << FloatType::Width) - 1;
+	RayStats& stats = *parameters.rayStats;
+	FloatType occluded(0.0f);
+	for (const auto& p : parameters.scene.planes)
+	{
+		stats.m_planeTests += FloatType::Width;
+		FloatType t = maxT;
+		occluded = occluded | (Geometry::RayPacketPlaneIntersect(packet, p.m_plane, t) & (t < maxT));
+		if (occluded.MoveMask() == c_allLanes)
+		{
+			return c_allLanes;
+		}
+	}
+	// Lanes already blocked by a plane get a negative max distance so the bvh skips them
+	FloatType bvhMaxT = FloatType::Select(occluded, FloatType(-1.0f), maxT);
+	occluded = occluded | parameters.bvh.RayPacketOccluded(packet, bvhMaxT, stats);
+	return occluded.MoveMask();
+}
+
+// Traces horizontal runs of primary rays as packets
+// Only the first hit is done in packets, shading + secondary rays diverge so they go back to single rays
+template<class FloatType>
+void TracePrimaryRayPackets(const TraceParamaters& parameters, const RenderParams& globals, const glm::vec3& origin)
+{
+	const int c_width = FloatType::Width;
+	const glm::ivec2 imageMin = parameters.outputOrigin;
+	const glm::ivec2 imageMax = parameters.outputOrigin + parameters.outputDimensions;
+
+	alignas(32) float dirX[c_width], dirY[c_width], dirZ[c_width], hitT[c_width];
+	int32_t planeHits[c_width];
+	uint32_t bvhHits[c_width];
+	for (int y = imageMin.y; y < imageMax.y; ++y)
+	{
+		for (int x = imageMin.x; x < imageMax.x; x += c_width)
 		{
-			glm::vec3 diffuse(0.0f);
-			glm::vec3 specular(0.0f);
-			for (auto l : globals.scene.lights)
+			// Pad the last packet of a row by repeating the last pixel, padded lanes are not written
+			const int laneCount = glm::min(c_width, imageMax.x - x);
+			for (int lane = 0; lane < c_width; ++lane)
 			{
-				auto pointToLight = glm::normalize(l.m_position - hitPosition);
-				auto nDotL = glm::dot(hitNormal, pointToLight);
+				int px = x + glm::min(lane, laneCount - 1);
+				glm::vec3 direction = GeneratePrimaryRayDirection(globals, glm::vec2(px, y) + parameters.sampleOffset);
+				dirX[lane] = direction.x;
+				dirY[lane] = direction.y;
+				dirZ[lane] = direction.z;
+			}
+			Geometry::RayPacket<FloatType> packet(origin, dirX, dirY, dirZ);
+			RayStats& stats = *parameters.rayStats;
+			stats.m_primaryRays += laneCount;
 
-				// shadow
-				float shadowBias = 0.000f;	// to avoid hitting the same object
-				Geometry::Ray pointToLightRay = { hitPosition + hitNormal * shadowBias, pointToLight };
-				float shadowT = 0.0f;
-				glm::vec3 shadowNormal(0.0f);
-				Material shadowMaterial;
-				bool inShadow = RayHitObject(pointToLightRay, globals, shadowT, shadowNormal, shadowMaterial);
-				glm::vec3 shadow(inShadow ? 0.0f : 1.0f);
-				diffuse += (nDotL * l.m_diffuse) * shadow;
+			FloatType closestT(std::numeric_limits<float>::max());
+			RayPacketHitObject(packet, parameters, closestT, planeHits, bvhHits);
+			closestT.Store(hitT);
 
-				//specular
-				glm::vec3 idealReflection = glm::reflect(pointToLight, hitNormal);
-				float specularPow = glm::pow(glm::max(0.0f, glm::dot(idealReflection, ray.m_direction)), 10.0f);
-				specular += /*shadow **/ l.m_diffuse * specularPow;
+			for (int lane = 0; lane < laneCount; ++lane)
+			{
+				Geometry::Ray ray = { origin, { dirX[lane], dirY[lane], dirZ[lane] } };
+				PrimaryHit hit;
+				glm::vec3 outColour;
+				if (bvhHits[lane] != SceneBvh::c_noHit)
+				{
+					hit.m_t = hitT[lane];
+					parameters.bvh.HitAttributes(bvhHits[lane], ray, hit.m_t, hit.m_normal, hit.m_material);
+					outColour = ShadeHit(ray, hit.m_t, hit.m_normal, hit.m_material, parameters, 0);
+				}
+				else if (planeHits[lane] != -1)
+				{
+					const Plane& plane = parameters.scene.planes[planeHits[lane]];
+					hit = { hitT[lane], plane.m_plane.m_normal, plane.m_material };
+					outColour = ShadeHit(ray, hit.m_t, hit.m_normal, hit.m_material, parameters, 0);
+				}
+				else
+				{
+					++stats.m_missedRays;
+					outColour = parameters.scene.skyColour;
+				}
+				OutputSample(parameters, { x + lane, y }, outColour);
+				if (parameters.features != nullptr)
+				{
+					OutputFeatures(parameters, { x + lane, y }, hit);
+				}
 			}
-			outColour = diffuse + specular;
 		}
-		else if (hitMaterial.m_type == ReflectRefract)
+	}
+}
+
+// Finds the closest hit for every ray in the queue, a packet at a time
+template<class FloatType>
+void IntersectRayQueue(RayQueue& rays, const TraceParamaters& parameters)
+{
+	const int c_width = FloatType::Width;
+	rays.Pad(c_width);
+	for (size_t i = 0; i < rays.Count(); i += c_width)
+	{
+		Geometry::RayPacket<FloatType> packet(&rays.m_originX[i], &rays.m_originY[i], &rays.m_originZ[i], &rays.m_dirX[i], &rays.m_dirY[i], &rays.m_dirZ[i]);
+		FloatType closestT = FloatType::Load(&rays.m_maxT[i]);
+		RayPacketHitObject(packet, parameters, closestT, &rays.m_hitPlane[i], &rays.m_hitPrimitive[i]);
+		closestT.Store(&rays.m_hitT[i]);
+	}
+}
+
+// Adds the contribution of every shadow ray that reaches its light to its path node
+template<class FloatType>
+void IntersectShadowQueue(RayQueue& shadowRays, std::vector<PathNode>& nodes, const TraceParamaters& parameters)
+{
+	const int c_width = FloatType::Width;
+	shadowRays.Pad(c_width);
+	parameters.rayStats->m_shadowRays += shadowRays.Count();
+	for (size_t i = 0; i < shadowRays.Count(); i += c_width)
+	{
+		Geometry::RayPacket<FloatType> packet(&shadowRays.m_originX[i], &shadowRays.m_originY[i], &shadowRays.m_originZ[i], &shadowRays.m_dirX[i], &shadowRays.m_dirY[i], &shadowRays.m_dirZ[i]);
+		int occludedLanes = RayPacketOccluded(packet, parameters, FloatType::Load(&shadowRays.m_maxT[i]));
+		const int laneCount = static_cast<int>(glm::min((size_t)c_width, shadowRays.Count() - i));
+		for (int lane = 0; lane < laneCount; ++lane)
 		{
-			static float bias = 0.001f;
-			float frenelFactor = fresnel(ray.m_direction, hitNormal, hitMaterial.m_refractiveIndex);
-			float dirDotNormal = glm::dot(ray.m_direction, hitNormal);
-			bool outside = dirDotNormal < 0;
-			glm::vec3 biasVec = bias * hitNormal;
+			if ((occludedLanes & (1 << lane)) == 0)
+			{
+				nodes[shadowRays.m_pathNode[i + lane]].m_colour += shadowRays.m_contribution[i + lane];
+			}
+		}
+	}
+}
 
-			auto reflectionDir = glm::reflect(ray.m_direction, hitNormal);
-			auto reflectionOrigin = outside ? hitPosition + biasVec : hitPosition - biasVec;
-			Geometry::Ray reflection = { reflectionOrigin, reflectionDir };
-			glm::vec3 reflectionColour = CastRay(reflection, globals, depth + 1);
+// Secondary rays past the max recursion return the sky colour without being traced, same as CastRay
+void PushSecondaryRay(const Geometry::Ray& ray, uint32_t parent, float weight, RayQueue& nextRays, std::vector<PathNode>& nodes, const TraceParamaters& parameters, int depth)
+{
+	if (depth + 1 >= parameters.maxRecursions)
+	{
+		nodes[parent].m_colour += parameters.scene.skyColour * weight;
+		return;
+	}
+	PathNode child;
+	child.m_parent = parent;
+	child.m_weight = weight;
+	nextRays.Push(ray.m_origin, ray.m_direction, std::numeric_limits<float>::max(), static_cast<uint32_t>(nodes.size()));
+	nodes.push_back(child);
+}
+
+// Primary rays take the first path nodes, in pixel order
+inline glm::ivec2 PrimaryPixel(const TraceParamaters& parameters, uint32_t nodeIndex)
+{
+	const int width = parameters.outputDimensions.x;
+	return parameters.outputOrigin + glm::ivec2(nodeIndex % width, nodeIndex / width);
+}
 
-			glm::vec3 refractionColor(0.0f);
-			if (frenelFactor < 1.0f)	// Not total internal reflection
+// Wavefront version of ShadeHit. Instead of recursing, shadow rays + secondary rays are queued for later waves
+// Child colours are added to each node when the paths are resolved
+void ShadeRayQueue(const RayQueue& rays, RayQueue& nextRays, WavefrontQueues& queues, const TraceParamaters& parameters, int depth)
+{
+	std::vector<PathNode>& nodes = queues.m_nodes;		// may grow, so only hold indices
+	RayStats& stats = *parameters.rayStats;
+	for (size_t i = 0; i < rays.Count(); ++i)
+	{
+		const uint32_t nodeIndex = rays.m_pathNode[i];
+		const Geometry::Ray ray = { rays.Origin(i), rays.Direction(i) };
+		const float hitT = rays.m_hitT[i];
+		glm::vec3 hitNormal(0.0f);
+		Material hitMaterial;
+		if (rays.m_hitPrimitive[i] != SceneBvh::c_noHit)
+		{
+			parameters.bvh.HitAttributes(rays.m_hitPrimitive[i], ray, hitT, hitNormal, hitMaterial);
+		}
+		else if (rays.m_hitPlane[i] != -1)
+		{
+			const Plane& plane = parameters.scene.planes[rays.m_hitPlane[i]];
+			hitNormal = plane.m_plane.m_normal;
+			hitMaterial = plane.m_material;
+		}
+		else
+		{
+			++stats.m_missedRays;
+			nodes[nodeIndex].m_colour = parameters.scene.skyColour;
+			if (depth == 0 && parameters.features != nullptr)
 			{
-				glm::vec3 refractionDir = (refract(ray.m_direction, hitNormal, hitMaterial.m_refractiveIndex));
-				glm::vec3 refractionOrig = outside ? hitPosition - biasVec : hitPosition + biasVec;
-				refractionColor = CastRay({ refractionOrig, refractionDir }, globals, depth + 1);
+				OutputFeatures(parameters, PrimaryPixel(parameters, nodeIndex), PrimaryHit());
 			}
-			
-			glm::vec3 mixed = (reflectionColour * frenelFactor) + (refractionColor * (1.0f - frenelFactor));
+			continue;
+		}
+		if (depth == 0 && parameters.features != nullptr)
+		{
+			OutputFeatures(parameters, PrimaryPixel(parameters, nodeIndex), { hitT, hitNormal, hitMaterial });
+		}
 
-			glm::vec3 specular(0.0f);
-			for (auto l : globals.scene.lights)
+		auto hitPosition = ray.m_origin + ray.m_direction * hitT;
+		glm::vec3 specular(0.0f);
+		if (hitMaterial.m_type == Diffuse)
+		{
+			specular = DiffuseLighting(parameters, hitPosition, hitNormal, ray.m_direction, [&](const Geometry::Ray& toLight, float lightDistance, const glm::vec3& lightDiffuse)
+			{
+				queues.m_shadowRays.Push(toLight.m_origin, toLight.m_direction, lightDistance, nodeIndex, lightDiffuse);
+			});
+		}
+		else if (hitMaterial.m_type == ReflectRefract)
+		{
+			SecondaryRays secondary = GenerateSecondaryRays(ray, hitPosition, hitNormal, hitMaterial);
+			PushSecondaryRay(secondary.m_reflection, nodeIndex, secondary.m_fresnel, nextRays, nodes, parameters, depth);
+			if (secondary.m_fresnel < 1.0f)
 			{
-				auto pointToLight = glm::normalize(l.m_position - hitPosition);
-				auto nDotL = glm::dot(hitNormal, pointToLight);
+				PushSecondaryRay(secondary.m_refraction, nodeIndex, 1.0f - secondary.m_fresnel, nextRays, nodes, parameters, depth);
+			}
+			specular = SpecularLighting(parameters, hitPosition, hitNormal, ray.m_direction);
+		}
+		nodes[nodeIndex].m_specular = specular;
+	}
+}
 
-				// shadow
-				Geometry::Ray pointToLightRay = { hitPosition, pointToLight };
-				float shadowT = 0.0f;
-				glm::vec3 shadowNormal(0.0f);
-				Material shadowMaterial;
-				bool inShadow = RayHitObject(pointToLightRay, globals, shadowT, shadowNormal, shadowMaterial);
-				glm::vec3 shadow(inShadow ? 0.0f : 1.0f);
+// Children are always stored after their parents, so walking backwards finishes every child before its parent
+void ResolvePaths(std::vector<PathNode>& nodes)
+{
+	for (size_t n = nodes.size(); n-- > 0;)
+	{
+		PathNode& node = nodes[n];
+		node.m_colour += node.m_specular;
+		if (node.m_parent != PathNode::c_noParent)
+		{
+			nodes[node.m_parent].m_colour += node.m_colour * node.m_weight;
+		}
+	}
+}
 
-				glm::vec3 idealReflection = glm::reflect(pointToLight, hitNormal);
-				float specularPow = glm::pow(glm::max(0.0f, glm::dot(idealReflection, ray.m_direction)), 10.0f);
-				specular += /*shadow **/ l.m_diffuse * specularPow;
-			}
-			outColour = mixed + specular;
+// Iterative alternative to CastRay. Each wave of rays is intersected in packets, then shaded,
+// which queues the shadow rays (intersected straight away) and the secondary rays for the next wave
+// Gives the same image as the recursive version
+template<class FloatType>
+void TraceWavefront(const TraceParamaters& parameters, const RenderParams& globals, const glm::vec3& origin)
+{
+	const glm::ivec2 imageMin = parameters.outputOrigin;
+	const glm::ivec2 imageMax = parameters.outputOrigin + parameters.outputDimensions;
+	WavefrontQueues& queues = *parameters.wavefront;
+	RayStats& stats = *parameters.rayStats;
+
+	// Primary rays take the first nodes, in pixel order
+	RayQueue* rays = &queues.m_rays[0];
+	RayQueue* nextRays = &queues.m_rays[1];
+	rays->Clear();
+	queues.m_nodes.clear();
+	for (int y = imageMin.y; y < imageMax.y; ++y)
+	{
+		for (int x = imageMin.x; x < imageMax.x; ++x)
+		{
+			glm::vec3 direction = GeneratePrimaryRayDirection(globals, glm::vec2(x, y) + parameters.sampleOffset);
+			rays->Push(origin, direction, std::numeric_limits<float>::max(), static_cast<uint32_t>(queues.m_nodes.size()));
+			queues.m_nodes.push_back(PathNode());
 		}
 	}
-	else
+	stats.m_primaryRays += rays->Count();
+
+	for (int depth = 0; rays->Count() > 0; ++depth)
 	{
-		outColour = globals.scene.skyColour;
+		IntersectRayQueue<FloatType>(*rays, parameters);
+		nextRays->Clear();
+		queues.m_shadowRays.Clear();
+		ShadeRayQueue(*rays, *nextRays, queues, parameters, depth);
+		IntersectShadowQueue<FloatType>(queues.m_shadowRays, queues.m_nodes, parameters);
+		stats.m_secondaryRays += nextRays->Count();
+		std::swap(rays, nextRays);
 	}
 
-	return glm::clamp(outColour, 0.0f,1.0f);
+	ResolvePaths(queues.m_nodes);
+	uint32_t pixelNode = 0;
+	for (int y = imageMin.y; y < imageMax.y; ++y)
+	{
+		for (int x = imageMin.x; x < imageMax.x; ++x)
+		{
+			OutputSample(parameters, { x, y }, queues.m_nodes[pixelNode++].m_colour);
+		}
+	}
 }
 
-void WritePixel(uint32_t* buffer, glm::ivec2 dims, glm::ivec2 pos, glm::vec3 colour)
+// Relative luminance difference, 0 for equal values up to 1 when one is black
+inline float Contrast(float a, float b)
 {
-	glm::ivec3 quantised = (glm::ivec3)(colour * 255.0f);
-	size_t pixelIndex = (pos.y * dims.x) + pos.x;
-	buffer[pixelIndex] = quantised.r | quantised.g << 8 | quantised.b << 16 | 0xff000000;
+	return glm::abs(a - b) / glm::max(a + b, 0.0001f);
+}
+
+// Base sample for the whole tile using the usual path, then extra single rays for the pixels that need them
+// Variance is tracked per pixel (Welford) so pixels near edges that turn out to be flat stop after one extra ray
+void TraceAdaptive(const TraceParamaters& parameters, const RenderParams& globals, const glm::vec3& origin)
+{
+	SDE_ASSERT(parameters.adaptiveScratch != nullptr);
+	const AdaptiveSampling& adaptive = parameters.adaptive;
+	AdaptiveScratch& scratch = *parameters.adaptiveScratch;
+	const glm::ivec2 size = parameters.outputDimensions;
+	const int pixelCount = size.x * size.y;
+	std::vector<glm::vec4>& colour = scratch.m_colour;
+	colour.resize(pixelCount);
+	if (parameters.features != nullptr)
+	{
+		scratch.m_features.m_normalDepth.resize(pixelCount);
+		scratch.m_features.m_material.resize(pixelCount);
+	}
+	TraceParamaters base = { colour, parameters.scene, parameters.bvh, parameters.camera, parameters.imageDimensions, parameters.outputOrigin, size, parameters.maxRecursions };
+	base.rayStats = parameters.rayStats;
+	base.primaryRayPackets = parameters.primaryRayPackets;
+	base.sampleOffset = parameters.sampleOffset;
+	base.sampleCount = parameters.sampleCount;
+	base.features = parameters.features != nullptr ? &scratch.m_features : nullptr;
+	base.lightBvh = parameters.lightBvh;
+	base.lightCutoff = parameters.lightCutoff;
+	base.lightSamples = parameters.lightSamples;
+	base.wavefront = parameters.wavefront;
+	base.tileOutput = true;
+	base.blendSamples = false;
+	TraceBoi::TraceMeSomethingNice(base);
+
+	std::vector<float>& luminance = scratch.m_luminance;
+	luminance.resize(pixelCount);
+	for (int p = 0; p < pixelCount; ++p)
+	{
+		luminance[p] = glm::dot(glm::vec3(colour[p]), glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	}
+	std::vector<AdaptiveScratch::Pixel>& refine = scratch.m_refine;
+	refine.clear();
+	for (int y = 0; y < size.y; ++y)
+	{
+		for (int x = 0; x < size.x; ++x)
+		{
+			const int p = y * size.x + x;
+			float contrast = 0.0f;
+			contrast = x > 0 ? glm::max(contrast, Contrast(luminance[p], luminance[p - 1])) : contrast;
+			contrast = x + 1 < size.x ? glm::max(contrast, Contrast(luminance[p], luminance[p + 1])) : contrast;
+			contrast = y > 0 ? glm::max(contrast, Contrast(luminance[p], luminance[p - size.x])) : contrast;
+			contrast = y + 1 < size.y ? glm::max(contrast, Contrast(luminance[p], luminance[p + size.x])) : contrast;
+			if (contrast > adaptive.m_contrastThreshold)
+			{
+				refine.push_back({ p, contrast, 1, luminance[p], 0.0f });
+				continue;
+			}
+			if (!adaptive.m_probeTileBorders)
+			{
+				continue;
+			}
+			// Neighbours in other tiles are not traced yet, so pixels along shared tile borders get one extra ray
+			// to check their own variance instead, after the pixels known to need it
+			const glm::ivec2 pos = parameters.outputOrigin + glm::ivec2(x, y);
+			const bool tileBorder = (x == 0 && pos.x > 0) || (y == 0 && pos.y > 0)
+				|| (x + 1 == size.x && pos.x + 1 < parameters.imageDimensions.x) || (y + 1 == size.y && pos.y + 1 < parameters.imageDimensions.y);
+			if (tileBorder)
+			{
+				refine.push_back({ p, 0.0f, 1, luminance[p], 0.0f });
+			}
+		}
+	}
+	std::sort(refine.begin(), refine.end(), [](const AdaptiveScratch::Pixel& a, const AdaptiveScratch::Pixel& b)
+	{
+		return a.m_contrast > b.m_contrast;
+	});
+
+	// Rounds spread the budget over every pixel that needs it, instead of spending it all on the first few
+	const glm::vec2 c_r2(0.7548776662f, 0.5698402910f);		// R2 sequence, well spread sub-pixel offsets for any number of rounds
+	int budget = static_cast<int>(adaptive.m_budget * pixelCount);
+	Geometry::Ray ray;
+	ray.m_origin = origin;
+	for (int round = 1; round < adaptive.m_maxSamples && budget > 0 && !refine.empty(); ++round)
+	{
+		const glm::vec2 offset = glm::fract(parameters.sampleOffset + c_r2 * (float)round);
+		size_t kept = 0;
+		for (size_t r = 0; r < refine.size() && budget > 0; ++r, --budget)
+		{
+			AdaptiveScratch::Pixel& pixel = refine[r];
+			const glm::ivec2 pos = parameters.outputOrigin + glm::ivec2(pixel.m_index % size.x, pixel.m_index / size.x);
+			ray.m_direction = GeneratePrimaryRayDirection(globals, glm::vec2(pos) + offset);
+			const glm::vec3 sample = CastRay(ray, parameters, 0);
+			glm::vec4& pixelColour = colour[pixel.m_index];
+			pixel.m_samples++;
+			pixelColour += (glm::vec4(sample, 1.0f) - pixelColour) / (float)pixel.m_samples;
+
+			const float sampleLuminance = glm::dot(sample, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+			const float delta = sampleLuminance - pixel.m_mean;
+			pixel.m_mean += delta / pixel.m_samples;
+			pixel.m_m2 += delta * (sampleLuminance - pixel.m_mean);
+			const float stdDev = glm::sqrt(pixel.m_m2 / (pixel.m_samples - 1));
+			if (stdDev > adaptive.m_contrastThreshold * glm::max(pixel.m_mean, 0.0001f))
+			{
+				refine[kept++] = pixel;
+			}
+		}
+		refine.resize(kept);
+	}
+
+	TraceBoi::OutputTile(parameters, colour, base.features);
 }
 
 namespace TraceBoi
 {
 	void TraceMeSomethingNice(const TraceParamaters& parameters)
 	{
+		SDE_ASSERT(parameters.rayStats != nullptr);
+
 		const glm::ivec2 imageMin = parameters.outputOrigin;
 		const glm::ivec2 imageMax = parameters.outputOrigin + parameters.outputDimensions;
 
@@ -234,16 +830,133 @@ namespace TraceBoi
 		glm::vec3 origin = (glm::vec3)(globals.m_cameraToWorld * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
 		globals.m_maxRecursions = parameters.maxRecursions;
 
+		if (parameters.adaptive.m_maxSamples > 1)
+		{
+			TraceAdaptive(parameters, globals, origin);
+			return;
+		}
+
+		if (parameters.wavefront != nullptr && parameters.maxRecursions > 0)
+		{
+			if (Simd::HasAvx())
+			{
+				TraceWavefront<Simd::Float8>(parameters, globals, origin);
+			}
+			else
+			{
+				TraceWavefront<Simd::Float4>(parameters, globals, origin);
+			}
+			return;
+		}
+
+		if (parameters.primaryRayPackets && parameters.maxRecursions > 0)
+		{
+			if (Simd::HasAvx())
+			{
+				TracePrimaryRayPackets<Simd::Float8>(parameters, globals, origin);
+			}
+			else
+			{
+				TracePrimaryRayPackets<Simd::Float4>(parameters, globals, origin);
+			}
+			return;
+		}
+
 		Geometry::Ray primaryRay;
 		primaryRay.m_origin = origin;
 		for (int y = imageMin.y; y < imageMax.y; ++y)
 		{
 			for (int x = imageMin.x; x < imageMax.x; ++x)
 			{
-				primaryRay.m_direction = GeneratePrimaryRayDirection(globals, { (float)x, (float)y });
-				glm::vec3 outColour = CastRay(primaryRay, parameters, 0);
-				WritePixel(parameters.outputBuffer.data(), parameters.imageDimensions, { x, y }, outColour);
+				primaryRay.m_direction = GeneratePrimaryRayDirection(globals, glm::vec2(x, y) + parameters.sampleOffset);
+				PrimaryHit hit;
+				glm::vec3 outColour = CastRay(primaryRay, parameters, 0, &hit);
+				OutputSample(parameters, { x, y }, outColour);
+				if (parameters.features != nullptr)
+				{
+					OutputFeatures(parameters, { x, y }, hit);
+				}
+			}
+		}
+	}
+
+	void OutputTile(const TraceParamaters& parameters, const std::vector<glm::vec4>& colour, const FeatureBuffers* features)
+	{
+		SDE_ASSERT(colour.size() == parameters.outputDimensions.x * parameters.outputDimensions.y);
+		size_t tilePixel = 0;
+		for (int y = 0; y < parameters.outputDimensions.y; ++y)
+		{
+			for (int x = 0; x < parameters.outputDimensions.x; ++x, ++tilePixel)
+			{
+				const glm::ivec2 pos = parameters.outputOrigin + glm::ivec2(x, y);
+				OutputSample(parameters, pos, glm::vec3(colour[tilePixel]));
+				if (parameters.features != nullptr && features != nullptr)
+				{
+					// Unblended features are exact, so the hit they came from can be rebuilt
+					const glm::vec4& normalDepth = features->m_normalDepth[tilePixel];
+					PrimaryHit hit;
+					hit.m_t = normalDepth.w;
+					hit.m_normal = glm::vec3(normalDepth);
+					hit.m_material.m_type = features->m_material[tilePixel] > 0.5f ? ReflectRefract : Diffuse;
+					OutputFeatures(parameters, pos, hit);
+				}
+			}
+		}
+	}
+
+	uint32_t AddInstancedMesh(Scene& scene, const Mesh& mesh)
+	{
+		auto meshBvh = std::make_shared<SceneBvh>();
+		meshBvh->Build(mesh);
+		scene.instancedMeshes.push_back(meshBvh);
+		return static_cast<uint32_t>(scene.instancedMeshes.size() - 1);
+	}
+
+	size_t ReadScriptFloats(const sol::object& values, size_t elementSize, std::vector<float>& result, const char* function)
+	{
+		result.clear();
+		lua_State* state = values.lua_state();
+		size_t badValue = 0;		// 1 based index of the first value that is not a number
+		if (values.get_type() == sol::type::string)
+		{
+			values.push();
+			size_t bytes = 0;
+			const char* data = lua_tolstring(state, -1, &bytes);
+			result.resize(bytes / sizeof(float));
+			memcpy(result.data(), data, result.size() * sizeof(float));
+			lua_pop(state, 1);
+			if (bytes % sizeof(float) != 0)
+			{
+				throw sol::error(std::string(function) + ": packed values are " + std::to_string(bytes) + " bytes, not a whole number of floats");
 			}
 		}
+		else if (values.get_type() == sol::type::table)
+		{
+			// Raw reads straight off the stack, going through sol for each value costs more than the rest of the load
+			values.push();
+			result.resize(lua_rawlen(state, -1));
+			for (size_t i = 0; i < result.size() && badValue == 0; ++i)
+			{
+				lua_rawgeti(state, -1, static_cast<lua_Integer>(i + 1));
+				int isNumber = 0;
+				result[i] = static_cast<float>(lua_tonumberx(state, -1, &isNumber));
+				badValue = isNumber ? 0 : i + 1;
+				lua_pop(state, 1);
+			}
+			lua_pop(state, 1);
+			if (badValue != 0)
+			{
+				throw sol::error(std::string(function) + ": value " + std::to_string(badValue) + " is not a number");
+			}
+		}
+		else
+		{
+			throw sol::error(std::string(function) + ": expected a table or a string of packed floats");
+		}
+		if (result.size() % elementSize != 0)
+		{
+			throw sol::error(std::string(function) + ": " + std::to_string(result.size()) + " values is not a multiple of " + std::to_string(elementSize));
+		}
+		return result.size() / elementSize;
 	}
 }
\ No newline at end of file
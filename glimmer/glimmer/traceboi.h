@@ -1,13 +1,23 @@
 #pragma once
 #include <vector>
+#include <memory>
 #include "render/camera.h"
 #include "geometry.h"
+#include "ray_stats.h"
+#include "obj_loader.h"
+#include "voxel_volume.h"
+#include "kernel/log.h"
 #include <sol.hpp>
 
+class SceneBvh;
+class LightBvh;
+struct WavefrontQueues;
+
 struct Light
 {
 	glm::vec3 m_position;
 	glm::vec3 m_diffuse;
+	float m_range = 0.0f;		// Fades out smoothly to nothing at this distance, 0 = infinite range with no falloff
 };
 
 enum MaterialType
@@ -36,7 +46,22 @@ struct Plane
 
 struct Mesh
 {
-	std::vector<Geometry::Triangle> m_triangles;
+	std::vector<Geometry::PrecomputedTriangle> m_triangles;		// see Geometry::PrecomputeTriangle
+	Material m_material;
+};
+
+// Places a copy of one of Scene::instancedMeshes in the world
+struct MeshInstance
+{
+	uint32_t m_mesh;			// index into Scene::instancedMeshes
+	glm::mat4 m_transform;		// object to world space
+};
+
+// Places one of Scene::voxelModels in the world, every solid voxel uses the same material
+struct VoxelVolume
+{
+	uint32_t m_model;			// index into Scene::voxelModels
+	glm::vec3 m_position;		// world space position of the model's origin
 	Material m_material;
 };
 
@@ -47,6 +72,13 @@ struct Scene
 	std::vector<Mesh> meshes;
 	std::vector<Light> lights;
 	glm::vec3 skyColour;
+	// Object space meshes with their bvh already built, see SceneBvh::Build(const Mesh&)
+	// Shared between copies of the scene, so snapshots do not copy or rebuild them
+	std::vector<std::shared_ptr<const SceneBvh>> instancedMeshes;
+	std::vector<MeshInstance> meshInstances;
+	// Shared between copies of the scene like instancedMeshes, so only edit them while building the scene, before any trace uses them
+	std::vector<std::shared_ptr<VoxelModel>> voxelModels;
+	std::vector<VoxelVolume> voxelVolumes;
 };
 
 struct ImageParameters
@@ -54,23 +86,87 @@ struct ImageParameters
 	glm::ivec2 m_dimensions;
 };
 
+// Primary hit surface info for each pixel, averaged over samples like the colour. Guides the denoiser
+// Materials have no colour of their own, so the material type is used to find edges instead of the usual albedo
+struct FeatureBuffers
+{
+	std::vector<glm::vec4> m_normalDepth;	// World space normal + distance to the hit, all 0 for misses
+	std::vector<float> m_material;			// 1 for ReflectRefract, 0 for Diffuse + misses
+};
+
+// Spends extra jittered primary rays only on the pixels that need them (edges, reflections, refraction boundaries)
+// Each tile gets one sample per pixel first. Pixels that stand out from their neighbours then get one more sample per round,
+// highest contrast first, until they reach m_maxSamples, their samples stop varying or the tile's budget runs out
+struct AdaptiveSampling
+{
+	int m_maxSamples = 1;				// Primary rays per pixel including the first, 1 = off
+	float m_contrastThreshold = 0.1f;	// Relative luminance difference to a neighbour ((max - min) / (max + min)) that needs more samples
+	float m_budget = 1.0f;				// Extra rays per tile, as an average per pixel
+	// Tiles are sampled before their neighbours are traced, so contrast across a tile border is never seen and an edge
+	// that runs exactly along one is not refined. This gives every border pixel one extra ray to test its own variance instead.
+	// On 16x16 tiles that is 60 of 256 pixels, about 23% more primary rays even for flat sky, so it is off by default
+	bool m_probeTileBorders = false;
+};
+
+// Buffers for adaptive sampling, reused between tiles so steady-state tracing does not allocate
+struct AdaptiveScratch
+{
+	struct Pixel
+	{
+		int m_index;		// In the tile
+		float m_contrast;
+		int m_samples;
+		float m_mean;		// Of luminance, for the variance
+		float m_m2;
+	};
+	std::vector<glm::vec4> m_colour;		// The tile's base sample, then the average of all its rays
+	FeatureBuffers m_features;
+	std::vector<float> m_luminance;
+	std::vector<Pixel> m_refine;			// Pixels still being sampled
+};
+
 struct TraceParamaters
 {
-	std::vector<uint32_t>& outputBuffer;
-	Scene scene;
+	std::vector<glm::vec4>& outputBuffer;	// Linear colour, not clamped. Convert with ToneMap::Apply for display
+	const Scene& scene;			// Must stay alive and unchanged until the trace completes
+	const SceneBvh& bvh;		// Acceleration structure for everything except planes
 	Render::Camera camera;
 	glm::ivec2 imageDimensions;
 	glm::ivec2 outputOrigin;
 	glm::ivec2 outputDimensions;
 	int maxRecursions;
-	int raycastCount = 0;
+	RayStats* rayStats = nullptr;	// Must be set, give each worker its own
+	bool primaryRayPackets = true;	// Trace primary rays in SIMD packets (SSE or AVX depending on cpu)
+	glm::vec2 sampleOffset = glm::vec2(0.5f);	// Sub-pixel position of primary rays
+	int sampleCount = 1;		// Samples averaged into outputBuffer including this one, 1 overwrites old samples
+	FeatureBuffers* features = nullptr;	// If set, primary hit features are averaged in here too, same dimensions as outputBuffer
+	const LightBvh* lightBvh = nullptr;	// If set, only lights that can reach a hit and pass lightCutoff are visited, otherwise every light is
+	float lightCutoff = 0.0f;	// Lights whose unshadowed contribution at a hit (max of r,g,b) is below this are skipped, no shadow ray is cast
+	int lightSamples = 0;		// If > 0 and lightBvh is set, hits only shade this many lights (max 8), picked through the bvh in proportion to their brightness
+	WavefrontQueues* wavefront = nullptr;	// If set, trace iteratively in waves of SIMD packets using these queues instead of recursing. Give each worker its own
+	bool tileOutput = false;	// outputBuffer + features only cover the output rect (rows outputDimensions.x wide) instead of the whole image
+	bool blendSamples = true;	// If false every sample overwrites the output, sampleCount still picks the light samples. See TraceBoi::OutputTile
+	AdaptiveSampling adaptive;	// All of a pixel's rays are averaged before blending, so accumulation sees one sample per trace
+	AdaptiveScratch* adaptiveScratch = nullptr;	// Must be set if adaptive.m_maxSamples > 1. Give each worker its own
 };
 
 namespace TraceBoi
 {
 	void TraceMeSomethingNice(const TraceParamaters& parameters);
 
-	// adds glimmer.scene.*(addSphere, addPlane, addLight, setSkyColour) to scripts
+	// Writes one sample of the output rect traced elsewhere (by a TileWorker) as if it was traced here
+	// colour + features are packed tiles, traced with blendSamples = false. features may be null if parameters.features is
+	void OutputTile(const TraceParamaters& parameters, const std::vector<glm::vec4>& colour, const FeatureBuffers* features);
+
+	// Builds the bvh for an object space mesh and adds it to scene.instancedMeshes, returns its index
+	uint32_t AddInstancedMesh(Scene& scene, const Mesh& mesh);
+
+	// Reads a flat array of numbers passed from a script, either a table or a string of packed floats (string.pack("f", ...))
+	// Returns the number of elements of elementSize floats. Anything else, a non-number value or a partial element at the end
+	// throws a sol::error naming function, which the script sees as a Lua error. A miscounted array is a script bug
+	size_t ReadScriptFloats(const sol::object& values, size_t elementSize, std::vector<float>& result, const char* function);
+
+	// adds glimmer.scene.* (spheres, planes, lights, sky colour, instanced meshes + voxel volumes) to scripts
 	// they will operate on the target scene
 	template<class ScriptScope>
 	static inline void RegisterScriptTypes(ScriptScope& globals, Scene& targetScene)
@@ -84,6 +180,21 @@ namespace TraceBoi
 				{ { { x, y, z, radius} }, m }
 			);
 		};
+		// Many at once for generated scenes, values is a flat array of x,y,z,radius per sphere, see ReadScriptFloats
+		scene["addSpheres"] = [&targetScene](sol::object values, bool reflect)
+		{
+			Material m = reflect ? Material{ 0.001f, ReflectRefract } : Material{ 1.0f, Diffuse };
+			std::vector<float> floats;
+			const size_t count = ReadScriptFloats(values, 4, floats, "addSpheres");
+			targetScene.spheres.reserve(targetScene.spheres.size() + count);
+			for (size_t i = 0; i < count; ++i)
+			{
+				const float* v = &floats[i * 4];
+				targetScene.spheres.push_back(
+					{ { { v[0], v[1], v[2], v[3] } }, m }
+				);
+			}
+		};
 		scene["addPlane"] = [&targetScene](float nx, float ny, float nz, float px, float py, float pz, bool reflect)
 		{
 			Material m = reflect ? Material{ 0.001f, ReflectRefract } : Material{ 1.0f, Diffuse };
@@ -91,13 +202,130 @@ namespace TraceBoi
 				{ { {nx,ny,nz}, {px,py,pz} }, m }
 			);
 		};
-		scene["addLight"] = [&targetScene](float px, float py, float pz, float r, float g, float b)
+		// values is nx,ny,nz,px,py,pz per plane
+		scene["addPlanes"] = [&targetScene](sol::object values, bool reflect)
+		{
+			Material m = reflect ? Material{ 0.001f, ReflectRefract } : Material{ 1.0f, Diffuse };
+			std::vector<float> floats;
+			const size_t count = ReadScriptFloats(values, 6, floats, "addPlanes");
+			targetScene.planes.reserve(targetScene.planes.size() + count);
+			for (size_t i = 0; i < count; ++i)
+			{
+				const float* v = &floats[i * 6];
+				targetScene.planes.push_back(
+					{ { { v[0], v[1], v[2] }, { v[3], v[4], v[5] } }, m }
+				);
+			}
+		};
+		// range is optional, lights without one reach everywhere
+		scene["addLight"] = [&targetScene](float px, float py, float pz, float r, float g, float b, sol::optional<float> range)
+		{
+			targetScene.lights.push_back({ {px,py,pz},{r,g,b}, range.value_or(0.0f) });
+		};
+		// values is px,py,pz,r,g,b,range per light, every value required
+		scene["addLights"] = [&targetScene](sol::object values)
 		{
-			targetScene.lights.push_back({ {px,py,pz},{r,g,b} });
+			std::vector<float> floats;
+			const size_t count = ReadScriptFloats(values, 7, floats, "addLights");
+			targetScene.lights.reserve(targetScene.lights.size() + count);
+			for (size_t i = 0; i < count; ++i)
+			{
+				const float* v = &floats[i * 7];
+				targetScene.lights.push_back({ { v[0], v[1], v[2] }, { v[3], v[4], v[5] }, v[6] });
+			}
 		};
 		scene["setSkyColour"] = [&targetScene](float r, float g, float b)
 		{
 			targetScene.skyColour = glm::vec3(r, g, b);
 		};
+		// vertices is a flat array of triangle vertex positions (x0,y0,z0, x1,y1,z1, ...), returns a mesh id for addInstance
+		scene["addInstancedMesh"] = [&targetScene](sol::object vertices, bool reflect) -> int
+		{
+			Mesh mesh;
+			mesh.m_material = reflect ? Material{ 0.001f, ReflectRefract } : Material{ 1.0f, Diffuse };
+			std::vector<float> floats;
+			const size_t count = ReadScriptFloats(vertices, 9, floats, "addInstancedMesh");
+			mesh.m_triangles.reserve(count);
+			for (size_t i = 0; i < count; ++i)
+			{
+				const float* v = &floats[i * 9];
+				mesh.m_triangles.push_back(Geometry::PrecomputeTriangle({ v[0], v[1], v[2] }, { v[3], v[4], v[5] }, { v[6], v[7], v[8] }));
+			}
+			return static_cast<int>(AddInstancedMesh(targetScene, mesh));
+		};
+		// As addInstancedMesh from an .obj file, returns -1 if it could not be loaded
+		scene["loadInstancedMesh"] = [&targetScene](const char* objPath, bool reflect) -> int
+		{
+			Mesh mesh;
+			mesh.m_material = reflect ? Material{ 0.001f, ReflectRefract } : Material{ 1.0f, Diffuse };
+			if (!ObjLoader::LoadMesh(objPath, mesh))
+			{
+				return -1;
+			}
+			return static_cast<int>(AddInstancedMesh(targetScene, mesh));
+		};
+		auto instanceTransform = [](const glm::vec3& position, const glm::vec3& rotation, float scale)
+		{
+			glm::mat4 transform = glm::translate(glm::mat4(1.0f), position);
+			transform = glm::rotate(transform, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+			transform = glm::rotate(transform, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
+			transform = glm::rotate(transform, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
+			return glm::scale(transform, glm::vec3(scale));
+		};
+		// Rotation is in degrees around x, y + z, then a uniform scale. Meshes that do not exist (e.g. -1 from loadInstancedMesh) are logged + skipped
+		scene["addInstance"] = [&targetScene, instanceTransform](int mesh, float px, float py, float pz, sol::optional<float> rx, sol::optional<float> ry, sol::optional<float> rz, sol::optional<float> scale)
+		{
+			if (mesh < 0 || static_cast<size_t>(mesh) >= targetScene.instancedMeshes.size())
+			{
+				SDE_LOG("addInstance: no instanced mesh %d, instance skipped", mesh);
+				return;
+			}
+			const glm::vec3 rotation(rx.value_or(0.0f), ry.value_or(0.0f), rz.value_or(0.0f));
+			targetScene.meshInstances.push_back({ static_cast<uint32_t>(mesh), instanceTransform({ px, py, pz }, rotation, scale.value_or(1.0f)) });
+		};
+		// values is px,py,pz,rx,ry,rz,scale per instance, every value required
+		scene["addInstances"] = [&targetScene, instanceTransform](int mesh, sol::object values)
+		{
+			if (mesh < 0 || static_cast<size_t>(mesh) >= targetScene.instancedMeshes.size())
+			{
+				SDE_LOG("addInstances: no instanced mesh %d, instances skipped", mesh);
+				return;
+			}
+			std::vector<float> floats;
+			const size_t count = ReadScriptFloats(values, 7, floats, "addInstances");
+			targetScene.meshInstances.reserve(targetScene.meshInstances.size() + count);
+			for (size_t i = 0; i < count; ++i)
+			{
+				const float* v = &floats[i * 7];
+				targetScene.meshInstances.push_back({ static_cast<uint32_t>(mesh), instanceTransform({ v[0], v[1], v[2] }, { v[3], v[4], v[5] }, v[6]) });
+			}
+		};
+		// Returns a model id for fillVoxels + addVoxelVolume
+		scene["addVoxelModel"] = [&targetScene](float voxelSize) -> int
+		{
+			auto model = std::make_shared<VoxelModel>();
+			model->SetVoxelSize(glm::vec3(voxelSize));
+			targetScene.voxelModels.push_back(model);
+			return static_cast<int>(targetScene.voxelModels.size() - 1);
+		};
+		// Fills the box between 2 voxel coords (inclusive), pass solid = false to clear it instead
+		scene["fillVoxels"] = [&targetScene](int model, int x0, int y0, int z0, int x1, int y1, int z1, sol::optional<bool> solid)
+		{
+			if (model >= 0 && static_cast<size_t>(model) < targetScene.voxelModels.size())
+			{
+				Geometry::FillVoxels(*targetScene.voxelModels[model], { x0, y0, z0 }, { x1, y1, z1 }, solid.value_or(true) ? 1 : 0);
+			}
+		};
+		// Places a model like addSphere, models that do not exist are logged + skipped
+		scene["addVoxelVolume"] = [&targetScene](int model, float px, float py, float pz, bool reflect)
+		{
+			if (model < 0 || static_cast<size_t>(model) >= targetScene.voxelModels.size())
+			{
+				SDE_LOG("addVoxelVolume: no voxel model %d, volume skipped", model);
+				return;
+			}
+			Material m = reflect ? Material{ 0.001f, ReflectRefract } : Material{ 1.0f, Diffuse };
+			targetScene.voxelVolumes.push_back({ static_cast<uint32_t>(model), { px, py, pz }, m });
+		};
 	}
 }
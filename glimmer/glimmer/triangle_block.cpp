@@ -0,0 +1,39 @@
+#include "triangle_block.h"
+#include "simd.h"
+#include "kernel/assert.h"
+
+namespace Geometry
+{
+	void TriangleBlock::Add(const PrecomputedTriangle& tri)
+	{
+		SDE_ASSERT(m_count < Width);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			m_v0[axis][m_count] = tri.m_v0[axis];
+			m_v1[axis][m_count] = tri.m_v1[axis];
+			m_v2[axis][m_count] = tri.m_v2[axis];
+			m_normal[axis][m_count] = tri.m_normal[axis];
+		}
+		++m_count;
+	}
+
+	PrecomputedTriangle TriangleBlock::Get(int lane) const
+	{
+		return {
+			{ m_v0[0][lane], m_v0[1][lane], m_v0[2][lane] },
+			{ m_v1[0][lane], m_v1[1][lane], m_v1[2][lane] },
+			{ m_v2[0][lane], m_v2[1][lane], m_v2[2][lane] },
+			{ m_normal[0][lane], m_normal[1][lane], m_normal[2][lane] }
+		};
+	}
+
+	bool RayTriangleBlockHit(const Ray& ray, const TriangleBlock& block, float& closestT, int& hitLane)
+	{
+		return Simd::HasAvx() ? RayTriangleBlockHit<Simd::Float8>(ray, block, closestT, hitLane) : RayTriangleBlockHit<Simd::Float4>(ray, block, closestT, hitLane);
+	}
+
+	bool RayTriangleBlockOccluded(const Ray& ray, const TriangleBlock& block, float maxT)
+	{
+		return Simd::HasAvx() ? RayTriangleBlockOccluded<Simd::Float8>(ray, block, maxT) : RayTriangleBlockOccluded<Simd::Float4>(ray, block, maxT);
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "ray_packet.h"
+#include "primitive_block.h"
+
+// Small batches of triangles stored as structure-of-arrays, so one ray can be tested against all of them at once
+// The bvh packs the triangles in each leaf into blocks
+namespace Geometry
+{
+	struct TriangleBlock
+	{
+		static const int Width = 8;
+
+		void Add(const PrecomputedTriangle& tri);
+		PrecomputedTriangle Get(int lane) const;
+
+		// [axis][lane], lanes past m_count are zero, which every kernel treats as a miss
+		float m_v0[3][Width] = {};
+		float m_v1[3][Width] = {};
+		float m_v2[3][Width] = {};
+		float m_normal[3][Width] = {};
+		int m_count = 0;
+	};
+
+	// Tests one ray against FloatType::Width triangles from the block, starting at firstLane
+	// Returns a lane mask of hits, with t written for those lanes only
+	template<class FloatType>
+	FloatType RayTriangleBlockIntersect(const Ray& ray, const TriangleBlock& block, int firstLane, FloatType& t);
+
+	// Finds the closest triangle in the block that is nearer than closestT
+	// The non-template version picks AVX if the cpu has it, traversal picks the width once per ray instead
+	template<class FloatType>
+	bool RayTriangleBlockHit(const Ray& ray, const TriangleBlock& block, float& closestT, int& hitLane);
+	bool RayTriangleBlockHit(const Ray& ray, const TriangleBlock& block, float& closestT, int& hitLane);
+
+	// Returns true if any triangle in the block is nearer than maxT
+	template<class FloatType>
+	bool RayTriangleBlockOccluded(const Ray& ray, const TriangleBlock& block, float maxT);
+	bool RayTriangleBlockOccluded(const Ray& ray, const TriangleBlock& block, float maxT);
+}
+
+#include "triangle_block.inl"
@@ -0,0 +1,25 @@
+namespace Geometry
+{
+	template<class FloatType>
+	FloatType RayTriangleBlockIntersect(const Ray& ray, const TriangleBlock& block, int firstLane, FloatType& t)
+	{
+		typedef PacketVec3<FloatType> Vec3;
+		auto load = [&block, firstLane](const float(&lanes)[3][TriangleBlock::Width]) -> Vec3
+		{
+			return { FloatType::Load(&lanes[0][firstLane]), FloatType::Load(&lanes[1][firstLane]), FloatType::Load(&lanes[2][firstLane]) };
+		};
+		return PluckerIntersect(Vec3::Broadcast(ray.m_origin), Vec3::Broadcast(ray.m_direction), load(block.m_v0), load(block.m_v1), load(block.m_v2), load(block.m_normal), t);
+	}
+
+	template<class FloatType>
+	inline bool RayTriangleBlockHit(const Ray& ray, const TriangleBlock& block, float& closestT, int& hitLane)
+	{
+		return RayBlockHit<FloatType, TriangleBlock, RayTriangleBlockIntersect<FloatType>>(ray, block, closestT, hitLane);
+	}
+
+	template<class FloatType>
+	inline bool RayTriangleBlockOccluded(const Ray& ray, const TriangleBlock& block, float maxT)
+	{
+		return RayBlockOccluded<FloatType, TriangleBlock, RayTriangleBlockIntersect<FloatType>>(ray, block, maxT);
+	}
+}
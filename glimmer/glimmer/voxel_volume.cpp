@@ -0,0 +1,199 @@
+#include "voxel_volume.h"
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+
+namespace
+{
+	const int c_blockVoxels = VoxelModel::BlockType::VoxelDimensions;
+	const float c_minHitT = 0.001f;		// Same as planes. Shadow rays start right on the surface they leave, crossing it again is not a hit
+
+	// Block containing a voxel, rounding down for negative coords
+	inline glm::ivec3 BlockOfVoxel(const glm::ivec3& voxel)
+	{
+		return glm::ivec3(glm::floor(glm::vec3(voxel) / (float)c_blockVoxels));
+	}
+
+	// One level of a 3D-DDA (Amanatides + Woo) over cells of cellSize, starting from the cell the ray is in at tStart
+	// Distances are all along the original ray, so the block + voxel walks agree on where the ray is
+	struct GridWalk
+	{
+		GridWalk(const Geometry::Ray& ray, const glm::vec3& invDirection, const glm::vec3& gridOrigin, const glm::vec3& cellSize,
+			float tStart, const glm::ivec3& minCell, const glm::ivec3& maxCell)
+		{
+			const glm::vec3 start = (ray.m_origin + ray.m_direction * tStart - gridOrigin) / cellSize;
+			m_cell = glm::clamp(glm::ivec3(glm::floor(start)), minCell, maxCell);	// tStart is on a cell boundary, so it can round either way
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				m_step[axis] = ray.m_direction[axis] < 0.0f ? -1 : 1;
+				if (ray.m_direction[axis] == 0.0f)
+				{
+					m_tNext[axis] = FLT_MAX;
+					m_tDelta[axis] = FLT_MAX;
+					continue;
+				}
+				const float boundary = gridOrigin[axis] + (m_cell[axis] + (m_step[axis] > 0 ? 1 : 0)) * cellSize[axis];
+				m_tNext[axis] = (boundary - ray.m_origin[axis]) * invDirection[axis];
+				m_tDelta[axis] = cellSize[axis] * fabsf(invDirection[axis]);
+			}
+		}
+
+		// Moves to the next cell, returns the distance where the ray enters it + the axis it crossed
+		inline float Step(int& axis)
+		{
+			axis = m_tNext.x < m_tNext.y ? (m_tNext.x < m_tNext.z ? 0 : 2) : (m_tNext.y < m_tNext.z ? 1 : 2);
+			const float tEnter = m_tNext[axis];
+			m_cell[axis] += m_step[axis];
+			m_tNext[axis] += m_tDelta[axis];
+			return tEnter;
+		}
+
+		glm::ivec3 m_cell;
+		glm::ivec3 m_step;
+		glm::vec3 m_tNext;		// distance to the next boundary on each axis
+		glm::vec3 m_tDelta;		// distance between boundaries on each axis
+	};
+}
+
+void* VoxelBlockAllocator::AllocateBlock(size_t bytes)
+{
+	return calloc(1, bytes);
+}
+
+void VoxelBlockAllocator::FreeBlock(void* block)
+{
+	free(block);
+}
+
+namespace Geometry
+{
+	void FillVoxels(VoxelModel& model, const glm::ivec3& minVoxel, const glm::ivec3& maxVoxel, uint8_t value)
+	{
+		const glm::ivec3 firstBlock = BlockOfVoxel(minVoxel);
+		const glm::ivec3 lastBlock = BlockOfVoxel(maxVoxel);
+		for (int bz = firstBlock.z; bz <= lastBlock.z; ++bz)
+		{
+			for (int by = firstBlock.y; by <= lastBlock.y; ++by)
+			{
+				for (int bx = firstBlock.x; bx <= lastBlock.x; ++bx)
+				{
+					const glm::ivec3 blockIndex(bx, by, bz);
+					VoxelModel::BlockType* block = model.BlockAt(blockIndex, value != 0);
+					if (block == nullptr)
+					{
+						continue;
+					}
+					const glm::ivec3 blockOrigin = blockIndex * c_blockVoxels;
+					const glm::ivec3 start = glm::max(minVoxel - blockOrigin, glm::ivec3(0));
+					const glm::ivec3 end = glm::min(maxVoxel - blockOrigin, glm::ivec3(c_blockVoxels - 1));
+					for (int z = start.z; z <= end.z; ++z)
+					{
+						for (int y = start.y; y <= end.y; ++y)
+						{
+							for (int x = start.x; x <= end.x; ++x)
+							{
+								block->VoxelAt(x, y, z) = value;
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	bool RayVoxelModelHit(const Ray& ray, const VoxelModel& model, const glm::vec3& position, float maxT, float& t, int& face, uint64_t& voxelTests)
+	{
+		const Math::Box3& bounds = model.GetTotalBounds();
+		if (glm::any(glm::greaterThan(bounds.Min(), bounds.Max())))
+		{
+			return false;	// no blocks
+		}
+
+		// Walk in model space, distances are the same as in world space
+		const Ray local = { ray.m_origin - position, ray.m_direction };
+		const glm::vec3 invDirection = 1.0f / ray.m_direction;
+		const glm::vec3 t0 = (bounds.Min() - local.m_origin) * invDirection;
+		const glm::vec3 t1 = (bounds.Max() - local.m_origin) * invDirection;
+		const glm::vec3 tMin = glm::min(t0, t1);
+		const glm::vec3 tMax = glm::max(t0, t1);
+		int axis = tMin.x > tMin.y ? (tMin.x > tMin.z ? 0 : 2) : (tMin.y > tMin.z ? 1 : 2);
+		const float tExit = glm::min(glm::min(tMax.x, tMax.y), glm::min(tMax.z, maxT));
+		float tBlock = glm::max(tMin[axis], 0.0f);
+		if (tBlock > tExit)
+		{
+			return false;
+		}
+
+		// The hit is the first crossing between empty + solid voxels, in either direction
+		// Crossings closer than c_minHitT only change which side the ray is on
+		const glm::vec3 voxelSize = model.GetVoxelSize();
+		bool inSolid = false;
+		auto crossing = [&](float tCross, int crossedAxis, int step, bool solid)
+		{
+			if (tCross < c_minHitT || crossedAxis == -1)
+			{
+				inSolid = solid;
+				return false;
+			}
+			// Entering solid voxels the normal faces back along the ray, leaving them it faces forwards
+			t = tCross;
+			face = crossedAxis * 2 + ((step > 0) == inSolid ? 1 : 0);
+			return true;
+		};
+
+		const glm::vec3 blockSize = model.GetBlockSize();
+		const glm::ivec3 firstBlock = glm::ivec3(glm::floor(bounds.Min() / blockSize + 0.5f));
+		const glm::ivec3 lastBlock = glm::ivec3(glm::floor(bounds.Max() / blockSize + 0.5f)) - 1;
+		GridWalk blocks(local, invDirection, glm::vec3(0.0f), blockSize, tBlock, firstBlock, lastBlock);
+		if (tMin[axis] < 0.0f)
+		{
+			axis = -1;	// starts inside, no face was crossed to get here
+		}
+		while (true)
+		{
+			const VoxelModel::BlockType* block = model.BlockAt(blocks.m_cell);
+			if (block == nullptr)
+			{
+				if (inSolid && crossing(tBlock, axis, axis == -1 ? 0 : blocks.m_step[axis], false))
+				{
+					return true;
+				}
+			}
+			else
+			{
+				GridWalk voxels(local, invDirection, glm::vec3(blocks.m_cell) * blockSize, voxelSize, tBlock, glm::ivec3(0), glm::ivec3(c_blockVoxels - 1));
+				float tVoxel = tBlock;
+				int voxelAxis = axis;
+				while (true)
+				{
+					++voxelTests;
+					const bool solid = block->VoxelAt(voxels.m_cell.x, voxels.m_cell.y, voxels.m_cell.z) != 0;
+					if (solid != inSolid && crossing(tVoxel, voxelAxis, voxelAxis == -1 ? 0 : voxels.m_step[voxelAxis], solid))
+					{
+						return true;
+					}
+					tVoxel = voxels.Step(voxelAxis);
+					if (tVoxel > maxT)
+					{
+						return false;
+					}
+					if (voxels.m_cell[voxelAxis] < 0 || voxels.m_cell[voxelAxis] >= c_blockVoxels)
+					{
+						break;
+					}
+				}
+			}
+
+			tBlock = blocks.Step(axis);
+			if (blocks.m_cell[axis] < firstBlock[axis] || blocks.m_cell[axis] > lastBlock[axis])
+			{
+				// Leaving the model, which is all empty outside
+				return inSolid && tBlock <= maxT && crossing(tBlock, axis, blocks.m_step[axis], false);
+			}
+			if (tBlock > maxT)
+			{
+				return false;
+			}
+		}
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "geometry.h"
+#include "vox/model.h"
+#include <stdint.h>
+
+// Voxel models are traced directly, without extracting triangles from them first
+// Each voxel is a byte, 0 is empty and anything else is solid. Only blocks that have been filled use any memory
+struct VoxelBlockAllocator
+{
+	static void* AllocateBlock(size_t bytes);	// zeroed, so new blocks start out empty
+	static void FreeBlock(void* block);
+};
+typedef Vox::Model<uint8_t, 16, VoxelBlockAllocator> VoxelModel;
+
+namespace Geometry
+{
+	// Sets every voxel from minVoxel to maxVoxel inclusive (model space voxel coords) to value
+	// Blocks are only created when value is solid, clearing never allocates
+	void FillVoxels(VoxelModel& model, const glm::ivec3& minVoxel, const glm::ivec3& maxVoxel, uint8_t value);
+
+	// Finds where the ray first crosses between empty + solid voxels closer than maxT, with the model's origin at position
+	// A DDA walks the blocks the ray passes through and skips empty ones whole, a second DDA walks the voxels inside occupied blocks
+	// Rays that start inside solid voxels hit where they leave them, like refraction rays inside a sphere
+	// Crossings closer than 0.001 are ignored like plane hits, so rays leaving a voxel surface do not hit it again
+	// face is the axis of the crossed face * 2, + 1 if its normal points along +axis, see VoxelFaceNormal
+	// voxelTests has the number of voxels visited added to it
+	bool RayVoxelModelHit(const Ray& ray, const VoxelModel& model, const glm::vec3& position, float maxT, float& t, int& face, uint64_t& voxelTests);
+
+	inline glm::vec3 VoxelFaceNormal(int face)
+	{
+		glm::vec3 normal(0.0f);
+		normal[face >> 1] = (face & 1) ? 1.0f : -1.0f;
+		return normal;
+	}
+}
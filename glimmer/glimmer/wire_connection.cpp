@@ -0,0 +1,80 @@
+#include "wire_connection.h"
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+namespace
+{
+	// Shared by both ends, each receives from its own queue + sends to the other
+	struct LoopbackPipe
+	{
+		std::mutex m_mutex;
+		std::condition_variable m_messageSent;
+		std::deque<std::vector<uint8_t>> m_queues[2];
+		bool m_closed = false;
+	};
+
+	class LoopbackConnection : public IWireConnection
+	{
+	public:
+		LoopbackConnection(std::shared_ptr<LoopbackPipe> pipe, int end)
+			: m_pipe(pipe)
+			, m_end(end)
+		{
+		}
+
+		virtual ~LoopbackConnection()
+		{
+			Close();
+		}
+
+		virtual bool Send(std::vector<uint8_t>&& message) override
+		{
+			std::lock_guard<std::mutex> lock(m_pipe->m_mutex);
+			if (m_pipe->m_closed)
+			{
+				return false;
+			}
+			m_pipe->m_queues[1 - m_end].push_back(std::move(message));
+			m_pipe->m_messageSent.notify_all();
+			return true;
+		}
+
+		virtual bool Receive(std::vector<uint8_t>& message) override
+		{
+			std::unique_lock<std::mutex> lock(m_pipe->m_mutex);
+			auto& queue = m_pipe->m_queues[m_end];
+			m_pipe->m_messageSent.wait(lock, [this, &queue]()
+			{
+				return m_pipe->m_closed || !queue.empty();
+			});
+			if (m_pipe->m_closed)
+			{
+				return false;
+			}
+			message = std::move(queue.front());
+			queue.pop_front();
+			return true;
+		}
+
+		virtual void Close() override
+		{
+			std::lock_guard<std::mutex> lock(m_pipe->m_mutex);
+			m_pipe->m_closed = true;
+			m_pipe->m_queues[0].clear();
+			m_pipe->m_queues[1].clear();
+			m_pipe->m_messageSent.notify_all();
+		}
+
+	private:
+		std::shared_ptr<LoopbackPipe> m_pipe;
+		int m_end;
+	};
+}
+
+void CreateLoopbackConnection(std::shared_ptr<IWireConnection>& a, std::shared_ptr<IWireConnection>& b)
+{
+	auto pipe = std::make_shared<LoopbackPipe>();
+	a = std::make_shared<LoopbackConnection>(pipe, 0);
+	b = std::make_shared<LoopbackConnection>(pipe, 1);
+}
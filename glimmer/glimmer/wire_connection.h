@@ -0,0 +1,24 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <stdint.h>
+
+// One end of a connection between a CpuRaytracer and a TileWorker, see WireFormat for what is sent over it
+// Messages arrive whole and in order, a stream transport (sockets, pipes) only has to add framing
+class IWireConnection
+{
+public:
+	virtual ~IWireConnection() = default;
+
+	// Can be called from any thread. Returns false if the connection is closed
+	virtual bool Send(std::vector<uint8_t>&& message) = 0;
+
+	// Blocks until a message arrives, returns false once the connection is closed
+	virtual bool Receive(std::vector<uint8_t>& message) = 0;
+
+	// Closes both ends, anything blocked in Receive on either end returns false
+	virtual void Close() = 0;
+};
+
+// Two connected ends in the same process, for testing TileWorkers on threads. glimmer_cli has a socket connection for worker processes
+void CreateLoopbackConnection(std::shared_ptr<IWireConnection>& a, std::shared_ptr<IWireConnection>& b);
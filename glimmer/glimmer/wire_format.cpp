@@ -0,0 +1,551 @@
+#include "wire_format.h"
+#include "bvh.h"
+#include "kernel/assert.h"
+#include "core/run_length_encoding.h"
+
+namespace
+{
+	const int c_blockVoxels = VoxelModel::BlockType::VoxelDimensions;
+	const uint32_t c_blockVoxelCount = c_blockVoxels * c_blockVoxels * c_blockVoxels;
+	const int c_maxTileSize = 1024;
+	const uint32_t c_maxImageSize = 32768;
+	const int c_maxRecursion = 64;
+	const int c_maxLightSamples = 1024;
+	const int c_maxAdaptiveSamples = 256;
+
+	void WriteMaterial(WireFormat::Writer& writer, const Material& material)
+	{
+		writer.Write(material.m_refractiveIndex);
+		writer.Write((uint8_t)material.m_type);
+	}
+
+	bool ReadMaterial(WireFormat::Reader& reader, Material& material)
+	{
+		uint8_t type = 0;
+		if (!reader.Read(material.m_refractiveIndex) || !reader.Read(type) || type > Diffuse)
+		{
+			return false;
+		}
+		material.m_type = static_cast<MaterialType>(type);
+		return true;
+	}
+
+	// Triangles are sent as their vertices, normals are recomputed when read
+	void WriteMesh(WireFormat::Writer& writer, const Mesh& mesh)
+	{
+		WriteMaterial(writer, mesh.m_material);
+		writer.Write((uint32_t)mesh.m_triangles.size());
+		for (const auto& tri : mesh.m_triangles)
+		{
+			writer.Write(tri.m_v0);
+			writer.Write(tri.m_v1);
+			writer.Write(tri.m_v2);
+		}
+	}
+
+	bool ReadMesh(WireFormat::Reader& reader, Mesh& mesh)
+	{
+		uint32_t triangleCount = 0;
+		if (!ReadMaterial(reader, mesh.m_material) || !reader.ReadCount(triangleCount, sizeof(glm::vec3) * 3))
+		{
+			return false;
+		}
+		mesh.m_triangles.resize(triangleCount);
+		for (auto& tri : mesh.m_triangles)
+		{
+			glm::vec3 v0, v1, v2;
+			if (!reader.Read(v0) || !reader.Read(v1) || !reader.Read(v2))
+			{
+				return false;
+			}
+			tri = Geometry::PrecomputeTriangle(v0, v1, v2);
+		}
+		return true;
+	}
+
+	// Only blocks that exist are sent, each run length encoded as most are large runs of empty or solid voxels
+	void WriteVoxelModel(WireFormat::Writer& writer, const VoxelModel& model)
+	{
+		writer.Write(model.GetVoxelSize());
+		std::vector<glm::ivec3> blockIndices;
+		const Math::Box3& bounds = model.GetTotalBounds();
+		if (glm::all(glm::lessThanEqual(bounds.Min(), bounds.Max())))
+		{
+			const glm::ivec3 firstBlock = glm::ivec3(glm::floor(bounds.Min() / model.GetBlockSize() + 0.5f));
+			const glm::ivec3 lastBlock = glm::ivec3(glm::floor(bounds.Max() / model.GetBlockSize() + 0.5f)) - 1;
+			for (int bz = firstBlock.z; bz <= lastBlock.z; ++bz)
+			{
+				for (int by = firstBlock.y; by <= lastBlock.y; ++by)
+				{
+					for (int bx = firstBlock.x; bx <= lastBlock.x; ++bx)
+					{
+						if (model.BlockAt({ bx, by, bz }) != nullptr)
+						{
+							blockIndices.push_back({ bx, by, bz });
+						}
+					}
+				}
+			}
+		}
+		writer.Write((uint32_t)blockIndices.size());
+		std::vector<uint8_t> voxels(c_blockVoxelCount);
+		std::vector<uint8_t> encoded;
+		for (const auto& blockIndex : blockIndices)
+		{
+			const VoxelModel::BlockType* block = model.BlockAt(blockIndex);
+			size_t voxel = 0;
+			for (int z = 0; z < c_blockVoxels; ++z)
+			{
+				for (int y = 0; y < c_blockVoxels; ++y)
+				{
+					for (int x = 0; x < c_blockVoxels; ++x)
+					{
+						voxels[voxel++] = block->VoxelAt(x, y, z);
+					}
+				}
+			}
+			encoded.clear();
+			Core::RunLengthEncoder encoder;
+			encoder.WriteData(voxels.data(), voxels.size(), encoded);
+			encoder.Flush(encoded);
+			writer.Write(blockIndex);
+			writer.Write((uint32_t)encoded.size());
+			writer.WriteBytes(encoded.data(), encoded.size());
+		}
+	}
+
+	bool ReadVoxelModel(WireFormat::Reader& reader, VoxelModel& model)
+	{
+		glm::vec3 voxelSize;
+		uint32_t blockCount = 0;
+		if (!reader.Read(voxelSize) || !reader.ReadCount(blockCount, sizeof(glm::ivec3) + sizeof(uint32_t)))
+		{
+			return false;
+		}
+		model.SetVoxelSize(voxelSize);
+		std::vector<uint8_t> encoded;
+		std::vector<uint8_t> voxels;
+		for (uint32_t b = 0; b < blockCount; ++b)
+		{
+			glm::ivec3 blockIndex;
+			uint32_t encodedSize = 0;
+			if (!reader.Read(blockIndex) || !reader.ReadCount(encodedSize, 1) || encodedSize < 4 || (encodedSize & 1) != 0)
+			{
+				return false;
+			}
+			encoded.resize(encodedSize);
+			reader.ReadBytes(encoded.data(), encodedSize);
+			voxels.clear();
+			Core::RunLengthDecoder().ReadData(encoded.data(), encoded.size(), voxels);
+			if (voxels.size() != c_blockVoxelCount)
+			{
+				return false;
+			}
+			VoxelModel::BlockType* block = model.BlockAt(blockIndex, true);
+			size_t voxel = 0;
+			for (int z = 0; z < c_blockVoxels; ++z)
+			{
+				for (int y = 0; y < c_blockVoxels; ++y)
+				{
+					for (int x = 0; x < c_blockVoxels; ++x)
+					{
+						block->VoxelAt(x, y, z) = voxels[voxel++];
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	void WriteTileJob(WireFormat::Writer& writer, const WireFormat::TileJob& tile)
+	{
+		writer.Write(tile.m_traceId);
+		writer.Write(tile.m_origin);
+		writer.Write(tile.m_size);
+	}
+
+	bool ReadTileJob(WireFormat::Reader& reader, WireFormat::TileJob& tile)
+	{
+		// Origin is bounded too, so origin + size cannot overflow when it is checked against the image
+		return reader.Read(tile.m_traceId) && reader.Read(tile.m_origin) && reader.Read(tile.m_size)
+			&& tile.m_origin.x >= 0 && tile.m_origin.y >= 0 && (uint32_t)tile.m_origin.x <= c_maxImageSize && (uint32_t)tile.m_origin.y <= c_maxImageSize
+			&& tile.m_size.x > 0 && tile.m_size.y > 0 && tile.m_size.x <= c_maxTileSize && tile.m_size.y <= c_maxTileSize;
+	}
+
+	// Field by field, so padding is not sent and new counters must be added here too
+	void WriteRayStats(WireFormat::Writer& writer, const RayStats& stats)
+	{
+		writer.Write(stats.m_primaryRays);
+		writer.Write(stats.m_secondaryRays);
+		writer.Write(stats.m_shadowRays);
+		writer.Write(stats.m_missedRays);
+		writer.Write(stats.m_boxTests);
+		writer.Write(stats.m_sphereTests);
+		writer.Write(stats.m_planeTests);
+		writer.Write(stats.m_triangleTests);
+		writer.Write(stats.m_voxelTests);
+	}
+
+	bool ReadRayStats(WireFormat::Reader& reader, RayStats& stats)
+	{
+		return reader.Read(stats.m_primaryRays) && reader.Read(stats.m_secondaryRays) && reader.Read(stats.m_shadowRays)
+			&& reader.Read(stats.m_missedRays) && reader.Read(stats.m_boxTests) && reader.Read(stats.m_sphereTests)
+			&& reader.Read(stats.m_planeTests) && reader.Read(stats.m_triangleTests) && reader.Read(stats.m_voxelTests);
+	}
+
+	WireFormat::Writer BeginMessage(std::vector<uint8_t>& message, WireFormat::MessageType type)
+	{
+		message.clear();
+		WireFormat::Writer writer(message);
+		writer.Write(type);
+		return writer;
+	}
+}
+
+namespace WireFormat
+{
+	bool CanWriteScene(const Scene& scene)
+	{
+		for (const auto& instance : scene.meshInstances)
+		{
+			if (instance.m_mesh >= scene.instancedMeshes.size())
+			{
+				return false;
+			}
+		}
+		for (const auto& volume : scene.voxelVolumes)
+		{
+			if (volume.m_model >= scene.voxelModels.size())
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void WriteScene(std::vector<uint8_t>& message, uint32_t sceneId, const Scene& scene)
+	{
+		Writer writer = BeginMessage(message, SceneMessage);
+		writer.Write(c_version);
+		writer.Write(sceneId);
+		writer.Write(scene.skyColour);
+		writer.Write((uint32_t)scene.spheres.size());
+		for (const auto& sphere : scene.spheres)
+		{
+			writer.Write(sphere.m_sphere.m_posAndRadius);
+			WriteMaterial(writer, sphere.m_material);
+		}
+		writer.Write((uint32_t)scene.planes.size());
+		for (const auto& plane : scene.planes)
+		{
+			writer.Write(plane.m_plane.m_normal);
+			writer.Write(plane.m_plane.m_point);
+			WriteMaterial(writer, plane.m_material);
+		}
+		writer.Write((uint32_t)scene.lights.size());
+		for (const auto& light : scene.lights)
+		{
+			writer.Write(light.m_position);
+			writer.Write(light.m_diffuse);
+			writer.Write(light.m_range);
+		}
+		writer.Write((uint32_t)scene.meshes.size());
+		for (const auto& mesh : scene.meshes)
+		{
+			WriteMesh(writer, mesh);
+		}
+		writer.Write((uint32_t)scene.instancedMeshes.size());
+		Mesh instancedMesh;
+		for (const auto& meshBvh : scene.instancedMeshes)
+		{
+			meshBvh->GetMesh(instancedMesh);
+			WriteMesh(writer, instancedMesh);
+		}
+		writer.Write((uint32_t)scene.meshInstances.size());
+		for (const auto& instance : scene.meshInstances)
+		{
+			writer.Write(instance.m_mesh);
+			writer.Write(instance.m_transform);
+		}
+		writer.Write((uint32_t)scene.voxelModels.size());
+		for (const auto& model : scene.voxelModels)
+		{
+			WriteVoxelModel(writer, *model);
+		}
+		writer.Write((uint32_t)scene.voxelVolumes.size());
+		for (const auto& volume : scene.voxelVolumes)
+		{
+			writer.Write(volume.m_model);
+			writer.Write(volume.m_position);
+			WriteMaterial(writer, volume.m_material);
+		}
+	}
+
+	bool ReadScene(Reader& reader, uint32_t& sceneId, Scene& scene)
+	{
+		uint32_t version = 0, count = 0;
+		if (!reader.Read(version) || version != c_version || !reader.Read(sceneId) || !reader.Read(scene.skyColour))
+		{
+			return false;
+		}
+		if (!reader.ReadCount(count, sizeof(glm::vec4)))
+		{
+			return false;
+		}
+		scene.spheres.resize(count);
+		for (auto& sphere : scene.spheres)
+		{
+			if (!reader.Read(sphere.m_sphere.m_posAndRadius) || !ReadMaterial(reader, sphere.m_material))
+			{
+				return false;
+			}
+		}
+		if (!reader.ReadCount(count, sizeof(glm::vec3) * 2))
+		{
+			return false;
+		}
+		scene.planes.resize(count);
+		for (auto& plane : scene.planes)
+		{
+			if (!reader.Read(plane.m_plane.m_normal) || !reader.Read(plane.m_plane.m_point) || !ReadMaterial(reader, plane.m_material))
+			{
+				return false;
+			}
+		}
+		if (!reader.ReadCount(count, sizeof(glm::vec3) * 2 + sizeof(float)))
+		{
+			return false;
+		}
+		scene.lights.resize(count);
+		for (auto& light : scene.lights)
+		{
+			if (!reader.Read(light.m_position) || !reader.Read(light.m_diffuse) || !reader.Read(light.m_range))
+			{
+				return false;
+			}
+		}
+		if (!reader.ReadCount(count, sizeof(uint32_t)))
+		{
+			return false;
+		}
+		scene.meshes.resize(count);
+		for (auto& mesh : scene.meshes)
+		{
+			if (!ReadMesh(reader, mesh))
+			{
+				return false;
+			}
+		}
+		if (!reader.ReadCount(count, sizeof(uint32_t)))
+		{
+			return false;
+		}
+		scene.instancedMeshes.clear();
+		Mesh instancedMesh;
+		for (uint32_t m = 0; m < count; ++m)
+		{
+			if (!ReadMesh(reader, instancedMesh))
+			{
+				return false;
+			}
+			TraceBoi::AddInstancedMesh(scene, instancedMesh);
+		}
+		if (!reader.ReadCount(count, sizeof(uint32_t) + sizeof(glm::mat4)))
+		{
+			return false;
+		}
+		scene.meshInstances.resize(count);
+		for (auto& instance : scene.meshInstances)
+		{
+			if (!reader.Read(instance.m_mesh) || instance.m_mesh >= scene.instancedMeshes.size() || !reader.Read(instance.m_transform))
+			{
+				return false;
+			}
+		}
+		if (!reader.ReadCount(count, sizeof(glm::vec3) + sizeof(uint32_t)))
+		{
+			return false;
+		}
+		scene.voxelModels.clear();
+		for (uint32_t m = 0; m < count; ++m)
+		{
+			auto model = std::make_shared<VoxelModel>();
+			if (!ReadVoxelModel(reader, *model))
+			{
+				return false;
+			}
+			scene.voxelModels.push_back(model);
+		}
+		if (!reader.ReadCount(count, sizeof(uint32_t) + sizeof(glm::vec3)))
+		{
+			return false;
+		}
+		scene.voxelVolumes.resize(count);
+		for (auto& volume : scene.voxelVolumes)
+		{
+			if (!reader.Read(volume.m_model) || volume.m_model >= scene.voxelModels.size() || !reader.Read(volume.m_position) || !ReadMaterial(reader, volume.m_material))
+			{
+				return false;
+			}
+		}
+		return reader.AtEnd();
+	}
+
+	void WriteTrace(std::vector<uint8_t>& message, const TraceSettings& settings)
+	{
+		Writer writer = BeginMessage(message, TraceMessage);
+		writer.Write(settings.m_traceId);
+		writer.Write(settings.m_sceneId);
+		writer.Write(settings.m_cameraPosition);
+		writer.Write(settings.m_cameraTarget);
+		writer.Write(settings.m_cameraUp);
+		writer.Write(settings.m_fov);
+		writer.Write(settings.m_imageDimensions);
+		writer.Write(settings.m_maxRecursion);
+		writer.Write(settings.m_sampleOffset);
+		writer.Write(settings.m_sampleCount);
+		writer.Write(settings.m_lightCutoff);
+		writer.Write(settings.m_lightSamples);
+		writer.Write((int32_t)settings.m_adaptive.m_maxSamples);
+		writer.Write(settings.m_adaptive.m_contrastThreshold);
+		writer.Write(settings.m_adaptive.m_budget);
+		const uint8_t flags = (settings.m_primaryRayPackets ? 1 : 0) | (settings.m_wavefront ? 2 : 0) | (settings.m_features ? 4 : 0)
+			| (settings.m_adaptive.m_probeTileBorders ? 8 : 0);
+		writer.Write(flags);
+	}
+
+	bool ReadTrace(Reader& reader, TraceSettings& settings)
+	{
+		uint8_t flags = 0;
+		if (!reader.Read(settings.m_traceId) || !reader.Read(settings.m_sceneId) || !reader.Read(settings.m_cameraPosition)
+			|| !reader.Read(settings.m_cameraTarget) || !reader.Read(settings.m_cameraUp) || !reader.Read(settings.m_fov)
+			|| !reader.Read(settings.m_imageDimensions) || !reader.Read(settings.m_maxRecursion) || !reader.Read(settings.m_sampleOffset)
+			|| !reader.Read(settings.m_sampleCount) || !reader.Read(settings.m_lightCutoff) || !reader.Read(settings.m_lightSamples)
+			|| !reader.Read(settings.m_adaptive.m_maxSamples) || !reader.Read(settings.m_adaptive.m_contrastThreshold) || !reader.Read(settings.m_adaptive.m_budget)
+			|| !reader.Read(flags))
+		{
+			return false;
+		}
+		settings.m_primaryRayPackets = (flags & 1) != 0;
+		settings.m_wavefront = (flags & 2) != 0;
+		settings.m_features = (flags & 4) != 0;
+		settings.m_adaptive.m_probeTileBorders = (flags & 8) != 0;
+		// Anything a worker would size buffers or loops from is bounded, comparisons are written so NaNs fail them
+		const glm::ivec2 dims = settings.m_imageDimensions;
+		const AdaptiveSampling& adaptive = settings.m_adaptive;
+		return dims.x > 0 && dims.y > 0 && (uint32_t)dims.x <= c_maxImageSize && (uint32_t)dims.y <= c_maxImageSize
+			&& settings.m_maxRecursion >= 0 && settings.m_maxRecursion <= c_maxRecursion && settings.m_sampleCount > 0
+			&& settings.m_lightSamples >= 0 && settings.m_lightSamples <= c_maxLightSamples
+			&& adaptive.m_maxSamples > 0 && adaptive.m_maxSamples <= c_maxAdaptiveSamples && adaptive.m_contrastThreshold >= 0.0f
+			&& adaptive.m_budget >= 0.0f && adaptive.m_budget <= (float)c_maxAdaptiveSamples && reader.AtEnd();
+	}
+
+	void WriteTile(std::vector<uint8_t>& message, const TileJob& tile)
+	{
+		Writer writer = BeginMessage(message, TileMessage);
+		WriteTileJob(writer, tile);
+	}
+
+	bool ReadTile(Reader& reader, TileJob& tile)
+	{
+		return ReadTileJob(reader, tile) && reader.AtEnd();
+	}
+
+	void WriteEndTrace(std::vector<uint8_t>& message, uint32_t traceId)
+	{
+		Writer writer = BeginMessage(message, EndTraceMessage);
+		writer.Write(traceId);
+	}
+
+	bool ReadEndTrace(Reader& reader, uint32_t& traceId)
+	{
+		return reader.Read(traceId) && reader.AtEnd();
+	}
+
+	void WritePull(std::vector<uint8_t>& message, uint32_t tileCount)
+	{
+		Writer writer = BeginMessage(message, PullMessage);
+		writer.Write(tileCount);
+	}
+
+	bool ReadPull(Reader& reader, uint32_t& tileCount)
+	{
+		return reader.Read(tileCount) && reader.AtEnd();
+	}
+
+	void WriteTileResult(std::vector<uint8_t>& message, const TileResult& result)
+	{
+		const size_t pixelCount = result.m_tile.m_size.x * result.m_tile.m_size.y;
+		SDE_ASSERT(result.m_colour.size() == pixelCount);
+		const bool hasFeatures = result.m_features.m_normalDepth.size() == pixelCount;
+		message.reserve(1 + 64 + pixelCount * (sizeof(glm::vec3) + (hasFeatures ? sizeof(glm::vec4) + 1 : 0)));
+		Writer writer = BeginMessage(message, TileResultMessage);
+		WriteTileJob(writer, result.m_tile);
+		writer.Write(result.m_traceTime);
+		WriteRayStats(writer, result.m_rayStats);
+		for (const auto& colour : result.m_colour)
+		{
+			writer.Write(glm::vec3(colour));
+		}
+		writer.Write((uint8_t)(hasFeatures ? 1 : 0));
+		if (hasFeatures)
+		{
+			writer.WriteBytes(result.m_features.m_normalDepth.data(), pixelCount * sizeof(glm::vec4));
+			for (float material : result.m_features.m_material)
+			{
+				writer.Write((uint8_t)(material > 0.5f ? 1 : 0));
+			}
+		}
+	}
+
+	bool ReadTileResult(Reader& reader, TileResult& result)
+	{
+		if (!ReadTileJob(reader, result.m_tile) || !reader.Read(result.m_traceTime) || !ReadRayStats(reader, result.m_rayStats))
+		{
+			return false;
+		}
+		const size_t pixelCount = result.m_tile.m_size.x * result.m_tile.m_size.y;
+		result.m_colour.resize(pixelCount);
+		for (auto& colour : result.m_colour)
+		{
+			glm::vec3 rgb;
+			if (!reader.Read(rgb))
+			{
+				return false;
+			}
+			colour = glm::vec4(rgb, 1.0f);
+		}
+		uint8_t hasFeatures = 0;
+		if (!reader.Read(hasFeatures))
+		{
+			return false;
+		}
+		if (hasFeatures == 0)
+		{
+			result.m_features.m_normalDepth.clear();
+			result.m_features.m_material.clear();
+			return reader.AtEnd();
+		}
+		result.m_features.m_normalDepth.resize(pixelCount);
+		result.m_features.m_material.resize(pixelCount);
+		if (!reader.ReadBytes(result.m_features.m_normalDepth.data(), pixelCount * sizeof(glm::vec4)))
+		{
+			return false;
+		}
+		for (auto& material : result.m_features.m_material)
+		{
+			uint8_t reflect = 0;
+			if (!reader.Read(reflect))
+			{
+				return false;
+			}
+			material = reflect != 0 ? 1.0f : 0.0f;
+		}
+		return reader.AtEnd();
+	}
+
+	bool ReadMessageType(Reader& reader, MessageType& type)
+	{
+		return reader.Read(type) && type <= TileResultMessage;
+	}
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include "traceboi.h"
+#include <vector>
+#include <string.h>
+#include <stdint.h>
+
+// Binary messages between a CpuRaytracer (the coordinator) and the TileWorkers tracing tiles for it
+// The coordinator sends each scene snapshot once, then the settings for each trace. Workers pull tiles and stream back one sample of each
+// Values are written as raw bytes, so both ends must have the same endianness. Workers reject scenes with a different c_version
+namespace WireFormat
+{
+	const uint32_t c_version = 2;
+
+	enum MessageType : uint8_t
+	{
+		SceneMessage,		// coordinator -> worker: scene id + Scene, replaces the worker's scene
+		TraceMessage,		// coordinator -> worker: TraceSettings for the next trace of the last scene sent
+		TileMessage,		// coordinator -> worker: TileJob, only sent in answer to pulls
+		EndTraceMessage,	// coordinator -> worker: trace id, no more tiles will be sent. Echoed back once every tile pulled has been returned
+		PullMessage,		// worker -> coordinator: number of tiles the worker wants
+		TileResultMessage	// worker -> coordinator: TileResult, also pulls one more tile
+	};
+
+	// Everything about a trace that is not in the scene
+	struct TraceSettings
+	{
+		uint32_t m_traceId = 0;
+		uint32_t m_sceneId = 0;
+		glm::vec3 m_cameraPosition = glm::vec3(0.0f);
+		glm::vec3 m_cameraTarget = glm::vec3(0.0f, 0.0f, 1.0f);
+		glm::vec3 m_cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
+		float m_fov = 60.0f;
+		glm::ivec2 m_imageDimensions = glm::ivec2(0);
+		int32_t m_maxRecursion = 0;
+		glm::vec2 m_sampleOffset = glm::vec2(0.5f);
+		int32_t m_sampleCount = 1;		// Workers do not blend samples, this only picks the same light samples as a local trace
+		float m_lightCutoff = 0.0f;
+		int32_t m_lightSamples = 0;
+		bool m_primaryRayPackets = true;
+		bool m_wavefront = false;
+		bool m_features = false;		// Results include primary hit features
+		AdaptiveSampling m_adaptive;
+	};
+
+	struct TileJob
+	{
+		uint32_t m_traceId = 0;
+		glm::ivec2 m_origin = glm::ivec2(0);
+		glm::ivec2 m_size = glm::ivec2(0);
+	};
+
+	// One sample of a tile, as traced by TraceBoi with tileOutput set + blendSamples cleared
+	// Colour is sent as rgb, and the material feature as a byte as it is always 0 or 1 before blending
+	struct TileResult
+	{
+		TileJob m_tile;
+		double m_traceTime = 0.0;		// Seconds the worker spent tracing it
+		RayStats m_rayStats;
+		std::vector<glm::vec4> m_colour;
+		FeatureBuffers m_features;		// Empty unless TraceSettings::m_features was set
+	};
+
+	// Appends plain values (ints, floats, glm vectors + matrices) to a message
+	class Writer
+	{
+	public:
+		explicit Writer(std::vector<uint8_t>& message) : m_message(message) {}
+		template<class T>
+		inline void Write(const T& value)	{ WriteBytes(&value, sizeof(value)); }
+		inline void WriteBytes(const void* data, size_t size)
+		{
+			const uint8_t* bytes = static_cast<const uint8_t*>(data);
+			m_message.insert(m_message.end(), bytes, bytes + size);
+		}
+	private:
+		std::vector<uint8_t>& m_message;
+	};
+
+	// Reads values back in the order they were written. Reading past the end fails instead of overrunning
+	class Reader
+	{
+	public:
+		Reader(const std::vector<uint8_t>& message) : m_data(message.data()), m_size(message.size()) {}
+		template<class T>
+		inline bool Read(T& value)	{ return ReadBytes(&value, sizeof(value)); }
+		inline bool ReadBytes(void* data, size_t size)
+		{
+			if (size > m_size - m_offset)
+			{
+				return false;
+			}
+			memcpy(data, m_data + m_offset, size);
+			m_offset += size;
+			return true;
+		}
+		// Counts are checked against what is left, so a bad count fails here instead of allocating something huge
+		inline bool ReadCount(uint32_t& count, size_t minBytesEach)
+		{
+			return Read(count) && (uint64_t)count * minBytesEach <= m_size - m_offset;
+		}
+		inline bool AtEnd() const	{ return m_offset == m_size; }
+	private:
+		const uint8_t* m_data;
+		size_t m_size;
+		size_t m_offset = 0;
+	};
+
+	// Each message is a MessageType followed by its body, the writers start a new message
+	void WriteScene(std::vector<uint8_t>& message, uint32_t sceneId, const Scene& scene);
+	void WriteTrace(std::vector<uint8_t>& message, const TraceSettings& settings);
+	void WriteTile(std::vector<uint8_t>& message, const TileJob& tile);
+	void WriteEndTrace(std::vector<uint8_t>& message, uint32_t traceId);
+	void WritePull(std::vector<uint8_t>& message, uint32_t tileCount);
+	void WriteTileResult(std::vector<uint8_t>& message, const TileResult& result);
+
+	// False if ReadScene would reject the scene, for instances of meshes or volumes of voxel models that do not exist
+	bool CanWriteScene(const Scene& scene);
+
+	// Read the body after ReadMessageType. All return false if the message is truncated or has bad values
+	bool ReadMessageType(Reader& reader, MessageType& type);
+	bool ReadScene(Reader& reader, uint32_t& sceneId, Scene& scene);	// Instanced mesh bvhs are rebuilt, voxel models are new copies
+	bool ReadTrace(Reader& reader, TraceSettings& settings);
+	bool ReadTile(Reader& reader, TileJob& tile);
+	bool ReadEndTrace(Reader& reader, uint32_t& traceId);
+	bool ReadPull(Reader& reader, uint32_t& tileCount);
+	bool ReadTileResult(Reader& reader, TileResult& result);
+}
@@ -0,0 +1,131 @@
+#include "kernel_benchmarks.h"
+#include "geometry.h"
+#include "triangle_block.h"
+#include "core/timer.h"
+#include "kernel/log.h"
+#include <random>
+#include <float.h>
+
+namespace Benchmarks
+{
+	namespace
+	{
+		const int c_rayCount = 4096;
+		const float c_originDistance = 50.0f;
+
+		// Rays from random points around target, passing at a distance of missDistance from it
+		// upperHemisphere keeps origins above the xz plane (for planes + triangles that lie in it)
+		std::vector<Geometry::Ray> MakeRays(std::mt19937& rng, glm::vec3 target, float minMissDistance, float maxMissDistance, bool upperHemisphere)
+		{
+			std::uniform_real_distribution<float> unitRange(-1.0f, 1.0f);
+			std::uniform_real_distribution<float> missRange(minMissDistance, maxMissDistance);
+			std::vector<Geometry::Ray> rays;
+			rays.reserve(c_rayCount);
+			while (rays.size() < c_rayCount)
+			{
+				glm::vec3 toOrigin(unitRange(rng), unitRange(rng), unitRange(rng));
+				float length = glm::length(toOrigin);
+				if (length < 0.01f || length > 1.0f || (upperHemisphere && toOrigin.y / length < 0.5f))
+				{
+					continue;	// outside the unit sphere or too shallow, try again
+				}
+				glm::vec3 origin = target + (toOrigin / length) * c_originDistance;
+				glm::vec3 toTarget = glm::normalize(target - origin);
+				glm::vec3 side = glm::normalize(glm::cross(toTarget, glm::vec3(unitRange(rng), unitRange(rng), unitRange(rng)) + glm::vec3(0.001f)));
+				glm::vec3 aimPoint = target + side * missRange(rng);
+				rays.push_back({ origin, glm::normalize(aimPoint - origin) });
+			}
+			return rays;
+		}
+
+		// Adapts the block kernel to TimeKernel, each test is one ray against every triangle in the block
+		bool RayTriangleBlockIntersect(const Geometry::Ray& ray, const Geometry::TriangleBlock& block, float& t)
+		{
+			int hitLane = 0;
+			t = FLT_MAX;
+			return Geometry::RayTriangleBlockHit(ray, block, t, hitLane);
+		}
+
+		template<class Primitive>
+		nlohmann::json TimeKernel(const char* kernelName, const char* caseName, const Primitive& primitive, const std::vector<Geometry::Ray>& rays, int iterations,
+			bool(*intersect)(const Geometry::Ray&, const Primitive&, float&))
+		{
+			uint64_t hitCount = 0;
+			double tSum = 0.0;	// Stops the compiler throwing the work away
+			double elapsed = 0.0;
+			{
+				Core::ScopedTimer timer(elapsed);
+				for (int i = 0; i < iterations; ++i)
+				{
+					for (const auto& ray : rays)
+					{
+						float t = 0.0f;
+						if (intersect(ray, primitive, t))
+						{
+							++hitCount;
+							tSum += t;
+						}
+					}
+				}
+			}
+			const double testCount = (double)iterations * rays.size();
+			const double nsPerTest = (elapsed * 1000000000.0) / testCount;
+			SDE_LOG("%s (%s): %fns per test, %.1f%% hit", kernelName, caseName, nsPerTest, (hitCount * 100.0) / testCount);
+			return {
+				{ "kernel", kernelName },
+				{ "case", caseName },
+				{ "tests", testCount },
+				{ "hit_rate", hitCount / testCount },
+				{ "seconds", elapsed },
+				{ "ns_per_test", nsPerTest },
+				{ "checksum", tSum }
+			};
+		}
+	}
+
+	nlohmann::json RunKernelBenchmarks(int iterations)
+	{
+		std::mt19937 rng(1234);		// Fixed seed so every run tests the same rays
+		nlohmann::json results = nlohmann::json::array();
+
+		const Geometry::Sphere sphere = { glm::vec4(0.0f, 0.0f, 0.0f, 5.0f) };
+		auto sphereHits = MakeRays(rng, glm::vec3(0.0f), 0.0f, 4.0f, false);
+		auto sphereMisses = MakeRays(rng, glm::vec3(0.0f), 6.0f, 20.0f, false);
+		results.push_back(TimeKernel("RaySphereIntersect", "hit", sphere, sphereHits, iterations, &Geometry::RaySphereIntersect));
+		results.push_back(TimeKernel("RaySphereIntersect", "miss", sphere, sphereMisses, iterations, &Geometry::RaySphereIntersect));
+
+		// Plane misses point away from the plane, there is no other way to miss
+		const Geometry::Plane plane = { { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 0.0f } };
+		auto planeHits = MakeRays(rng, glm::vec3(0.0f), 0.0f, 20.0f, true);
+		auto planeMisses = planeHits;
+		for (auto& ray : planeMisses)
+		{
+			ray.m_direction.y = -ray.m_direction.y;
+		}
+		results.push_back(TimeKernel("RayPlaneIntersect", "hit", plane, planeHits, iterations, &Geometry::RayPlaneIntersect));
+		results.push_back(TimeKernel("RayPlaneIntersect", "miss", plane, planeMisses, iterations, &Geometry::RayPlaneIntersect));
+
+		// Triangle lies in the xz plane, centred on the origin
+		const Geometry::Triangle triangle = { { -5.0f, 0.0f, -3.0f }, { 5.0f, 0.0f, -3.0f }, { 0.0f, 0.0f, 6.0f } };
+		auto triangleHits = MakeRays(rng, glm::vec3(0.0f), 0.0f, 1.0f, true);
+		auto triangleMisses = MakeRays(rng, glm::vec3(0.0f), 8.0f, 20.0f, true);
+		results.push_back(TimeKernel("RayTriangleIntersect", "hit", triangle, triangleHits, iterations, &Geometry::RayTriangleIntersect));
+		results.push_back(TimeKernel("RayTriangleIntersect", "miss", triangle, triangleMisses, iterations, &Geometry::RayTriangleIntersect));
+
+		const Geometry::PrecomputedTriangle precomputed = Geometry::PrecomputeTriangle(triangle.m_v0, triangle.m_v1, triangle.m_v2);
+		results.push_back(TimeKernel("RayPrecomputedTriangleIntersect", "hit", precomputed, triangleHits, iterations, &Geometry::RayTriangleIntersect));
+		results.push_back(TimeKernel("RayPrecomputedTriangleIntersect", "miss", precomputed, triangleMisses, iterations, &Geometry::RayTriangleIntersect));
+
+		// A full block of copies of the triangle stacked below each other, so hits go through several
+		Geometry::TriangleBlock triangleBlock;
+		for (int i = 0; i < Geometry::TriangleBlock::Width; ++i)
+		{
+			const glm::vec3 offset(0.0f, -0.5f * i, 0.0f);
+			triangleBlock.Add(Geometry::PrecomputeTriangle(triangle.m_v0 + offset, triangle.m_v1 + offset, triangle.m_v2 + offset));
+		}
+		results.push_back(TimeKernel("RayTriangleBlockIntersect", "hit", triangleBlock, triangleHits, iterations, &RayTriangleBlockIntersect));
+		results.push_back(TimeKernel("RayTriangleBlockIntersect", "miss", triangleBlock, triangleMisses, iterations, &RayTriangleBlockIntersect));
+
+		return results;
+	}
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include <nlohmann/json.hpp>
+
+namespace Benchmarks
+{
+	// Times the single ray intersection kernels against fixed sets of hitting and missing rays
+	// Returns one entry per kernel + case
+	nlohmann::json RunKernelBenchmarks(int iterations);
+}
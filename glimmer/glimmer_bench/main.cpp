@@ -0,0 +1,122 @@
+#include "kernel_benchmarks.h"
+#include "scene_benchmarks.h"
+#include "kernel/platform.h"
+#include "kernel/log.h"
+#include "kernel/file_io.h"
+#include <string.h>
+#include <stdlib.h>
+
+// Raytracer benchmark suite, writes results as json for regression tracking
+// usage: glimmer_bench [-out glimmer_bench.json] [-iterations 1000] [-frames 5] [-threads 1,2,4,8] [-width 512] [-height 512] [-scene name] [-wavefront] [-lightcutoff 0] [-lightsamples 0] [-adaptive 1] [-nokernels] [-noscenes]
+int main(int argc, char* argv[])
+{
+	std::string outputFile = "glimmer_bench.json";
+	int kernelIterations = 1000;
+	bool runKernels = true, runScenes = true;
+	Benchmarks::SceneBenchmarkParameters sceneParams;
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const char* value = (i + 1) < argc ? argv[i + 1] : "";
+		if (strcmp(arg, "-nokernels") == 0)
+		{
+			runKernels = false;
+			continue;
+		}
+		else if (strcmp(arg, "-noscenes") == 0)
+		{
+			runScenes = false;
+			continue;
+		}
+		else if (strcmp(arg, "-wavefront") == 0)
+		{
+			sceneParams.m_wavefront = true;
+			continue;
+		}
+		else if (strcmp(arg, "-out") == 0)
+		{
+			outputFile = value;
+		}
+		else if (strcmp(arg, "-iterations") == 0)
+		{
+			kernelIterations = atoi(value);
+		}
+		else if (strcmp(arg, "-frames") == 0)
+		{
+			sceneParams.m_frames = atoi(value);
+		}
+		else if (strcmp(arg, "-width") == 0)
+		{
+			sceneParams.m_imageSize.x = atoi(value);
+		}
+		else if (strcmp(arg, "-height") == 0)
+		{
+			sceneParams.m_imageSize.y = atoi(value);
+		}
+		else if (strcmp(arg, "-lightcutoff") == 0)
+		{
+			sceneParams.m_lightCutoff = (float)atof(value);
+		}
+		else if (strcmp(arg, "-lightsamples") == 0)
+		{
+			sceneParams.m_lightSamples = atoi(value);
+		}
+		else if (strcmp(arg, "-adaptive") == 0)
+		{
+			sceneParams.m_adaptiveSamples = atoi(value);
+		}
+		else if (strcmp(arg, "-scene") == 0)
+		{
+			sceneParams.m_sceneFilter = value;
+		}
+		else if (strcmp(arg, "-threads") == 0)
+		{
+			sceneParams.m_threadCounts.clear();
+			for (const char* c = value; c != nullptr; c = strchr(c, ','))
+			{
+				c = (*c == ',') ? c + 1 : c;
+				sceneParams.m_threadCounts.push_back(atoi(c));
+			}
+		}
+		else
+		{
+			SDE_LOG("Unknown argument '%s'", arg);
+			return 1;
+		}
+		++i;
+	}
+	for (int threadCount : sceneParams.m_threadCounts)
+	{
+		if (threadCount <= 0)
+		{
+			SDE_LOG("Invalid thread count %d", threadCount);
+			return 1;
+		}
+	}
+	if (sceneParams.m_frames <= 0 || kernelIterations <= 0 || sceneParams.m_imageSize.x <= 0 || sceneParams.m_imageSize.y <= 0)
+	{
+		SDE_LOG("Frames, iterations and image size must be > 0");
+		return 1;
+	}
+
+	if (Kernel::Platform::Initialise(argc, argv, Kernel::Platform::Features::Headless) != Kernel::Platform::InitResult::InitOK)
+	{
+		return 1;
+	}
+
+	nlohmann::json results;
+	results["kernels"] = runKernels ? Benchmarks::RunKernelBenchmarks(kernelIterations) : nlohmann::json::array();
+	results["scenes"] = runScenes ? Benchmarks::RunSceneBenchmarks(sceneParams) : nlohmann::json::array();
+
+	Kernel::Platform::Shutdown();
+
+	std::string resultText = results.dump(2);
+	std::vector<uint8_t> fileData(resultText.begin(), resultText.end());
+	if (!Kernel::FileIO::SaveBinaryFile(outputFile.c_str(), fileData))
+	{
+		SDE_LOG("Failed to write %s", outputFile.c_str());
+		return 1;
+	}
+	SDE_LOG("Wrote %s", outputFile.c_str());
+	return 0;
+}
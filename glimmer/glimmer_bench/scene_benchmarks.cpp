@@ -0,0 +1,278 @@
+#include "scene_benchmarks.h"
+#include "cpu_raytracer.h"
+#include "sde/job_system.h"
+#include "kernel/thread.h"
+#include "kernel/log.h"
+#include <random>
+#include <algorithm>
+
+namespace Benchmarks
+{
+	namespace
+	{
+		struct CannedScene
+		{
+			const char* m_name;
+			void(*m_build)(Scene&);
+			int m_maxRecursion;
+		};
+
+		const Material c_diffuse = { 1.0f, Diffuse };
+		const Material c_reflective = { 0.001f, ReflectRefract };
+
+		void AddGroundAndSky(Scene& scene, const Material& groundMaterial)
+		{
+			scene.planes.push_back({ { { 0.0f, 1.0f, 0.0f }, { 0.0f, -100.0f, 0.0f } }, groundMaterial });
+			scene.skyColour = glm::vec3(0.8f, 0.8f, 0.8f);
+		}
+
+		void AddLights(Scene& scene, std::mt19937& rng, int count)
+		{
+			std::uniform_real_distribution<float> xzRange(-250.0f, 250.0f), yRange(200.0f, 500.0f), colourRange(0.0f, 1.0f / count);
+			for (int l = 0; l < count; ++l)
+			{
+				scene.lights.push_back({ { xzRange(rng), yRange(rng), xzRange(rng) }, { colourRange(rng), colourRange(rng), colourRange(rng) } });
+			}
+		}
+
+		void AddSpheres(Scene& scene, std::mt19937& rng, int count, float minRadius, float maxRadius, const Material& material)
+		{
+			std::uniform_real_distribution<float> xRange(-150.0f, 150.0f), yRange(-50.0f, 150.0f), zRange(0.0f, 200.0f), radiusRange(minRadius, maxRadius);
+			for (int s = 0; s < count; ++s)
+			{
+				scene.spheres.push_back({ { glm::vec4(xRange(rng), yRange(rng), zRange(rng), radiusRange(rng)) }, material });
+			}
+		}
+
+		// Lots of small diffuse spheres, stresses bvh traversal
+		void BuildManySpheres(Scene& scene)
+		{
+			std::mt19937 rng(1);
+			AddSpheres(scene, rng, 2000, 1.0f, 6.0f, c_diffuse);
+			AddLights(scene, rng, 4);
+			AddGroundAndSky(scene, c_diffuse);
+		}
+
+		// Everything reflects, stresses secondary rays
+		void BuildReflections(Scene& scene)
+		{
+			std::mt19937 rng(2);
+			AddSpheres(scene, rng, 40, 8.0f, 24.0f, c_reflective);
+			AddLights(scene, rng, 2);
+			AddGroundAndSky(scene, c_reflective);
+		}
+
+		Mesh TessellateSphere(const glm::vec3& centre, float radius, int segments)
+		{
+			auto pointOnSphere = [&](int u, int v)
+			{
+				float theta = glm::pi<float>() * v / segments;
+				float phi = glm::two_pi<float>() * u / segments;
+				return centre + radius * glm::vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+			};
+			Mesh mesh;
+			mesh.m_material = c_diffuse;
+			mesh.m_triangles.reserve(segments * segments * 2);
+			for (int v = 0; v < segments; ++v)
+			{
+				for (int u = 0; u < segments; ++u)
+				{
+					glm::vec3 p00 = pointOnSphere(u, v), p10 = pointOnSphere(u + 1, v);
+					glm::vec3 p01 = pointOnSphere(u, v + 1), p11 = pointOnSphere(u + 1, v + 1);
+					mesh.m_triangles.push_back(Geometry::PrecomputeTriangle(p00, p10, p11));
+					mesh.m_triangles.push_back(Geometry::PrecomputeTriangle(p00, p11, p01));
+				}
+			}
+			return mesh;
+		}
+
+		// Tessellated sphere with ~100k triangles
+		void BuildTriangleMesh(Scene& scene)
+		{
+			std::mt19937 rng(3);
+			scene.meshes.push_back(TessellateSphere({ 0.0f, 50.0f, 50.0f }, 90.0f, 224));
+			AddLights(scene, rng, 2);
+			AddGroundAndSky(scene, c_diffuse);
+		}
+
+		// 1000 copies of a ~8k triangle mesh, stresses instance traversal
+		void BuildInstances(Scene& scene)
+		{
+			std::mt19937 rng(6);
+			std::uniform_real_distribution<float> angleRange(0.0f, glm::two_pi<float>()), scaleRange(0.5f, 1.5f);
+			const uint32_t mesh = TraceBoi::AddInstancedMesh(scene, TessellateSphere(glm::vec3(0.0f), 6.0f, 64));
+			for (int z = 0; z < 25; ++z)
+			{
+				for (int x = 0; x < 40; ++x)
+				{
+					glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(-195.0f + x * 10.0f, -90.0f + (z % 5) * 2.0f, z * 16.0f));
+					transform = glm::rotate(transform, angleRange(rng), glm::vec3(0.0f, 1.0f, 0.0f));
+					transform = glm::scale(transform, glm::vec3(scaleRange(rng), scaleRange(rng), scaleRange(rng)));
+					scene.meshInstances.push_back({ mesh, transform });
+				}
+			}
+			AddLights(scene, rng, 2);
+			AddGroundAndSky(scene, c_diffuse);
+		}
+
+		// Rolling voxel terrain, 256x256 columns of up to 48 voxels, stresses block + voxel walks
+		void BuildVoxelTerrain(Scene& scene)
+		{
+			std::mt19937 rng(7);
+			auto model = std::make_shared<VoxelModel>();
+			model->SetVoxelSize(glm::vec3(1.5f));
+			for (int z = 0; z < 256; ++z)
+			{
+				for (int x = 0; x < 256; ++x)
+				{
+					const float height = 24.0f + 12.0f * sinf(x * 0.05f) * cosf(z * 0.07f) + 8.0f * sinf((x + z) * 0.13f);
+					Geometry::FillVoxels(*model, { x, 0, z }, { x, (int)height, z }, 1);
+				}
+			}
+			scene.voxelModels.push_back(model);
+			scene.voxelVolumes.push_back({ 0, { -192.0f, -100.0f, -20.0f }, c_diffuse });
+			AddLights(scene, rng, 2);
+			AddGroundAndSky(scene, c_diffuse);
+		}
+
+		// Few objects but every hit shades against lots of lights
+		void BuildManyLights(Scene& scene)
+		{
+			std::mt19937 rng(4);
+			AddSpheres(scene, rng, 50, 4.0f, 16.0f, c_diffuse);
+			AddLights(scene, rng, 64);
+			AddGroundAndSky(scene, c_diffuse);
+		}
+
+		// Lots of small lights spread over the ground, each only reaches a few objects
+		void BuildRangedLights(Scene& scene)
+		{
+			std::mt19937 rng(5);
+			AddSpheres(scene, rng, 200, 2.0f, 10.0f, c_diffuse);
+			std::uniform_real_distribution<float> xRange(-150.0f, 150.0f), yRange(-90.0f, 150.0f), zRange(0.0f, 200.0f), colourRange(0.0f, 0.5f);
+			for (int l = 0; l < 512; ++l)
+			{
+				scene.lights.push_back({ { xRange(rng), yRange(rng), zRange(rng) }, { colourRange(rng), colourRange(rng), colourRange(rng) }, 40.0f });
+			}
+			AddGroundAndSky(scene, c_diffuse);
+		}
+
+		const CannedScene c_scenes[] = {
+			{ "many_spheres", BuildManySpheres, 6 },
+			{ "reflections", BuildReflections, 8 },
+			{ "triangle_mesh", BuildTriangleMesh, 6 },
+			{ "many_lights", BuildManyLights, 6 },
+			{ "ranged_lights", BuildRangedLights, 6 },
+			{ "instances", BuildInstances, 6 },
+			{ "voxel_terrain", BuildVoxelTerrain, 6 },
+		};
+
+		nlohmann::json RayStatsToJson(const RayStats& stats, double seconds)
+		{
+			return {
+				{ "primary", stats.m_primaryRays },
+				{ "secondary", stats.m_secondaryRays },
+				{ "shadow", stats.m_shadowRays },
+				{ "missed", stats.m_missedRays },
+				{ "box_tests", stats.m_boxTests },
+				{ "sphere_tests", stats.m_sphereTests },
+				{ "plane_tests", stats.m_planeTests },
+				{ "triangle_tests", stats.m_triangleTests },
+				{ "voxel_tests", stats.m_voxelTests },
+				{ "primary_per_second", stats.m_primaryRays / seconds },
+				{ "secondary_per_second", stats.m_secondaryRays / seconds },
+				{ "shadow_per_second", stats.m_shadowRays / seconds }
+			};
+		}
+
+		// Blocks until a full frame has been traced, returns the trace time
+		double TraceFrame(CpuRaytracer& tracer, const Scene& scene, Render::Camera& camera)
+		{
+			while (!tracer.TryDrawScene(scene, camera))
+			{
+				Kernel::Thread::Sleep(1);
+			}
+			tracer.WaitForTrace();
+			tracer.Tick();
+			return tracer.GetLastDrawTime();
+		}
+	}
+
+	nlohmann::json RunSceneBenchmarks(const SceneBenchmarkParameters& params)
+	{
+		nlohmann::json results = nlohmann::json::array();
+
+		Render::Camera camera;
+		camera.SetFOVAndAspectRatio(51.52f, (float)params.m_imageSize.x / (float)params.m_imageSize.y);
+		camera.LookAt({ 0.0f, 50.0f, -200.0f }, { 0.0f, 50.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+		for (const auto& cannedScene : c_scenes)
+		{
+			if (std::string(cannedScene.m_name).find(params.m_sceneFilter) == std::string::npos)
+			{
+				continue;
+			}
+			Scene scene;
+			cannedScene.m_build(scene);
+
+			double baseThreadTime = 0.0;	// thread count * time for the first thread count
+			for (int threadCount : params.m_threadCounts)
+			{
+				SDE::JobSystem jobSystem(threadCount);
+				jobSystem.Initialise();
+				std::vector<double> frameTimes;
+				RayStats rayStats;		// Same every frame, so only the last is kept
+				{
+					CpuRaytracer::Parameters tracerParams;
+					tracerParams.m_jobSystem = &jobSystem;
+					tracerParams.m_jobCount = threadCount * 2;
+					tracerParams.m_maxRecursion = cannedScene.m_maxRecursion;
+					tracerParams.m_progressive = false;
+					tracerParams.m_wavefront = params.m_wavefront;
+					tracerParams.m_lightCutoff = params.m_lightCutoff;
+					tracerParams.m_lightSamples = params.m_lightSamples;
+					tracerParams.m_adaptive.m_maxSamples = params.m_adaptiveSamples;
+					tracerParams.m_image.m_dimensions = params.m_imageSize;
+					CpuRaytracer tracer(tracerParams);
+
+					TraceFrame(tracer, scene, camera);		// Warm up, also builds the bvh
+					for (int f = 0; f < params.m_frames; ++f)
+					{
+						frameTimes.push_back(TraceFrame(tracer, scene, camera));
+					}
+					rayStats = tracer.GetRayStats();
+				}
+				jobSystem.Shutdown();
+
+				std::sort(frameTimes.begin(), frameTimes.end());
+				const double bestTime = frameTimes.front();
+				const double medianTime = frameTimes[frameTimes.size() / 2];
+				if (baseThreadTime == 0.0)
+				{
+					baseThreadTime = bestTime * threadCount;
+				}
+				const double scalingEfficiency = baseThreadTime / (bestTime * threadCount);
+				const double rayCount = (double)rayStats.TotalRays();
+				SDE_LOG("%s, %d threads: %fs best, %fs median, %f Mrays/s, %.1f%% scaling", cannedScene.m_name, threadCount, bestTime, medianTime,
+					(rayCount / bestTime) / 1000000.0, scalingEfficiency * 100.0);
+				results.push_back({
+					{ "scene", cannedScene.m_name },
+					{ "threads", threadCount },
+					{ "wavefront", params.m_wavefront },
+					{ "light_cutoff", params.m_lightCutoff },
+					{ "light_samples", params.m_lightSamples },
+					{ "adaptive_samples", params.m_adaptiveSamples },
+					{ "frames", params.m_frames },
+					{ "width", params.m_imageSize.x },
+					{ "height", params.m_imageSize.y },
+					{ "seconds_best", bestTime },
+					{ "seconds_median", medianTime },
+					{ "rays_per_second", rayCount / bestTime },
+					{ "ns_per_ray", (bestTime * 1000000000.0) / rayCount },
+					{ "scaling_efficiency", scalingEfficiency },
+					{ "rays", RayStatsToJson(rayStats, bestTime) }
+				});
+			}
+		}
+		return results;
+	}
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include "math/glm_headers.h"
+#include <nlohmann/json.hpp>
+#include <vector>
+#include <string>
+
+namespace Benchmarks
+{
+	struct SceneBenchmarkParameters
+	{
+		std::vector<int> m_threadCounts = { 1, 2, 4, 8 };	// Scaling efficiency is relative to the first entry
+		glm::ivec2 m_imageSize = { 512, 512 };
+		int m_frames = 5;					// Timed frames per run, after one warm-up frame
+		std::string m_sceneFilter;			// Only run scenes whose name contains this
+		bool m_wavefront = false;			// Use the wavefront integrator instead of recursive tracing
+		float m_lightCutoff = 0.0f;			// See CpuRaytracer::Parameters
+		int m_lightSamples = 0;
+		int m_adaptiveSamples = 1;			// Max primary rays per pixel for adaptive supersampling, 1 = off
+	};
+
+	// Traces full frames of each canned scene with the CpuRaytracer at each thread count
+	// Returns one entry per scene + thread count
+	nlohmann::json RunSceneBenchmarks(const SceneBenchmarkParameters& params);
+}
@@ -0,0 +1,299 @@
+#include "batch_render_system.h"
+#include "kernel/thread.h"
+#include "kernel/log.h"
+#include "core/timer.h"
+#include "core/system_enumerator.h"
+#include "sde/job_system.h"
+#include "sde/script_system.h"
+#include "bitmap_file_writer.h"
+#include "raw_file_buffer.h"
+#include "raw_file_io.h"
+#include "image.h"
+#include "scene_cache.h"
+#include "socket_connection.h"
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+
+bool BatchRenderSystem::ParseCommandLine(int argc, char* argv[], Parameters& params)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		if (strcmp(arg, "-wavefront") == 0)
+		{
+			params.m_wavefront = true;
+			continue;
+		}
+		if (strcmp(arg, "-denoise") == 0)
+		{
+			params.m_denoise = true;
+			continue;
+		}
+		if (strcmp(arg, "-nocache") == 0)
+		{
+			params.m_sceneCache = false;
+			continue;
+		}
+		if (strcmp(arg, "-reinhard") == 0)
+		{
+			params.m_toneMap.m_reinhard = true;
+			continue;
+		}
+		if (strcmp(arg, "-gamma") == 0)
+		{
+			params.m_toneMap.m_gammaCorrect = true;
+			continue;
+		}
+		const char* value = (i + 1) < argc ? argv[i + 1] : nullptr;
+		if (value == nullptr)
+		{
+			return false;
+		}
+		if (strcmp(arg, "-scene") == 0)
+		{
+			params.m_sceneFile = value;
+		}
+		else if (strcmp(arg, "-out") == 0)
+		{
+			params.m_outputFile = value;
+		}
+		else if (strcmp(arg, "-width") == 0)
+		{
+			params.m_imageSize.x = atoi(value);
+		}
+		else if (strcmp(arg, "-height") == 0)
+		{
+			params.m_imageSize.y = atoi(value);
+		}
+		else if (strcmp(arg, "-samples") == 0)
+		{
+			params.m_samples = atoi(value);
+		}
+		else if (strcmp(arg, "-recursion") == 0)
+		{
+			params.m_maxRecursion = atoi(value);
+		}
+		else if (strcmp(arg, "-threads") == 0)
+		{
+			params.m_threadCount = atoi(value);
+		}
+		else if (strcmp(arg, "-jobs") == 0)
+		{
+			params.m_jobCount = atoi(value);
+		}
+		else if (strcmp(arg, "-adaptive") == 0)
+		{
+			params.m_adaptiveSamples = atoi(value);
+		}
+		else if (strcmp(arg, "-tileWorker") == 0)
+		{
+			params.m_tileWorkers.push_back(value);
+		}
+		else if (strcmp(arg, "-loopbackWorkers") == 0)
+		{
+			params.m_loopbackWorkers = atoi(value);
+		}
+		else if (strcmp(arg, "-loopbackWorkerThreads") == 0)
+		{
+			params.m_loopbackWorkerThreads = atoi(value);
+		}
+		else if (strcmp(arg, "-workerPort") == 0)
+		{
+			params.m_workerPort = atoi(value);
+		}
+		else if (strcmp(arg, "-exposure") == 0)
+		{
+			params.m_toneMap.m_exposure = (float)atof(value);
+		}
+		else
+		{
+			return false;
+		}
+		++i;
+	}
+	if (params.m_threadCount == 0)
+	{
+		params.m_threadCount = std::max(1, (int)std::thread::hardware_concurrency());	// 0 if it cannot be detected
+	}
+	if (params.m_jobCount == 0)
+	{
+		params.m_jobCount = params.m_threadCount;
+	}
+	return params.m_threadCount > 0 && params.m_imageSize.x > 0 && params.m_imageSize.y > 0 && params.m_samples > 0 && params.m_jobCount > 0 && params.m_adaptiveSamples > 0 && params.m_loopbackWorkers >= 0 && params.m_loopbackWorkerThreads > 0
+		&& params.m_workerPort >= 0 && params.m_workerPort <= 65535;
+}
+
+BatchRenderSystem::BatchRenderSystem(const Parameters& params, int& exitCode)
+	: m_parameters(params)
+	, m_exitCode(exitCode)
+{
+	m_exitCode = 1;		// Only cleared once the image is written
+}
+
+BatchRenderSystem::~BatchRenderSystem()
+{
+}
+
+bool BatchRenderSystem::PreInit(Core::ISystemEnumerator& systemEnumerator)
+{
+	m_jobSystem = (SDE::JobSystem*)systemEnumerator.GetSystem("Jobs");
+	m_scriptSystem = (SDE::ScriptSystem*)systemEnumerator.GetSystem("Script");
+
+	CpuRaytracer::Parameters params;
+	params.m_jobSystem = m_jobSystem;
+	params.m_jobCount = m_parameters.m_jobCount;
+	params.m_maxRecursion = m_parameters.m_maxRecursion;
+	params.m_progressive = m_parameters.m_samples > 1;
+	params.m_maxSamples = m_parameters.m_samples;
+	params.m_wavefront = m_parameters.m_wavefront;
+	params.m_denoise = m_parameters.m_denoise;
+	params.m_adaptive.m_maxSamples = m_parameters.m_adaptiveSamples;
+	params.m_toneMap = m_parameters.m_toneMap;
+	params.m_image.m_dimensions = m_parameters.m_imageSize;
+	for (const std::string& address : m_parameters.m_tileWorkers)
+	{
+		std::string errorText;
+		std::shared_ptr<IWireConnection> connection = SocketConnection::Connect(address, errorText);
+		if (connection == nullptr)
+		{
+			SDE_LOG("Failed to connect to tile worker %s - %s", address.c_str(), errorText.c_str());
+			return false;
+		}
+		params.m_tileWorkers.push_back(connection);
+	}
+	if (!m_parameters.m_tileWorkers.empty())
+	{
+		SDE_LOG("Tracing with %d tile worker processes", (int)m_parameters.m_tileWorkers.size());
+	}
+	for (int w = 0; w < m_parameters.m_loopbackWorkers; ++w)
+	{
+		std::shared_ptr<IWireConnection> coordinatorEnd, workerEnd;
+		CreateLoopbackConnection(coordinatorEnd, workerEnd);
+		auto loopback = std::make_unique<LoopbackWorker>();
+		loopback->m_jobSystem = std::make_unique<SDE::JobSystem>(m_parameters.m_loopbackWorkerThreads);
+		loopback->m_jobSystem->Initialise();
+		TileWorker::Parameters workerParams;
+		workerParams.m_jobSystem = loopback->m_jobSystem.get();
+		workerParams.m_maxTilesInFlight = m_parameters.m_loopbackWorkerThreads * 2;
+		loopback->m_worker = std::make_unique<TileWorker>(workerParams, workerEnd);
+		TileWorker* worker = loopback->m_worker.get();
+		loopback->m_thread = std::thread([worker]()
+		{
+			worker->Run();
+		});
+		m_loopbackWorkers.push_back(std::move(loopback));
+		params.m_tileWorkers.push_back(coordinatorEnd);
+	}
+	if (!m_loopbackWorkers.empty())
+	{
+		SDE_LOG("Tracing with %d loopback tile workers of %d threads each", (int)m_loopbackWorkers.size(), m_parameters.m_loopbackWorkerThreads);
+	}
+	m_cpuTracer = std::make_unique<CpuRaytracer>(params);
+
+	return true;
+}
+
+bool BatchRenderSystem::LoadScene()
+{
+	const std::string cachePath = m_parameters.m_sceneFile + ".cache";
+	std::string errorText;
+	bool fromCache = false;
+	if (!SceneCache::LoadScene(*m_scriptSystem, m_parameters.m_sceneFile.c_str(), m_parameters.m_sceneCache ? cachePath.c_str() : nullptr, m_scene, fromCache, errorText))
+	{
+		SDE_LOG("Error loading %s - %s", m_parameters.m_sceneFile.c_str(), errorText.data());
+		return false;
+	}
+	if (fromCache)
+	{
+		SDE_LOG("Loaded the scene from %s", cachePath.c_str());
+	}
+
+	// Same camera as the interactive app
+	m_camera.SetFOVAndAspectRatio(51.52f, (float)m_parameters.m_imageSize.x / (float)m_parameters.m_imageSize.y);
+	m_camera.LookAt({ 0.0f, 50.0f, -200.0f }, { 0.0f, 50.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+	return true;
+}
+
+bool BatchRenderSystem::PostInit()
+{
+	Core::Timer timer;
+	m_startTime = timer.GetSeconds();
+	if (!LoadScene())
+	{
+		return false;
+	}
+	SDE_LOG("Loaded %s in %fs (%d spheres, %d planes, %d meshes, %d mesh instances, %d voxel volumes, %d lights)", m_parameters.m_sceneFile.c_str(), timer.GetSeconds() - m_startTime,
+		(int)m_scene.spheres.size(), (int)m_scene.planes.size(), (int)m_scene.meshes.size(), (int)m_scene.meshInstances.size(), (int)m_scene.voxelVolumes.size(), (int)m_scene.lights.size());
+	return true;
+}
+
+bool BatchRenderSystem::Tick()
+{
+	m_cpuTracer->TryDrawScene(m_scene, m_camera);
+	if (m_cpuTracer->Tick())
+	{
+		m_totalTraceTime += m_cpuTracer->GetLastDrawTime();
+		++m_tracesCompleted;
+		const RayStats& rayStats = m_cpuTracer->GetRayStats();
+		SDE_LOG("Sample %d/%d traced in %fs (%f Mrays/s, load balance %.1f%%)", m_tracesCompleted, m_parameters.m_samples, m_cpuTracer->GetLastDrawTime(),
+			(rayStats.TotalRays() / m_cpuTracer->GetLastDrawTime()) / 1000000.0, m_cpuTracer->GetLoadBalance() * 100.0);
+
+		if (m_tracesCompleted >= m_parameters.m_samples)
+		{
+			const uint64_t pixelCount = (uint64_t)m_parameters.m_imageSize.x * m_parameters.m_imageSize.y * m_tracesCompleted;
+			SDE_LOG("Traced %d samples in %fs (%f Mpixels/s)", m_tracesCompleted, m_totalTraceTime, (pixelCount / m_totalTraceTime) / 1000000.0);
+			if (WriteOutput())
+			{
+				m_exitCode = 0;
+			}
+			Core::Timer timer;
+			SDE_LOG("Total time %fs", timer.GetSeconds() - m_startTime);
+			return false;
+		}
+	}
+
+	// Nothing else runs on the main thread, so don't steal time from the workers
+	Kernel::Thread::Sleep(1);
+	return true;
+}
+
+bool BatchRenderSystem::WriteOutput()
+{
+	// Image is bottom-up, trace output is top-down
+	const auto& output = m_cpuTracer->GetOutput();
+	const glm::ivec2 size = m_parameters.m_imageSize;
+	Image image(size.x, size.y);
+	for (int y = 0; y < size.y; ++y)
+	{
+		for (int x = 0; x < size.x; ++x)
+		{
+			const uint32_t rgba = output[(y * size.x) + x];
+			image.SetPixelColour(x, size.y - 1 - y, ColourRGB((uint8_t)(rgba & 0xff), (uint8_t)((rgba >> 8) & 0xff), (uint8_t)((rgba >> 16) & 0xff)));
+		}
+	}
+
+	RawFileBuffer fileBuffer;
+	BitmapFileWriter bitmapWriter;
+	RawFileBufferWriter fileWriter;
+	if (!bitmapWriter.WriteFile(image, fileBuffer) || !fileWriter.WriteTofile(m_parameters.m_outputFile, fileBuffer))
+	{
+		SDE_LOG("Failed to write %s", m_parameters.m_outputFile.c_str());
+		return false;
+	}
+	SDE_LOG("Wrote %s", m_parameters.m_outputFile.c_str());
+	return true;
+}
+
+void BatchRenderSystem::Shutdown()
+{
+	// Destroying the tracer closes the connections, which stops the workers
+	m_cpuTracer = nullptr;
+	for (auto& loopback : m_loopbackWorkers)
+	{
+		loopback->m_thread.join();
+		loopback->m_worker = nullptr;
+		loopback->m_jobSystem->Shutdown();
+	}
+	m_loopbackWorkers.clear();
+}
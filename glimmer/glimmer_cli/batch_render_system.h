@@ -0,0 +1,77 @@
+#pragma once
+
+#include "core/system.h"
+#include "cpu_raytracer.h"
+#include "tile_worker.h"
+#include "render/camera.h"
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+
+namespace SDE
+{
+	class JobSystem;
+	class ScriptSystem;
+}
+
+// Headless version of CpuRaytracerSystem
+// Loads a scene script, traces it with the job system, writes a bitmap and quits
+class BatchRenderSystem : public Core::ISystem
+{
+public:
+	struct Parameters
+	{
+		std::string m_sceneFile = "scene.lua";
+		bool m_sceneCache = true;		// Reuse the scene built by the last run of an unchanged script, see SceneCache
+		std::string m_outputFile = "glimmer.bmp";
+		glm::ivec2 m_imageSize = { 512, 512 };
+		int m_samples = 1;				// > 1 uses progressive accumulation
+		int m_maxRecursion = 6;
+		int m_threadCount = 0;			// Job system threads, 0 = one per hardware thread
+		int m_jobCount = 0;				// Trace jobs queued at once, 0 = one per job system thread
+		bool m_wavefront = false;		// Use the wavefront integrator
+		bool m_denoise = false;			// Denoise the image after every sample
+		int m_adaptiveSamples = 1;		// Max primary rays per pixel for adaptive supersampling, 1 = off
+		std::vector<std::string> m_tileWorkers;	// host:port of glimmer_cli processes started with -workerPort, they trace alongside the local jobs
+		int m_loopbackWorkers = 0;		// In-process tile workers on their own threads, only for testing the wire format without other processes
+		int m_loopbackWorkerThreads = 4;	// Size of each loopback worker's own job system
+		int m_workerPort = 0;			// If set, run as a tile worker listening on this port instead of rendering, see TileWorkerSystem
+		ToneMap::Parameters m_toneMap;
+	};
+
+	// Returns false if the command line was invalid
+	static bool ParseCommandLine(int argc, char* argv[], Parameters& params);
+
+	BatchRenderSystem(const Parameters& params, int& exitCode);	// exitCode is set when the render completes or fails
+	virtual ~BatchRenderSystem();
+
+	virtual bool PreInit(Core::ISystemEnumerator& systemEnumerator);
+	virtual bool PostInit();
+	virtual bool Tick();
+	virtual void Shutdown();
+
+private:
+	bool LoadScene();
+	bool WriteOutput();
+
+	// In-process stand-in for a worker process, with its own job system + a loopback connection
+	struct LoopbackWorker
+	{
+		std::unique_ptr<SDE::JobSystem> m_jobSystem;
+		std::unique_ptr<TileWorker> m_worker;
+		std::thread m_thread;
+	};
+
+	Parameters m_parameters;
+	int& m_exitCode;
+	Scene m_scene;
+	Render::Camera m_camera;
+	std::unique_ptr<CpuRaytracer> m_cpuTracer;
+	int m_tracesCompleted = 0;
+	double m_totalTraceTime = 0.0;
+	double m_startTime = 0.0;
+	SDE::JobSystem* m_jobSystem = nullptr;
+	SDE::ScriptSystem* m_scriptSystem = nullptr;
+	std::vector<std::unique_ptr<LoopbackWorker>> m_loopbackWorkers;
+};
@@ -0,0 +1,50 @@
+#include "sde/job_system.h"
+#include "sde/script_system.h"
+#include "engine/engine_startup.h"
+#include "core/system_registrar.h"
+#include "kernel/log.h"
+#include "batch_render_system.h"
+#include "tile_worker_system.h"
+
+// Headless batch renderer, no window or render device is created
+// With -workerPort it traces tiles for other glimmer_cli processes instead
+class SystemRegistration : public Engine::IAppSystemRegistrar
+{
+public:
+	SystemRegistration(const BatchRenderSystem::Parameters& params, int& exitCode)
+		: m_params(params)
+		, m_exitCode(exitCode)
+	{
+	}
+	void RegisterSystems(Core::ISystemRegistrar& systemManager)
+	{
+		systemManager.RegisterSystem("Jobs", new SDE::JobSystem(m_params.m_threadCount));
+		if (m_params.m_workerPort != 0)
+		{
+			systemManager.RegisterSystem("TileWorker", new TileWorkerSystem(static_cast<uint16_t>(m_params.m_workerPort), m_exitCode));
+			return;
+		}
+		systemManager.RegisterSystem("Script", new SDE::ScriptSystem());
+		systemManager.RegisterSystem("BatchRender", new BatchRenderSystem(m_params, m_exitCode));
+	}
+
+private:
+	BatchRenderSystem::Parameters m_params;
+	int& m_exitCode;
+};
+
+int main(int argc, char* argv[])
+{
+	BatchRenderSystem::Parameters params;
+	if (!BatchRenderSystem::ParseCommandLine(argc, argv, params))
+	{
+		SDE_LOG("usage: glimmer_cli [-scene scene.lua] [-nocache] [-out glimmer.bmp] [-width 512] [-height 512] [-samples 1] [-recursion 6] [-threads 0] [-jobs 0] [-wavefront] [-denoise] [-adaptive 1] [-tileWorker host:port]... [-loopbackWorkers 0] [-loopbackWorkerThreads 4] [-exposure 1] [-reinhard] [-gamma]");
+		SDE_LOG("   or: glimmer_cli -workerPort 9000 [-threads 0]");
+		return 1;
+	}
+
+	int exitCode = 1;
+	SystemRegistration sysRegistration(params, exitCode);
+	int engineResult = Engine::Run(sysRegistration, argc, argv, Kernel::Platform::Features::Headless);
+	return engineResult != 0 ? engineResult : exitCode;
+}
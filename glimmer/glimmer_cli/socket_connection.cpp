@@ -0,0 +1,248 @@
+#include "socket_connection.h"
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <limits.h>
+
+namespace
+{
+	const uint32_t c_maxMessageBytes = 1u << 30;		// Any longer is a corrupt length, not a real scene
+
+	// Every connection + listener holds one reference, winsock counts them
+	bool StartWinsock(std::string& errorText)
+	{
+		WSADATA data;
+		const int result = WSAStartup(MAKEWORD(2, 2), &data);
+		if (result != 0)
+		{
+			errorText = "WSAStartup failed (" + std::to_string(result) + ")";
+			return false;
+		}
+		return true;
+	}
+
+	std::string SocketError(const char* call)
+	{
+		return std::string(call) + " failed (" + std::to_string(WSAGetLastError()) + ")";
+	}
+
+	bool SendAll(SOCKET s, const uint8_t* data, size_t size)
+	{
+		while (size > 0)
+		{
+			const int sent = send(s, reinterpret_cast<const char*>(data), static_cast<int>(std::min<size_t>(size, INT_MAX)), 0);
+			if (sent <= 0)
+			{
+				return false;
+			}
+			data += sent;
+			size -= sent;
+		}
+		return true;
+	}
+
+	bool ReceiveAll(SOCKET s, uint8_t* data, size_t size)
+	{
+		while (size > 0)
+		{
+			const int received = recv(s, reinterpret_cast<char*>(data), static_cast<int>(std::min<size_t>(size, INT_MAX)), 0);
+			if (received <= 0)
+			{
+				return false;
+			}
+			data += received;
+			size -= received;
+		}
+		return true;
+	}
+
+	// Takes ownership of a connected socket + one winsock reference
+	class SocketWireConnection : public IWireConnection
+	{
+	public:
+		explicit SocketWireConnection(SOCKET s)
+			: m_socket(s)
+		{
+			// Messages are small and latency bound (pulls, tiles), don't wait to batch them
+			const BOOL noDelay = TRUE;
+			setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+		}
+
+		virtual ~SocketWireConnection()
+		{
+			Close();
+			closesocket(m_socket);
+			WSACleanup();
+		}
+
+		virtual bool Send(std::vector<uint8_t>&& message) override
+		{
+			const uint32_t size = static_cast<uint32_t>(message.size());
+			const uint8_t header[4] = { (uint8_t)size, (uint8_t)(size >> 8), (uint8_t)(size >> 16), (uint8_t)(size >> 24) };
+			std::lock_guard<std::mutex> lock(m_sendMutex);
+			if (m_closed || message.size() > c_maxMessageBytes)
+			{
+				return false;
+			}
+			if (!SendAll(m_socket, header, sizeof(header)) || !SendAll(m_socket, message.data(), message.size()))
+			{
+				Close();
+				return false;
+			}
+			return true;
+		}
+
+		// Only ever called from one thread
+		virtual bool Receive(std::vector<uint8_t>& message) override
+		{
+			uint8_t header[4];
+			if (m_closed || !ReceiveAll(m_socket, header, sizeof(header)))
+			{
+				Close();
+				return false;
+			}
+			const uint32_t size = header[0] | (header[1] << 8) | (header[2] << 16) | ((uint32_t)header[3] << 24);
+			if (size > c_maxMessageBytes)
+			{
+				Close();
+				return false;
+			}
+			message.resize(size);
+			if (!ReceiveAll(m_socket, message.data(), size))
+			{
+				Close();
+				return false;
+			}
+			return true;
+		}
+
+		// Shutdown wakes up blocked send + recv calls on other threads, the socket is only released by the destructor
+		virtual void Close() override
+		{
+			if (!m_closed.exchange(true))
+			{
+				shutdown(m_socket, SD_BOTH);
+			}
+		}
+
+	private:
+		SOCKET m_socket;
+		std::mutex m_sendMutex;		// Messages from different threads must not interleave
+		std::atomic<bool> m_closed = { false };
+	};
+}
+
+namespace SocketConnection
+{
+	std::shared_ptr<IWireConnection> Connect(const std::string& address, std::string& errorText)
+	{
+		const size_t colon = address.rfind(':');
+		if (colon == std::string::npos || colon == 0 || colon + 1 == address.size())
+		{
+			errorText = "Expected host:port, got '" + address + "'";
+			return nullptr;
+		}
+		if (!StartWinsock(errorText))
+		{
+			return nullptr;
+		}
+		const std::string host = address.substr(0, colon);
+		const std::string port = address.substr(colon + 1);
+		addrinfo hints = {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_protocol = IPPROTO_TCP;
+		addrinfo* addresses = nullptr;
+		if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0)
+		{
+			errorText = SocketError("getaddrinfo");
+			WSACleanup();
+			return nullptr;
+		}
+		SOCKET s = INVALID_SOCKET;
+		for (addrinfo* a = addresses; a != nullptr && s == INVALID_SOCKET; a = a->ai_next)
+		{
+			s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+			if (s != INVALID_SOCKET && connect(s, a->ai_addr, static_cast<int>(a->ai_addrlen)) == SOCKET_ERROR)
+			{
+				errorText = SocketError("connect");
+				closesocket(s);
+				s = INVALID_SOCKET;
+			}
+		}
+		freeaddrinfo(addresses);
+		if (s == INVALID_SOCKET)
+		{
+			WSACleanup();
+			return nullptr;
+		}
+		return std::make_shared<SocketWireConnection>(s);
+	}
+
+	Listener::Listener()
+		: m_socket(INVALID_SOCKET)
+	{
+	}
+
+	Listener::~Listener()
+	{
+		if (m_socket != INVALID_SOCKET)
+		{
+			closesocket(m_socket);
+		}
+		if (m_winsockStarted)
+		{
+			WSACleanup();
+		}
+	}
+
+	bool Listener::Listen(uint16_t port, std::string& errorText)
+	{
+		if (!m_winsockStarted)
+		{
+			if (!StartWinsock(errorText))
+			{
+				return false;
+			}
+			m_winsockStarted = true;
+		}
+		SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (s == INVALID_SOCKET)
+		{
+			errorText = SocketError("socket");
+			return false;
+		}
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_ANY);
+		address.sin_port = htons(port);
+		if (bind(s, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR || listen(s, 1) == SOCKET_ERROR)
+		{
+			errorText = SocketError("bind/listen");
+			closesocket(s);
+			return false;
+		}
+		m_socket = s;
+		return true;
+	}
+
+	std::shared_ptr<IWireConnection> Listener::Accept(std::string& errorText)
+	{
+		SOCKET s = accept(static_cast<SOCKET>(m_socket), nullptr, nullptr);
+		if (s == INVALID_SOCKET)
+		{
+			errorText = SocketError("accept");
+			return nullptr;
+		}
+		if (!StartWinsock(errorText))
+		{
+			closesocket(s);
+			return nullptr;
+		}
+		return std::make_shared<SocketWireConnection>(s);
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "wire_connection.h"
+#include <string>
+#include <stdint.h>
+
+// IWireConnection over a TCP socket, so tile workers can run in other processes or on other machines
+// Each message is sent as its length (4 bytes, little endian) followed by its bytes
+namespace SocketConnection
+{
+	// Connects to a worker listening at "host:port", returns nullptr and sets errorText on failure
+	std::shared_ptr<IWireConnection> Connect(const std::string& address, std::string& errorText);
+
+	// Worker side, accepts coordinators one at a time
+	class Listener
+	{
+	public:
+		Listener();
+		~Listener();
+		Listener(const Listener&) = delete;
+		Listener& operator=(const Listener&) = delete;
+
+		bool Listen(uint16_t port, std::string& errorText);		// On every interface
+		std::shared_ptr<IWireConnection> Accept(std::string& errorText);	// Blocks until a coordinator connects, nullptr on failure
+
+	private:
+		uintptr_t m_socket;		// SOCKET, kept out of the header so winsock is only included in one place
+		bool m_winsockStarted = false;
+	};
+}
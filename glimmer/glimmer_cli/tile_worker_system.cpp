@@ -0,0 +1,64 @@
+#include "tile_worker_system.h"
+#include "tile_worker.h"
+#include "kernel/log.h"
+#include "core/system_enumerator.h"
+#include "sde/job_system.h"
+#include <string>
+
+TileWorkerSystem::TileWorkerSystem(uint16_t port, int& exitCode)
+	: m_port(port)
+	, m_exitCode(exitCode)
+{
+	m_exitCode = 1;		// Only cleared once listening
+}
+
+TileWorkerSystem::~TileWorkerSystem()
+{
+}
+
+bool TileWorkerSystem::PreInit(Core::ISystemEnumerator& systemEnumerator)
+{
+	m_jobSystem = (SDE::JobSystem*)systemEnumerator.GetSystem("Jobs");
+	return true;
+}
+
+bool TileWorkerSystem::PostInit()
+{
+	std::string errorText;
+	if (!m_listener.Listen(m_port, errorText))
+	{
+		SDE_LOG("Failed to listen on port %d - %s", m_port, errorText.c_str());
+		return false;
+	}
+	m_exitCode = 0;
+	SDE_LOG("Tile worker with %d threads waiting for coordinators on port %d", m_jobSystem->GetThreadCount(), m_port);
+	return true;
+}
+
+// Nothing else runs on the main thread, so it can block until the coordinator is done
+bool TileWorkerSystem::Tick()
+{
+	std::string errorText;
+	std::shared_ptr<IWireConnection> connection = m_listener.Accept(errorText);
+	if (connection == nullptr)
+	{
+		SDE_LOG("Failed to accept a coordinator - %s", errorText.c_str());
+		m_exitCode = 1;
+		return false;
+	}
+	SDE_LOG("Coordinator connected");
+
+	TileWorker::Parameters params;
+	params.m_jobSystem = m_jobSystem;
+	params.m_maxTilesInFlight = m_jobSystem->GetThreadCount() * 2;
+	TileWorker worker(params, connection);
+	if (worker.Run())
+	{
+		SDE_LOG("Coordinator disconnected");
+	}
+	else
+	{
+		SDE_LOG("Disconnected a coordinator that sent a bad message");
+	}
+	return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "core/system.h"
+#include "socket_connection.h"
+#include <stdint.h>
+
+namespace SDE
+{
+	class JobSystem;
+}
+
+// Headless tile worker process, traces tiles for glimmer_cli coordinators that connect over a socket (-tileWorker host:port)
+// Serves one coordinator at a time with the whole job system, then waits for the next until the process is stopped
+class TileWorkerSystem : public Core::ISystem
+{
+public:
+	TileWorkerSystem(uint16_t port, int& exitCode);		// exitCode is set if the port cannot be listened on
+	virtual ~TileWorkerSystem();
+
+	virtual bool PreInit(Core::ISystemEnumerator& systemEnumerator);
+	virtual bool PostInit();
+	virtual bool Tick();
+
+private:
+	uint16_t m_port;
+	int& m_exitCode;
+	SDE::JobSystem* m_jobSystem = nullptr;
+	SocketConnection::Listener m_listener;
+};